@@ -0,0 +1,373 @@
+#pragma once
+#include <cstdint>
+#include <cmath>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <ostream>
+#include <iomanip>
+#include <utility>
+#include <cstring>
+#include <type_traits>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include "utils.hpp"
+
+//statistical micro benchmark harness, each benchmark is warmed up, the iterations per sample are calibrated so one sample
+//outlasts the timer resolution and scheduler noise, then ns/op is reported as min/median/mean/p99/stddev over the samples
+
+//forces value to be materialized, so the computation producing it can't be dropped or hoisted out of the timed loop
+//register sized values may stay in a register, anything larger is pinned in memory
+template <typename T>
+ALWAYS_INLINE void DoNotOptimize(const T &value) noexcept
+{
+#if defined(__GNUC__)
+    if constexpr (std::is_trivially_copyable_v<T> && sizeof(T) <= sizeof(void *))
+        asm volatile("" : : "r,m"(value) : "memory");
+    else
+        asm volatile("" : : "m"(value) : "memory");
+#else
+    static volatile const void *sink;
+    sink = &value;
+#endif
+}
+template <typename T>
+ALWAYS_INLINE void DoNotOptimize(T &value) noexcept
+{
+#if defined(__GNUC__)
+    if constexpr (std::is_trivially_copyable_v<T> && sizeof(T) <= sizeof(void *))
+        asm volatile("" : "+r,m"(value) : : "memory");
+    else
+        asm volatile("" : "+m"(value) : : "memory");
+#else
+    static volatile void *sink;
+    sink = &value;
+#endif
+}
+//stops the compiler from caching memory across the barrier, for work whose only effect is stores
+ALWAYS_INLINE void ClobberMemory() noexcept
+{
+#if defined(__GNUC__)
+    asm volatile("" : : : "memory");
+#endif
+}
+
+//cycles, instructions and cache misses for the calling thread through one perf_event_open group
+//silently unavailable off Linux or when perf_event_paranoid forbids it, Available() tells which
+class PerfCounters
+{
+private:
+    int fds[3] = {-1, -1, -1};
+    bool available = false;
+
+#if defined(__linux__)
+    static int Open(uint64_t config, int group) noexcept
+    {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = config;
+        attr.disabled = group == -1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        return int(::syscall(SYS_perf_event_open, &attr, 0, -1, group, 0));
+    }
+#endif
+
+public:
+    struct Sample
+    {
+        uint64_t cycles = 0, instructions = 0, cacheMisses = 0;
+    };
+
+    PerfCounters() noexcept
+    {
+#if defined(__linux__)
+        fds[0] = Open(PERF_COUNT_HW_CPU_CYCLES, -1);
+        if (fds[0] < 0)
+            return;
+        fds[1] = Open(PERF_COUNT_HW_INSTRUCTIONS, fds[0]);
+        fds[2] = Open(PERF_COUNT_HW_CACHE_MISSES, fds[0]);
+        available = fds[1] >= 0 && fds[2] >= 0;
+#endif
+    }
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    bool Available() const noexcept { return available; }
+
+    void Start() noexcept
+    {
+#if defined(__linux__)
+        if (available)
+        {
+            ::ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ::ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+#endif
+    }
+    Sample Stop() noexcept
+    {
+        Sample s;
+#if defined(__linux__)
+        if (available)
+        {
+            ::ioctl(fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+            uint64_t buf[4] = {}; //nr, then one value per event in creation order
+            if (::read(fds[0], buf, sizeof(buf)) == ssize_t(sizeof(buf)) && buf[0] == 3)
+            {
+                s.cycles = buf[1];
+                s.instructions = buf[2];
+                s.cacheMisses = buf[3];
+            }
+        }
+#endif
+        return s;
+    }
+
+    ~PerfCounters() noexcept
+    {
+#if defined(__linux__)
+        for (const int fd : fds)
+        {
+            if (fd >= 0)
+                ::close(fd);
+        }
+#endif
+    }
+};
+
+struct BenchOptions
+{
+    std::chrono::nanoseconds warmup = std::chrono::milliseconds(100); //run untimed for at least this long first
+    std::chrono::nanoseconds sampleTime = std::chrono::milliseconds(10); //calibrated length of one sample
+    size_t samples = 30;
+    bool counters = true; //read PerfCounters per sample when they are available
+};
+
+//all times are nanoseconds per operation, counters are per operation and NaN when unavailable
+struct BenchResult
+{
+    std::string name;
+    uint64_t iterations = 0; //operations per sample
+    size_t samples = 0;
+    double min = 0, median = 0, mean = 0, p99 = 0, stddev = 0;
+    double itemsPerOp = 0; //caller defined work per operation (flops, bytes, elements), 0 when not given
+    double cycles = std::numeric_limits<double>::quiet_NaN();
+    double instructions = std::numeric_limits<double>::quiet_NaN();
+    double cacheMisses = std::numeric_limits<double>::quiet_NaN();
+
+    //items per second at the median
+    double Throughput() const noexcept { return itemsPerOp > 0 && median > 0 ? itemsPerOp * 1e9 / median : 0; }
+};
+
+class Bench
+{
+private:
+    BenchOptions opts;
+    PerfCounters counters;
+    std::vector<BenchResult> results;
+
+    using clock = std::chrono::steady_clock;
+
+    template <typename F>
+    static std::chrono::nanoseconds TimeBatch(F &f, uint64_t iterations)
+    {
+        const auto t1 = clock::now();
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            f();
+            ClobberMemory();
+        }
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - t1);
+    }
+
+    static double Percentile(const std::vector<double> &sorted, double p) noexcept
+    {
+        //nearest rank, with few samples p99 is the slowest sample
+        const size_t rank = size_t(std::ceil(p * double(sorted.size())));
+        return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+    }
+
+    static void WriteJSONString(std::ostream &os, const std::string &s)
+    {
+        os << '"';
+        for (const char c : s)
+        {
+            if (c == '"' || c == '\\')
+                os << '\\' << c;
+            else if (static_cast<unsigned char>(c) < 0x20)
+                os << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c) << std::dec << std::setfill(' ');
+            else
+                os << c;
+        }
+        os << '"';
+    }
+    static void WriteJSONNumber(std::ostream &os, double v)
+    {
+        if (std::isfinite(v))
+            os << v;
+        else
+            os << "null";
+    }
+
+public:
+    explicit Bench(BenchOptions options = {}) : opts(options) {}
+
+    bool CountersAvailable() const noexcept { return counters.Available(); }
+
+    //times f(), which performs one operation, itemsPerOp feeds Throughput()
+    template <typename F>
+    BenchResult Run(std::string name, double itemsPerOp, F &&f)
+    {
+        //calibration doubles as the start of the warmup, grow the batch until it fills one sample
+        uint64_t iterations = 1;
+        std::chrono::nanoseconds warmed{0};
+        for (;;)
+        {
+            const auto t = TimeBatch(f, iterations);
+            warmed += t;
+            if (t >= opts.sampleTime)
+                break;
+            const double scale = t.count() > 0 ? double(opts.sampleTime.count()) / double(t.count()) * 1.2 : 10.0;
+            iterations = std::max<uint64_t>(iterations + 1, uint64_t(double(iterations) * std::clamp(scale, 1.5, 10.0)));
+        }
+        while (warmed < opts.warmup)
+        {
+            warmed += TimeBatch(f, iterations);
+        }
+
+        const bool useCounters = opts.counters && counters.Available();
+        std::vector<double> ns(std::max<size_t>(opts.samples, 1));
+        PerfCounters::Sample total;
+        for (double &sample : ns)
+        {
+            if (useCounters)
+                counters.Start();
+            const auto t = TimeBatch(f, iterations);
+            if (useCounters)
+            {
+                const PerfCounters::Sample s = counters.Stop();
+                total.cycles += s.cycles;
+                total.instructions += s.instructions;
+                total.cacheMisses += s.cacheMisses;
+            }
+            sample = double(t.count()) / double(iterations);
+        }
+
+        BenchResult res;
+        res.name = std::move(name);
+        res.iterations = iterations;
+        res.samples = ns.size();
+        res.itemsPerOp = itemsPerOp;
+        res.mean = std::accumulate(ns.begin(), ns.end(), 0.0) / double(ns.size());
+        double var = 0;
+        for (const double v : ns)
+        {
+            var += pow2<double>(v - res.mean);
+        }
+        res.stddev = ns.size() > 1 ? std::sqrt(var / double(ns.size() - 1)) : 0.0;
+        std::sort(ns.begin(), ns.end());
+        res.min = ns.front();
+        res.median = ns.size() % 2 ? ns[ns.size() / 2] : (ns[ns.size() / 2 - 1] + ns[ns.size() / 2]) / 2;
+        res.p99 = Percentile(ns, 0.99);
+        if (useCounters)
+        {
+            const double ops = double(iterations) * double(ns.size());
+            res.cycles = double(total.cycles) / ops;
+            res.instructions = double(total.instructions) / ops;
+            res.cacheMisses = double(total.cacheMisses) / ops;
+        }
+        results.push_back(std::move(res));
+        return results.back();
+    }
+    template <typename F>
+    BenchResult Run(std::string name, F &&f) { return Run(std::move(name), 0.0, std::forward<F>(f)); }
+
+    const std::vector<BenchResult> &Results() const noexcept { return results; }
+
+    void PrintTable(std::ostream &os) const
+    {
+        const auto flags = os.flags();
+        const auto precision = os.precision();
+        size_t width = 4;
+        for (const BenchResult &r : results)
+        {
+            width = std::max(width, r.name.size());
+        }
+        os << std::left << std::setw(int(width)) << "name" << std::right << std::setw(14) << "min ns" << std::setw(14) << "median ns"
+           << std::setw(14) << "p99 ns" << std::setw(12) << "stddev %" << std::setw(14) << "items/s" << std::setw(12) << "cycles" << std::setw(12) << "misses" << '\n';
+        os << std::fixed;
+        for (const BenchResult &r : results)
+        {
+            os << std::left << std::setw(int(width)) << r.name << std::right << std::setprecision(2) << std::setw(14) << r.min << std::setw(14) << r.median
+               << std::setw(14) << r.p99 << std::setprecision(1) << std::setw(12) << (r.mean > 0 ? r.stddev * 100 / r.mean : 0.0);
+            os << std::setprecision(3) << std::setw(14) << std::scientific << r.Throughput() << std::fixed << std::setprecision(1);
+            if (std::isfinite(r.cycles))
+                os << std::setw(12) << r.cycles << std::setw(12) << r.cacheMisses;
+            else
+                os << std::setw(12) << '-' << std::setw(12) << '-';
+            os << '\n';
+        }
+        os.flags(flags);
+        os.precision(precision);
+    }
+
+    void WriteCSV(std::ostream &os) const
+    {
+        const auto precision = os.precision(10);
+        os << "name,iterations,samples,min_ns,median_ns,mean_ns,p99_ns,stddev_ns,items_per_op,items_per_s,cycles,instructions,cache_misses\n";
+        for (const BenchResult &r : results)
+        {
+            //names are quoted with inner quotes doubled, the usual CSV escaping
+            os << '"';
+            for (const char c : r.name)
+            {
+                os << c;
+                if (c == '"')
+                    os << '"';
+            }
+            os << "\"," << r.iterations << ',' << r.samples << ',' << r.min << ',' << r.median << ',' << r.mean << ',' << r.p99 << ',' << r.stddev << ','
+               << r.itemsPerOp << ',' << r.Throughput() << ',';
+            const double counted[] = {r.cycles, r.instructions, r.cacheMisses};
+            for (size_t i = 0; i < 3; ++i)
+            {
+                if (std::isfinite(counted[i]))
+                    os << counted[i];
+                os << (i < 2 ? ',' : '\n');
+            }
+        }
+        os.precision(precision);
+    }
+
+    void WriteJSON(std::ostream &os) const
+    {
+        const auto precision = os.precision(10);
+        os << "[\n";
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const BenchResult &r = results[i];
+            os << "  {\"name\": ";
+            WriteJSONString(os, r.name);
+            os << ", \"iterations\": " << r.iterations << ", \"samples\": " << r.samples;
+            const std::pair<const char *, double> fields[] = {{"min_ns", r.min}, {"median_ns", r.median}, {"mean_ns", r.mean}, {"p99_ns", r.p99}, {"stddev_ns", r.stddev}, {"items_per_op", r.itemsPerOp}, {"items_per_s", r.Throughput()}, {"cycles", r.cycles}, {"instructions", r.instructions}, {"cache_misses", r.cacheMisses}};
+            for (const auto &[key, v] : fields)
+            {
+                os << ", \"" << key << "\": ";
+                WriteJSONNumber(os, v);
+            }
+            os << (i + 1 < results.size() ? "},\n" : "}\n");
+        }
+        os << "]\n";
+        os.precision(precision);
+    }
+};
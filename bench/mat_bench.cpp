@@ -0,0 +1,560 @@
+//regression benchmarks for Mat, FastMat and FastMatBatch, there is no build system, compile directly:
+//  g++ -std=c++20 -O3 -march=native -pthread bench/mat_bench.cpp -o mat_bench
+//  ./mat_bench [--quick] [--filter substring] [--simd scalar|sse2|avx2|avx512] [--csv out.csv] [--json out.json]
+//--simd caps the dispatched kernels, build without -march=native to compare levels from one binary
+//cycle and cache miss columns need perf_event_open, e.g. sysctl kernel.perf_event_paranoid=1, and read "-" otherwise
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "../bench.hpp"
+#include "../mat.hpp"
+#include "../mat_io.hpp"
+#include "../mat_reduce.hpp"
+#include "../quant_mat.hpp"
+#include "../mat_transpose.hpp"
+#include "../mat_async.hpp"
+#include "../mat_pool.hpp"
+#include "../mat_lu.hpp"
+#include "../mat_conv.hpp"
+#include "../bit_mat.hpp"
+#include "../fast_mat.hpp"
+#include "../fast_mat_batch.hpp"
+
+struct Suite
+{
+    Bench bench;
+    std::string filter;
+    std::mt19937 rng{42};
+
+    explicit Suite(BenchOptions opts) : bench(opts) {}
+
+    bool Selected(std::string_view name) const { return filter.empty() || name.find(filter) != std::string_view::npos; }
+
+    template <typename F>
+    void Run(const std::string &name, double items, F &&f)
+    {
+        if (Selected(name))
+        {
+            const BenchResult r = bench.Run(name, items, std::forward<F>(f));
+            std::cerr << name << ": " << r.median << " ns\n";
+        }
+    }
+
+    template <typename M>
+    void Fill(M &m)
+    {
+        std::uniform_real_distribution<double> dist(-1, 1);
+        for (auto &v : m)
+        {
+            v = typename M::type(dist(rng));
+        }
+    }
+};
+
+static void MatBenchmarks(Suite &s, bool quick)
+{
+    for (const size_t n : quick ? std::vector<size_t>{64, 256} : std::vector<size_t>{64, 256, 512, 1024})
+    {
+        fMat a(n, n, mat_uninit), b(n, n, mat_uninit);
+        s.Fill(a);
+        s.Fill(b);
+        const std::string dim = std::to_string(n) + 'x' + std::to_string(n);
+        s.Run("Mat::Dot " + dim, 2.0 * n * n * n, [&]
+              {
+                  fMat c = a.Dot(b);
+                  DoNotOptimize(c.data()[0]);
+              });
+        s.Run("Mat::Dot transposed " + dim, 2.0 * n * n * n, [&]
+              {
+                  fMat c = a.Dot(b.TransposedView());
+                  DoNotOptimize(c.data()[0]);
+              });
+        fMat x(1, n, mat_uninit), xs(n, 4, mat_uninit);
+        s.Fill(x);
+        s.Fill(xs);
+        s.Run("Mat::Dot vector " + dim, 2.0 * n * n, [&]
+              {
+                  fMat y = a.Dot(x);
+                  DoNotOptimize(y.data()[0]);
+              });
+        s.Run("Mat::Dot vector transposed " + dim, 2.0 * n * n, [&]
+              {
+                  fMat y = a.TransposedView().Dot(x);
+                  DoNotOptimize(y.data()[0]);
+              });
+        s.Run("MatVecBatch x4 " + dim, 8.0 * n * n, [&]
+              {
+                  fMat y = MatVecBatch<float, size_t>(a, xs);
+                  DoNotOptimize(y.data()[0]);
+              });
+        const bfMat ha = MatCast<BFloat16>(a), hb = MatCast<BFloat16>(b);
+        s.Run("MixedDot bf16 " + dim, 2.0 * n * n * n, [&]
+              {
+                  fMat c = MixedDot<float>(ha, hb);
+                  DoNotOptimize(c.data()[0]);
+              });
+        const QuantMat<> qa(a), qb(b);
+        s.Run("QuantMat Dot int8 " + dim, 2.0 * n * n * n, [&]
+              {
+                  fMat c = Dot(qa, qb);
+                  DoNotOptimize(c.data()[0]);
+              });
+        //four independent Dot -> elementwise -> Sum chains, one after another and as an async graph
+        s.Run("pipeline x4 serial " + dim, 8.0 * n * n * n, [&]
+              {
+                  float total = 0;
+                  for (int i = 0; i < 4; ++i)
+                  {
+                      fMat c = a.Dot(b);
+                      fMat d = c * 2 + a;
+                      total += Sum(d);
+                  }
+                  DoNotOptimize(total);
+              });
+        MatAsync<float> graph;
+        const MatFuture<fMat> fa = graph.Value(a), fb = graph.Value(b);
+        s.Run("pipeline x4 MatAsync " + dim, 8.0 * n * n * n, [&]
+              {
+                  MatFuture<float> sums[4];
+                  for (auto &f : sums)
+                  {
+                      f = graph.Sum(graph.Map([](const auto &c, const auto &x) { return c * 2 + x; }, graph.Dot(fa, fb), fa));
+                  }
+                  float total = 0;
+                  for (auto &f : sums)
+                  {
+                      total += f.Get();
+                  }
+                  DoNotOptimize(total);
+              });
+    }
+
+    //small temporaries, where the heap round trip is a large part of the cost
+    for (const size_t n : quick ? std::vector<size_t>{32} : std::vector<size_t>{8, 32, 128})
+    {
+        fMat a(n, n, mat_uninit), b(n, n, mat_uninit);
+        s.Fill(a);
+        s.Fill(b);
+        const pfMat pa(a), pb(b);
+        const std::string dim = std::to_string(n) + 'x' + std::to_string(n);
+        s.Run("Mat temporaries " + dim, double(2 * n * n), [&]
+              {
+                  fMat e = a + b;
+                  fMat f = e * a;
+                  DoNotOptimize(f.data()[0]);
+              });
+        s.Run("PoolMat temporaries " + dim, double(2 * n * n), [&]
+              {
+                  pfMat e = pa + pb;
+                  pfMat f = e * pa;
+                  DoNotOptimize(f.data()[0]);
+              });
+    }
+
+    for (const size_t n : quick ? std::vector<size_t>{256} : std::vector<size_t>{256, 1024, 2048})
+    {
+        fMat a(n, n, mat_uninit), b(n, n, mat_uninit), c(n, n, mat_uninit), d(n, n);
+        s.Fill(a);
+        s.Fill(b);
+        s.Fill(c);
+        const std::string dim = std::to_string(n) + 'x' + std::to_string(n);
+        s.Run("Mat a*b+c*2 " + dim, double(n * n), [&]
+              {
+                  d = a * b + c * 2.0f;
+                  DoNotOptimize(d.data()[0]);
+              });
+        s.Run("Mat += scalar " + dim, double(n * n), [&]
+              {
+                  d += 1.0f;
+                  DoNotOptimize(d.data()[0]);
+              });
+        s.Run("Mat copy " + dim, double(n * n * sizeof(float)), [&]
+              {
+                  fMat e(a);
+                  DoNotOptimize(e.data()[0]);
+              });
+        s.Run("Sum " + dim, double(n * n), [&]
+              {
+                  float r = Sum(a);
+                  DoNotOptimize(r);
+              });
+        s.Run("Sum Kahan " + dim, double(n * n), [&]
+              {
+                  float r = Sum(a, MatSummation::Kahan);
+                  DoNotOptimize(r);
+              });
+        s.Run("ArgMax " + dim, double(n * n), [&]
+              {
+                  auto r = ArgMax(a);
+                  DoNotOptimize(r);
+              });
+        s.Run("ColSums " + dim, double(n * n), [&]
+              {
+                  fMat r = ColSums(a);
+                  DoNotOptimize(r.data()[0]);
+              });
+        s.Run("hash_combine per element " + dim, double(n * n * sizeof(float)), [&]
+              {
+                  size_t h = 0;
+                  for (const float v : a)
+                  {
+                      hash_combine(h, v);
+                  }
+                  DoNotOptimize(h);
+              });
+        s.Run("std::hash<Mat> " + dim, double(n * n * sizeof(float)), [&]
+              {
+                  size_t h = std::hash<fMat>{}(a);
+                  DoNotOptimize(h);
+              });
+        s.Run("Transpose " + dim, double(n * n * sizeof(float)), [&]
+              {
+                  TransposeInto(a, d);
+                  DoNotOptimize(d.data()[0]);
+              });
+        s.Run("TransposeInPlace " + dim, double(n * n * sizeof(float)), [&]
+              {
+                  TransposeInPlace(d);
+                  DoNotOptimize(d.data()[0]);
+              });
+        fMat r(n, n / 2 + 1, mat_uninit);
+        s.Fill(r);
+        s.Run("TransposeInPlace " + std::to_string(n) + 'x' + std::to_string(n / 2 + 1), double(r.SizeX() * r.SizeY() * sizeof(float)), [&]
+              {
+                  TransposeInPlace(r);
+                  DoNotOptimize(r.data()[0]);
+              });
+    }
+
+    {
+        const size_t n = quick ? 128 : 512;
+        fMat a(n, n, mat_uninit);
+        s.Fill(a);
+        const std::string dim = std::to_string(n) + 'x' + std::to_string(n);
+        const std::string text = a.Save();
+        s.Run("Mat::Save text " + dim, double(n * n), [&]
+              {
+                  std::string t = a.Save();
+                  DoNotOptimize(t.data()[0]);
+              });
+        s.Run("Mat::Load text " + dim, double(n * n), [&]
+              {
+                  fMat m = fMat::Load(text);
+                  DoNotOptimize(m.data()[0]);
+              });
+        std::stringstream bin;
+        SaveBinary(a, bin);
+        const std::string bytes = bin.str();
+        s.Run("LoadBinary " + dim, double(bytes.size()), [&]
+              {
+                  std::istringstream is(bytes);
+                  fMat m = LoadBinary<fMat>(is);
+                  DoNotOptimize(m.data()[0]);
+              });
+    }
+}
+
+//blocked LU against elimination over At, the way systems used to be solved by hand
+static void LUBenchmarks(Suite &s, bool quick)
+{
+    for (const size_t n : quick ? std::vector<size_t>{256} : std::vector<size_t>{256, 1024})
+    {
+        dMat a(n, n, mat_uninit), b(1, n, mat_uninit);
+        s.Fill(a);
+        s.Fill(b);
+        const std::string dim = std::to_string(n) + 'x' + std::to_string(n);
+        s.Run("elimination over At " + dim, 2.0 / 3.0 * n * n * n, [&]
+              {
+                  dMat m = a, x = b;
+                  for (size_t c = 0; c < n; ++c)
+                  {
+                      size_t p = c;
+                      for (size_t r = c + 1; r < n; ++r)
+                      {
+                          if (std::abs(m.At(c, r)) > std::abs(m.At(c, p)))
+                              p = r;
+                      }
+                      for (size_t j = 0; j < n; ++j)
+                      {
+                          std::swap(m.At(j, c), m.At(j, p));
+                      }
+                      std::swap(x.At(0, c), x.At(0, p));
+                      for (size_t r = c + 1; r < n; ++r)
+                      {
+                          const double f = m.At(c, r) / m.At(c, c);
+                          for (size_t j = c; j < n; ++j)
+                          {
+                              m.At(j, r) -= f * m.At(j, c);
+                          }
+                          x.At(0, r) -= f * x.At(0, c);
+                      }
+                  }
+                  for (size_t c = n; c-- > 0;)
+                  {
+                      double v = x.At(0, c);
+                      for (size_t q = c + 1; q < n; ++q)
+                      {
+                          v -= m.At(q, c) * x.At(0, q);
+                      }
+                      x.At(0, c) = v / m.At(c, c);
+                  }
+                  DoNotOptimize(x.data()[0]);
+              });
+        s.Run("Solve " + dim, 2.0 / 3.0 * n * n * n, [&]
+              {
+                  dMat x = Solve(a, b);
+                  DoNotOptimize(x.data()[0]);
+              });
+        s.Run("Inverse " + dim, 2.0 * n * n * n, [&]
+              {
+                  dMat x = Inverse(a);
+                  DoNotOptimize(x.data()[0]);
+              });
+    }
+}
+
+//2D convolution over At against the direct and im2col paths, one channel and a layer of many
+static void ConvBenchmarks(Suite &s, bool quick)
+{
+    struct Layer
+    {
+        size_t size, kernel, channels, batch;
+    };
+    const std::vector<Layer> layers = quick ? std::vector<Layer>{{256, 3, 1, 1}, {32, 3, 16, 4}}
+                                            : std::vector<Layer>{{256, 3, 1, 1}, {256, 5, 1, 1}, {32, 3, 4, 4}, {32, 3, 16, 4}, {32, 3, 64, 4}};
+    for (const Layer &l : layers)
+    {
+        const size_t n = l.size, k = l.kernel, c = l.channels;
+        const ConvParams p{.padX = k / 2, .padY = k / 2, .inChannels = c, .outChannels = c, .batch = l.batch};
+        fMat in(n, l.batch * c * n, mat_uninit), kernels(k, c * c * k, mat_uninit);
+        s.Fill(in);
+        s.Fill(kernels);
+        const std::string dim = std::to_string(n) + 'x' + std::to_string(n) + ' ' + std::to_string(k) + 'x' + std::to_string(k) + " c" + std::to_string(c) + " b" + std::to_string(l.batch);
+        const double flops = 2.0 * l.batch * c * c * k * k * n * n;
+        if (c == 1)
+        {
+            s.Run("conv over At " + dim, flops, [&]
+                  {
+                      fMat out(n, n);
+                      for (size_t y = 0; y < n; ++y)
+                      {
+                          for (size_t x = 0; x < n; ++x)
+                          {
+                              float v = 0;
+                              for (size_t ky = 0; ky < k; ++ky)
+                              {
+                                  for (size_t kx = 0; kx < k; ++kx)
+                                  {
+                                      const size_t iy = y + ky, ix = x + kx;
+                                      if (iy >= k / 2 && ix >= k / 2 && iy - k / 2 < n && ix - k / 2 < n)
+                                          v += kernels.At(kx, ky) * in.At(ix - k / 2, iy - k / 2);
+                                  }
+                              }
+                              out.At(x, y) = v;
+                          }
+                      }
+                      DoNotOptimize(out.data()[0]);
+                  });
+        }
+        for (const ConvPath path : {ConvPath::Direct, ConvPath::Im2col})
+        {
+            ConvParams q = p;
+            q.path = path;
+            s.Run(std::string(path == ConvPath::Direct ? "Conv2D direct " : "Conv2D im2col ") + dim, flops, [&]
+                  {
+                      fMat out = Conv2D(in, kernels, q);
+                      DoNotOptimize(out.data()[0]);
+                  });
+        }
+    }
+}
+
+//boolean adjacency matrices, one int per bit against 64 bits per word
+static void BitMatBenchmarks(Suite &s, bool quick)
+{
+    for (const size_t n : quick ? std::vector<size_t>{256} : std::vector<size_t>{256, 1024})
+    {
+        iMat a(n, n), sparse(n, n);
+        std::bernoulli_distribution half(0.5), few(8.0 / double(n));
+        for (size_t i = 0; i < n * n; ++i)
+        {
+            a.FastAt(i) = half(s.rng);
+            sparse.FastAt(i) = few(s.rng);
+        }
+        const BitMat bits(a), sparseBits(sparse);
+        const std::string dim = std::to_string(n) + 'x' + std::to_string(n);
+        s.Run("iMat boolean Dot " + dim, 2.0 * n * n * n, [&]
+              {
+                  iMat c = a.Dot(a);
+                  DoNotOptimize(c.data()[0]);
+              });
+        s.Run("BitMat::Dot " + dim, 2.0 * n * n * n, [&]
+              {
+                  BitMat c = bits.Dot(bits);
+                  DoNotOptimize(c.data()[0]);
+              });
+        s.Run("BitMat::Dot sparse " + dim, 2.0 * n * n * n, [&]
+              {
+                  BitMat c = sparseBits.Dot(bits);
+                  DoNotOptimize(c.data()[0]);
+              });
+        s.Run("iMat ColSums " + dim, double(n * n), [&]
+              {
+                  iMat c = ColSums(a);
+                  DoNotOptimize(c.data()[0]);
+              });
+        s.Run("BitMat::ColCounts " + dim, double(n * n), [&]
+              {
+                  Mat<size_t> c = bits.ColCounts();
+                  DoNotOptimize(c.data()[0]);
+              });
+        s.Run("BitMat::RowCounts " + dim, double(n * n), [&]
+              {
+                  Mat<size_t> c = bits.RowCounts();
+                  DoNotOptimize(c.data()[0]);
+              });
+        s.Run("BitMat::TransitiveClosure sparse " + dim, double(n) * n * n, [&]
+              {
+                  BitMat c = sparseBits.TransitiveClosure();
+                  DoNotOptimize(c.data()[0]);
+              });
+    }
+}
+
+template <size_t N, typename T>
+static void FastMatBenchmarks(Suite &s, const std::string &tag)
+{
+    FastMat<N, N, T> a{}, b{};
+    s.Fill(a);
+    s.Fill(b);
+    a += FastMat<N, N, T>::Identity() * T(N); //diagonally dominant, so always invertible
+    const std::string dim = std::to_string(N) + 'x' + std::to_string(N) + ' ' + tag;
+    s.Run("FastMat::Dot " + dim, 2.0 * N * N * N, [&]
+          {
+              DoNotOptimize(a);
+              auto c = a.Dot(b);
+              DoNotOptimize(c);
+          });
+    s.Run("FastMat::Inverse " + dim, 1, [&]
+          {
+              DoNotOptimize(a);
+              auto c = a.Inverse();
+              DoNotOptimize(c);
+          });
+    s.Run("FastMat::Determinant " + dim, 1, [&]
+          {
+              DoNotOptimize(a);
+              T d = a.Determinant();
+              DoNotOptimize(d);
+          });
+    s.Run("std::hash<FastMat> " + dim, 1, [&]
+          {
+              DoNotOptimize(a);
+              size_t h = std::hash<FastMat<N, N, T>>{}(a);
+              DoNotOptimize(h);
+          });
+}
+
+template <size_t N, typename T>
+static void FastMatBatchBenchmarks(Suite &s, const std::string &tag, size_t count)
+{
+    std::vector<FastMat<N, N, T>> mats(count);
+    for (auto &m : mats)
+    {
+        s.Fill(m);
+        m += FastMat<N, N, T>::Identity() * T(N);
+    }
+    FastMatBatch<N, N, T> a(mats), b(mats), c(count);
+    FastMatBatch<1, N, T> v(count), out(count);
+    const std::string dim = std::to_string(N) + 'x' + std::to_string(N) + ' ' + tag + " x" + std::to_string(count);
+    s.Run("FastMatBatch::Dot " + dim, double(count), [&]
+          {
+              DotInto(a, b, c);
+              DoNotOptimize(c.Tile(0, 0, 0)[0]);
+          });
+    s.Run("FastMatBatch::Transform " + dim, double(count), [&]
+          {
+              TransformInto(a, v, out);
+              DoNotOptimize(out.Tile(0, 0, 0)[0]);
+          });
+    s.Run("FastMatBatch::Inverse " + dim, double(count), [&]
+          {
+              InverseInto(a, c);
+              DoNotOptimize(c.Tile(0, 0, 0)[0]);
+          });
+    std::vector<FastMat<N, N, T>> out_mats(count);
+    s.Run("FastMat array Dot " + dim, double(count), [&]
+          {
+              for (size_t i = 0; i < count; ++i)
+              {
+                  out_mats[i] = mats[i].Dot(mats[i]);
+              }
+              DoNotOptimize(out_mats[0]);
+          });
+}
+
+int main(int argc, char **argv)
+{
+    BenchOptions opts;
+    bool quick = false;
+    std::string csv, json, filter;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string_view arg = argv[i];
+        if (arg == "--quick")
+        {
+            quick = true;
+        }
+        else if (arg == "--simd" && i + 1 < argc)
+        {
+            SimdForce(SimdParse(argv[++i], SimdDetected()));
+        }
+        else if ((arg == "--csv" || arg == "--json" || arg == "--filter") && i + 1 < argc)
+        {
+            (arg == "--csv" ? csv : arg == "--json" ? json : filter) = argv[++i];
+        }
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--quick] [--filter substring] [--simd scalar|sse2|avx2|avx512] [--csv out.csv] [--json out.json]\n";
+            return 1;
+        }
+    }
+    if (quick)
+    {
+        opts.warmup = std::chrono::milliseconds(20);
+        opts.sampleTime = std::chrono::milliseconds(2);
+        opts.samples = 10;
+    }
+
+    std::cerr << "simd: " << simd_level_names[size_t(SimdActive())] << " (cpu " << simd_level_names[size_t(SimdDetected())] << ")\n";
+    Suite s(opts);
+    s.filter = filter;
+    MatBenchmarks(s, quick);
+    LUBenchmarks(s, quick);
+    ConvBenchmarks(s, quick);
+    BitMatBenchmarks(s, quick);
+    FastMatBenchmarks<2, float>(s, "float");
+    FastMatBenchmarks<3, float>(s, "float");
+    FastMatBenchmarks<4, float>(s, "float");
+    FastMatBenchmarks<4, double>(s, "double");
+    FastMatBenchmarks<6, double>(s, "double");
+    FastMatBatchBenchmarks<4, float>(s, "float", quick ? 4096 : 1 << 16);
+    FastMatBatchBenchmarks<3, double>(s, "double", quick ? 4096 : 1 << 16);
+
+    s.bench.PrintTable(std::cout);
+    if (!csv.empty())
+    {
+        std::ofstream os(csv);
+        s.bench.WriteCSV(os);
+    }
+    if (!json.empty())
+    {
+        std::ofstream os(json);
+        s.bench.WriteJSON(os);
+    }
+    return 0;
+}
@@ -0,0 +1,227 @@
+//throughput of MPMCQueue and SPSCRing against a mutex protected std::queue, there is no build system, compile directly:
+//  g++ -std=c++20 -O3 -march=native -pthread bench/queue_bench.cpp -o queue_bench
+//  ./queue_bench [--quick] [--filter substring] [--csv out.csv] [--json out.json]
+//every run also checks that each item arrives exactly once, the process exits with 1 if one didn't
+#include <iostream>
+#include <fstream>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "../bench.hpp"
+#include "../lockfree_queue.hpp"
+
+//the baseline, a bounded std::queue behind one mutex with the same interface as the lock free queues
+template <typename T>
+class LockedQueue
+{
+private:
+    std::mutex mtx;
+    std::queue<T> q;
+    size_t cap;
+
+public:
+    explicit LockedQueue(size_t capacity) : cap(capacity) {}
+
+    size_t TryPushBatch(T *items, size_t n)
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        n = std::min(n, cap - q.size());
+        for (size_t i = 0; i < n; ++i)
+        {
+            q.push(std::move(items[i]));
+        }
+        return n;
+    }
+    size_t TryPopBatch(T *out, size_t n)
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        n = std::min(n, q.size());
+        for (size_t i = 0; i < n; ++i)
+        {
+            out[i] = std::move(q.front());
+            q.pop();
+        }
+        return n;
+    }
+    void Push(T v) { PushBatch(&v, 1); }
+    void Pop(T &out) { PopBatch(&out, 1); }
+    void PushBatch(T *items, size_t n)
+    {
+        while (n)
+        {
+            const size_t k = TryPushBatch(items, n);
+            items += k;
+            n -= k;
+            if (!k)
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+    size_t PopBatch(T *out, size_t n)
+    {
+        size_t k;
+        while (n && !(k = TryPopBatch(out, n)))
+        {
+            std::this_thread::yield();
+        }
+        return n ? k : 0;
+    }
+};
+
+struct Suite
+{
+    Bench bench;
+    std::string filter;
+    bool failed = false;
+
+    explicit Suite(BenchOptions opts) : bench(opts) {}
+
+    bool Selected(std::string_view name) const { return filter.empty() || name.find(filter) != std::string_view::npos; }
+
+    template <typename F>
+    void Run(const std::string &name, double items, F &&f)
+    {
+        if (Selected(name))
+        {
+            const BenchResult r = bench.Run(name, items, std::forward<F>(f));
+            std::cerr << name << ": " << r.median << " ns\n";
+        }
+    }
+};
+
+//producers push disjoint ranges of 1..items, consumers pop fixed shares in batches of batch (1 uses Push / Pop) and sum them
+template <typename Q>
+static bool Transfer(size_t producers, size_t consumers, size_t items, size_t batch)
+{
+    Q q(1024);
+    std::atomic<uint64_t> sum{0}, count{0};
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < producers; ++p)
+    {
+        threads.emplace_back([&, p]
+                             {
+                                 const size_t first = items * p / producers, last = items * (p + 1) / producers;
+                                 std::vector<uint64_t> buf(batch);
+                                 for (size_t i = first; i < last;)
+                                 {
+                                     const size_t k = std::min(batch, last - i);
+                                     for (size_t j = 0; j < k; ++j)
+                                     {
+                                         buf[j] = i + j + 1;
+                                     }
+                                     if (batch == 1)
+                                         q.Push(buf[0]);
+                                     else
+                                         q.PushBatch(buf.data(), k);
+                                     i += k;
+                                 }
+                             });
+    }
+    for (size_t c = 0; c < consumers; ++c)
+    {
+        threads.emplace_back([&, c]
+                             {
+                                 const size_t share = items * (c + 1) / consumers - items * c / consumers;
+                                 std::vector<uint64_t> buf(batch);
+                                 uint64_t s = 0;
+                                 for (size_t got = 0; got < share;)
+                                 {
+                                     size_t k = 1;
+                                     if (batch == 1)
+                                         q.Pop(buf[0]);
+                                     else
+                                         k = q.PopBatch(buf.data(), std::min(batch, share - got));
+                                     for (size_t j = 0; j < k; ++j)
+                                     {
+                                         s += buf[j];
+                                     }
+                                     got += k;
+                                 }
+                                 sum += s;
+                                 count += share;
+                             });
+    }
+    for (std::thread &t : threads)
+    {
+        t.join();
+    }
+    return count == items && sum == uint64_t(items) * (items + 1) / 2;
+}
+
+template <typename Q>
+static void QueueBenchmarks(Suite &s, const std::string &name, size_t producers, size_t consumers, size_t items, size_t batch)
+{
+    const std::string tag = name + ' ' + std::to_string(producers) + "P" + std::to_string(consumers) + "C" + (batch > 1 ? " batch " + std::to_string(batch) : "");
+    s.Run(tag, double(items), [&]
+          {
+              if (!Transfer<Q>(producers, consumers, items, batch))
+              {
+                  std::cerr << tag << ": lost or duplicated items\n";
+                  s.failed = true;
+              }
+          });
+}
+
+int main(int argc, char **argv)
+{
+    BenchOptions opts;
+    bool quick = false;
+    std::string csv, json, filter;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string_view arg = argv[i];
+        if (arg == "--quick")
+        {
+            quick = true;
+        }
+        else if ((arg == "--csv" || arg == "--json" || arg == "--filter") && i + 1 < argc)
+        {
+            (arg == "--csv" ? csv : arg == "--json" ? json : filter) = argv[++i];
+        }
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--quick] [--filter substring] [--csv out.csv] [--json out.json]\n";
+            return 1;
+        }
+    }
+    if (quick)
+    {
+        opts.warmup = std::chrono::milliseconds(20);
+        opts.sampleTime = std::chrono::milliseconds(2);
+        opts.samples = 10;
+    }
+    opts.counters = false; //counters would only see the spawning thread
+
+    Suite s(opts);
+    s.filter = filter;
+    const size_t items = quick ? size_t(1) << 16 : size_t(1) << 20;
+    for (const size_t batch : {size_t(1), size_t(32)})
+    {
+        QueueBenchmarks<LockedQueue<uint64_t>>(s, "mutex std::queue", 1, 1, items, batch);
+        QueueBenchmarks<SPSCRing<uint64_t>>(s, "SPSCRing", 1, 1, items, batch);
+        QueueBenchmarks<MPMCQueue<uint64_t>>(s, "MPMCQueue", 1, 1, items, batch);
+        for (const size_t threads : {size_t(2), size_t(4)})
+        {
+            QueueBenchmarks<LockedQueue<uint64_t>>(s, "mutex std::queue", threads, threads, items, batch);
+            QueueBenchmarks<MPMCQueue<uint64_t>>(s, "MPMCQueue", threads, threads, items, batch);
+            QueueBenchmarks<MPMCQueue<uint64_t, QueueWait::Block>>(s, "MPMCQueue blocking", threads, threads, items, batch);
+        }
+    }
+
+    s.bench.PrintTable(std::cout);
+    if (!csv.empty())
+    {
+        std::ofstream os(csv);
+        s.bench.WriteCSV(os);
+    }
+    if (!json.empty())
+    {
+        std::ofstream os(json);
+        s.bench.WriteJSON(os);
+    }
+    return s.failed ? 1 : 0;
+}
@@ -0,0 +1,447 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <vector>
+#include "mat.hpp"
+#include "mat_reduce.hpp"
+#include "tpool.hpp"
+
+//dense boolean matrix packed 64 bits per word, bit x of row y is bit x % 64 of word x / 64, rows are padded to whole words
+//and the padding bits are kept 0, so AND/OR/XOR/NOT and popcounts work on whole words without masking
+//Dot is the boolean product (OR of ANDs), Four Russians: 8 tables of every OR of 8 rows of B turn 64 bits of a row of A into 8 lookups
+
+//words of each result row one set of Dot tables covers, 8 tables of 256 entries of this many words stay in L2
+#ifndef BIT_MAT_BLOCK_WORDS
+#define BIT_MAT_BLOCK_WORDS 4
+#endif
+
+//words of A with at most this many bits set OR the rows of B directly instead of building the Dot tables
+#ifndef BIT_MAT_SPARSE_BITS
+#define BIT_MAT_SPARSE_BITS 6
+#endif
+
+class BitMat
+{
+private:
+    Mat<uint64_t> words; //Stride() words per row
+    size_t sizeX = 0, sizeY = 0;
+
+    uint64_t TailMask() const noexcept { return sizeX % 64 ? (uint64_t(1) << (sizeX % 64)) - 1 : ~uint64_t(0); }
+
+    //body(first, last) over [0, n) units of unitBits bits each, split across threads like MatParallelRange,
+    //which counts elements while a word op handles 64 at a time
+    template <typename F>
+    static void ParallelUnits(size_t n, size_t unitBits, F &&body)
+    {
+        MatParallelUnits(n, unitBits, MAT_PARALLEL_ELEMENTS * 64, MAT_PARALLEL_ELEMENTS * 16, body);
+    }
+
+    template <typename Op>
+    BitMat &Apply(const BitMat &mat, Op op, const char *who)
+    {
+        if (sizeX != mat.sizeX || sizeY != mat.sizeY)
+            throw std::invalid_argument(std::string(who) + ": parameter must match the dimensions of this");
+        uint64_t *dst = words.data();
+        const uint64_t *src = mat.words.data();
+        ParallelUnits(Stride() * sizeY, 64, [dst, src, op](size_t first, size_t last)
+                      {
+                          for (size_t i = first; i < last; ++i)
+                          {
+                              dst[i] = op(dst[i], src[i]);
+                          }
+                      });
+        return *this;
+    }
+
+public:
+    BitMat() = default;
+    //all bits 0
+    BitMat(size_t w, size_t h) : words((w + 63) / 64, h), sizeX(w), sizeY(h) {}
+    //bits set where the elements are nonzero
+    template <MatViewable M>
+    explicit BitMat(const M &);
+
+    static BitMat Identity(size_t n)
+    {
+        BitMat res(n, n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            res.Set(i, i);
+        }
+        return res;
+    }
+
+    size_t SizeX() const noexcept { return sizeX; }
+    size_t SizeY() const noexcept { return sizeY; }
+    //words per row
+    size_t Stride() const noexcept { return words.SizeX(); }
+    uint64_t *data() noexcept { return words.data(); } //padding bits must stay 0
+    const uint64_t *data() const noexcept { return words.data(); }
+
+    bool Get(size_t x, size_t y) const
+    {
+        MAT_BOUNDS((x < sizeX) && (y < sizeY), MatOutOfRange("Get", x, y));
+        return (words.data()[y * Stride() + x / 64] >> (x % 64)) & 1;
+    }
+    void Set(size_t x, size_t y, bool v = true)
+    {
+        MAT_BOUNDS((x < sizeX) && (y < sizeY), MatOutOfRange("Set", x, y));
+        uint64_t &w = words.data()[y * Stride() + x / 64];
+        w = (w & ~(uint64_t(1) << (x % 64))) | (uint64_t(v) << (x % 64));
+    }
+    void Flip(size_t x, size_t y)
+    {
+        MAT_BOUNDS((x < sizeX) && (y < sizeY), MatOutOfRange("Flip", x, y));
+        words.data()[y * Stride() + x / 64] ^= uint64_t(1) << (x % 64);
+    }
+
+    std::span<uint64_t> Row(size_t y)
+    {
+        MAT_BOUNDS(y < sizeY, MatOutOfRange("Row", y));
+        return {words.data() + y * Stride(), Stride()};
+    }
+    std::span<const uint64_t> Row(size_t y) const
+    {
+        MAT_BOUNDS(y < sizeY, MatOutOfRange("Row", y));
+        return {words.data() + y * Stride(), Stride()};
+    }
+
+    BitMat &operator&=(const BitMat &mat) { return Apply(mat, [](uint64_t a, uint64_t b) { return a & b; }, "operator&="); }
+    BitMat &operator|=(const BitMat &mat) { return Apply(mat, [](uint64_t a, uint64_t b) { return a | b; }, "operator|="); }
+    BitMat &operator^=(const BitMat &mat) { return Apply(mat, [](uint64_t a, uint64_t b) { return a ^ b; }, "operator^="); }
+    //a & ~b without the temporary
+    BitMat &AndNot(const BitMat &mat) { return Apply(mat, [](uint64_t a, uint64_t b) { return a & ~b; }, "AndNot"); }
+    friend BitMat operator&(BitMat a, const BitMat &b) { return a &= b; }
+    friend BitMat operator|(BitMat a, const BitMat &b) { return a |= b; }
+    friend BitMat operator^(BitMat a, const BitMat &b) { return a ^= b; }
+    BitMat operator~() const;
+
+    bool operator==(const BitMat &mat) const noexcept
+    {
+        return sizeX == mat.sizeX && sizeY == mat.sizeY && std::equal(words.data(), words.data() + Stride() * sizeY, mat.words.data());
+    }
+
+    //set bits, in total, per row (a 1 x SizeY() column) and per column (a SizeX() x 1 row)
+    size_t Count() const;
+    Mat<size_t> RowCounts() const;
+    Mat<size_t> ColCounts() const;
+
+    //boolean product, bit (x, y) is set when some k has (k, y) set in this and (x, k) set in mat
+    BitMat Dot(const BitMat &) const;
+    //bit (x, y) set when y reaches x through one or more edges of this adjacency matrix, Warshall a row at a time
+    BitMat TransitiveClosure() const;
+
+    //0 / 1 elements
+    template <typename T = int>
+    Mat<T> ToMat() const;
+};
+
+template <MatViewable M>
+inline BitMat::BitMat(const M &m) : BitMat(mat_const_view_t<M>(m).SizeX(), mat_const_view_t<M>(m).SizeY())
+{
+    using T = typename M::type;
+    const mat_const_view_t<M> v(m);
+    const size_t stride = Stride(), w = sizeX;
+    uint64_t *dst = words.data();
+    ParallelUnits(sizeY, stride * 64, [&v, dst, stride, w](size_t first, size_t last)
+                  {
+                      for (size_t y = first; y < last; ++y)
+                      {
+                          for (size_t k = 0; k < stride; ++k)
+                          {
+                              const size_t x0 = k * 64, n = std::min<size_t>(64, w - x0);
+                              uint64_t bits = 0;
+                              if (!v.IsTransposed())
+                              {
+                                  const T *row = v.data() + y * v.Stride() + x0;
+                                  for (size_t b = 0; b < n; ++b)
+                                  {
+                                      bits |= uint64_t(row[b] != T()) << b;
+                                  }
+                              }
+                              else
+                              {
+                                  for (size_t b = 0; b < n; ++b)
+                                  {
+                                      bits |= uint64_t(v.At(x0 + b, y) != T()) << b;
+                                  }
+                              }
+                              dst[y * stride + k] = bits;
+                          }
+                      }
+                  });
+}
+
+inline BitMat BitMat::operator~() const
+{
+    BitMat res(sizeX, sizeY);
+    const size_t stride = Stride();
+    const uint64_t tail = TailMask();
+    const uint64_t *src = words.data();
+    uint64_t *dst = res.words.data();
+    ParallelUnits(sizeY, stride * 64, [src, dst, stride, tail](size_t first, size_t last)
+                  {
+                      for (size_t y = first; y < last; ++y)
+                      {
+                          for (size_t k = 0; k < stride; ++k)
+                          {
+                              dst[y * stride + k] = ~src[y * stride + k];
+                          }
+                          if (stride)
+                          {
+                              dst[y * stride + stride - 1] &= tail;
+                          }
+                      }
+                  });
+    return res;
+}
+
+inline size_t BitMat::Count() const
+{
+    std::atomic<size_t> total{0};
+    const uint64_t *src = words.data();
+    ParallelUnits(Stride() * sizeY, 64, [src, &total](size_t first, size_t last)
+                  {
+                      size_t n = 0;
+                      for (size_t i = first; i < last; ++i)
+                      {
+                          n += size_t(std::popcount(src[i]));
+                      }
+                      total.fetch_add(n, std::memory_order_relaxed);
+                  });
+    return total.load(std::memory_order_relaxed);
+}
+
+inline Mat<size_t> BitMat::RowCounts() const
+{
+    Mat<size_t> res(1, sizeY, mat_uninit);
+    const size_t stride = Stride();
+    const uint64_t *src = words.data();
+    size_t *out = res.data();
+    ParallelUnits(sizeY, stride * 64, [src, out, stride](size_t first, size_t last)
+                  {
+                      for (size_t y = first; y < last; ++y)
+                      {
+                          size_t n = 0;
+                          for (size_t k = 0; k < stride; ++k)
+                          {
+                              n += size_t(std::popcount(src[y * stride + k]));
+                          }
+                          out[y] = n;
+                      }
+                  });
+    return res;
+}
+
+//rows are added into 8 bit sliced counters (carry save, 64 columns per op) held in registers for 4 words at a time,
+//which are spread into the per column counts every 255 rows
+inline Mat<size_t> BitMat::ColCounts() const
+{
+    Mat<size_t> res(sizeX, 1);
+    const size_t stride = Stride(), h = sizeY, w = sizeX;
+    const uint64_t *src = words.data();
+    size_t *out = res.data();
+    ParallelUnits(stride, h * 64, [src, out, stride, h, w](size_t first, size_t last)
+                  {
+                      for (size_t y0 = 0; y0 < h; y0 += 255)
+                      {
+                          const size_t y1 = std::min(h, y0 + 255);
+                          for (size_t k0 = first; k0 < last; k0 += 4)
+                          {
+                              const size_t cw = std::min<size_t>(4, last - k0);
+                              uint64_t planes[8][4] = {};
+                              for (size_t y = y0; y < y1; ++y)
+                              {
+                                  const uint64_t *row = src + y * stride + k0;
+                                  uint64_t carry[4] = {};
+                                  if (cw == 4)
+                                  {
+                                      std::memcpy(carry, row, sizeof(carry));
+                                  }
+                                  else
+                                  {
+                                      std::memcpy(carry, row, cw * sizeof(uint64_t));
+                                  }
+                                  for (size_t p = 0; p < 8; ++p)
+                                  {
+                                      for (size_t j = 0; j < 4; ++j)
+                                      {
+                                          const uint64_t c = planes[p][j] & carry[j];
+                                          planes[p][j] ^= carry[j];
+                                          carry[j] = c;
+                                      }
+                                  }
+                              }
+                              for (size_t j = 0; j < cw; ++j)
+                              {
+                                  size_t counts[64] = {};
+                                  for (size_t p = 0; p < 8; ++p)
+                                  {
+                                      for (size_t b = 0; b < 64; ++b)
+                                      {
+                                          counts[b] += size_t((planes[p][j] >> b) & 1) << p;
+                                      }
+                                  }
+                                  const size_t x0 = (k0 + j) * 64;
+                                  for (size_t b = 0; b < std::min<size_t>(64, w - x0); ++b)
+                                  {
+                                      out[x0 + b] += counts[b];
+                                  }
+                              }
+                          }
+                      }
+                  });
+    return res;
+}
+
+inline BitMat BitMat::Dot(const BitMat &mat) const
+{
+    if (sizeX != mat.sizeY)
+        throw std::invalid_argument("Dot: dimensions invalid");
+    BitMat res(mat.sizeX, sizeY);
+    const size_t aw = Stride(), bw = mat.Stride(), bh = mat.sizeY, h = sizeY;
+    if (!bw || !h)
+        return res;
+    const uint64_t *a = words.data(), *b = mat.words.data();
+    uint64_t *c = res.words.data();
+    //tasks are a block of result columns over a range of rows, each builds its own tables
+    constexpr size_t bwBlock = BIT_MAT_BLOCK_WORDS;
+    const size_t colBlocks = (bw + bwBlock - 1) / bwBlock;
+    const size_t rowBlock = std::max<size_t>(512, (h + 3) / 4), rowBlocks = (h + rowBlock - 1) / rowBlock;
+    const auto task = [=](size_t first, size_t last)
+    {
+        SimdDispatch([&](auto)
+                     {
+                         const uint64_t zero[bwBlock] = {};
+                         std::vector<uint64_t> tables(8 * 256 * bwBlock);
+                         for (size_t t = first; t < last; ++t)
+                         {
+                             const size_t c0 = t % colBlocks * bwBlock, cw = std::min(bwBlock, bw - c0);
+                             const size_t y0 = t / colBlocks * rowBlock, y1 = std::min(h, y0 + rowBlock);
+                             for (size_t k = 0; k < aw; ++k)
+                             {
+                                 const size_t k0 = k * 64;
+                                 bool built = false;
+                                 for (size_t y = y0; y < y1; ++y)
+                                 {
+                                     uint64_t bits = a[y * aw + k];
+                                     if (!bits)
+                                         continue;
+                                     uint64_t *out = c + y * bw + c0;
+                                     if (std::popcount(bits) <= BIT_MAT_SPARSE_BITS)
+                                     {
+                                         for (; bits; bits &= bits - 1)
+                                         {
+                                             const uint64_t *row = b + (k0 + size_t(std::countr_zero(bits))) * bw + c0;
+                                             for (size_t j = 0; j < cw; ++j)
+                                             {
+                                                 out[j] |= row[j];
+                                             }
+                                         }
+                                         continue;
+                                     }
+                                     if (!built)
+                                     {
+                                         //entry m of table i is the OR of rows k0 + 8i + j of B for the bits j of m
+                                         for (size_t i = 0; i < 8; ++i)
+                                         {
+                                             uint64_t *table = tables.data() + i * 256 * bwBlock;
+                                             std::fill(table, table + bwBlock, 0);
+                                             for (size_t m = 1; m < 256; ++m)
+                                             {
+                                                 const size_t r = k0 + 8 * i + size_t(std::countr_zero(m));
+                                                 const uint64_t *row = r < bh ? b + r * bw + c0 : zero;
+                                                 const uint64_t *prev = table + (m & (m - 1)) * bwBlock;
+                                                 for (size_t j = 0; j < bwBlock; ++j)
+                                                 {
+                                                     table[m * bwBlock + j] = prev[j] | (j < cw ? row[j] : 0);
+                                                 }
+                                             }
+                                         }
+                                         built = true;
+                                     }
+                                     uint64_t acc[bwBlock] = {};
+                                     for (size_t i = 0; i < 8; ++i)
+                                     {
+                                         const uint64_t *e = tables.data() + (i * 256 + ((bits >> (8 * i)) & 255)) * bwBlock;
+                                         for (size_t j = 0; j < bwBlock; ++j)
+                                         {
+                                             acc[j] |= e[j];
+                                         }
+                                     }
+                                     for (size_t j = 0; j < cw; ++j)
+                                     {
+                                         out[j] |= acc[j];
+                                     }
+                                 }
+                             }
+                         }
+                     });
+    };
+    const size_t tasks = colBlocks * rowBlocks;
+    if (uint64_t(h) * aw * bw < MAT_PARALLEL_ELEMENTS || tasks == 1)
+    {
+        task(0, tasks);
+    }
+    else
+    {
+        parallel_for(0, tasks, 1, task);
+    }
+    return res;
+}
+
+inline BitMat BitMat::TransitiveClosure() const
+{
+    if (sizeX != sizeY)
+        throw std::invalid_argument("TransitiveClosure: matrix must be square");
+    BitMat res = *this;
+    const size_t stride = Stride(), n = sizeY;
+    uint64_t *d = res.words.data();
+    for (size_t k = 0; k < n; ++k)
+    {
+        const uint64_t *rowK = d + k * stride;
+        const size_t word = k / 64;
+        const uint64_t bit = uint64_t(1) << (k % 64);
+        //row k ORed into itself changes nothing, skipping it leaves row k read only during the pass
+        ParallelUnits(n, stride * 64, [d, rowK, stride, word, bit, k](size_t first, size_t last)
+                      {
+                          for (size_t y = first; y < last; ++y)
+                          {
+                              uint64_t *row = d + y * stride;
+                              if (y != k && (row[word] & bit))
+                              {
+                                  for (size_t j = 0; j < stride; ++j)
+                                  {
+                                      row[j] |= rowK[j];
+                                  }
+                              }
+                          }
+                      });
+    }
+    return res;
+}
+
+template <typename T>
+inline Mat<T> BitMat::ToMat() const
+{
+    Mat<T> res(sizeX, sizeY, mat_uninit);
+    const size_t stride = Stride(), w = sizeX;
+    const uint64_t *src = words.data();
+    T *dst = res.data();
+    ParallelUnits(sizeY, stride * 64, [src, dst, stride, w](size_t first, size_t last)
+                  {
+                      for (size_t y = first; y < last; ++y)
+                      {
+                          for (size_t x = 0; x < w; ++x)
+                          {
+                              dst[y * w + x] = T((src[y * stride + x / 64] >> (x % 64)) & 1);
+                          }
+                      }
+                  });
+    return res;
+}
@@ -1,15 +1,288 @@
+#pragma once
 #include <stdexcept>
+#include <ostream>
+#include <type_traits>
+#include "utils.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define FAST_MAT_SSE
+#endif
+
+//products with at most this many multiply adds are fully unrolled at compile time, larger ones keep their loops
+#ifndef FAST_MAT_UNROLL_LIMIT
+#define FAST_MAT_UNROLL_LIMIT 512
+#endif
+
+#ifdef FAST_MAT_SSE
+//hand vectorized N x N products for N = 2, 3, 4, row i of C is the sum over k of a(i, k) broadcast times row k of B
+template <size_t N>
+ALWAYS_INLINE void FastMatDotSimd(const float (&a)[N][N], const float (&b)[N][N], float (&c)[N][N]) noexcept
+{
+    if constexpr (N == 2)
+    {
+        //the whole 2x2 fits one register, C = A(0,0,2,2) * B(0,1,0,1) + A(1,1,3,3) * B(2,3,2,3)
+        const __m128 va = _mm_loadu_ps(&a[0][0]);
+        const __m128 vb = _mm_loadu_ps(&b[0][0]);
+        const __m128 lo = _mm_mul_ps(_mm_shuffle_ps(va, va, _MM_SHUFFLE(2, 2, 0, 0)), _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(1, 0, 1, 0)));
+        const __m128 hi = _mm_mul_ps(_mm_shuffle_ps(va, va, _MM_SHUFFLE(3, 3, 1, 1)), _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 2, 3, 2)));
+        _mm_storeu_ps(&c[0][0], _mm_add_ps(lo, hi));
+    }
+    else if constexpr (N == 3)
+    {
+        //rows are padded to 4 lanes in registers, loads and stores only touch the 3 real elements
+        const __m128 b0 = _mm_setr_ps(b[0][0], b[0][1], b[0][2], 0.0f);
+        const __m128 b1 = _mm_setr_ps(b[1][0], b[1][1], b[1][2], 0.0f);
+        const __m128 b2 = _mm_setr_ps(b[2][0], b[2][1], b[2][2], 0.0f);
+        for (size_t i = 0; i < 3; ++i)
+        {
+            __m128 r = _mm_mul_ps(_mm_set1_ps(a[i][0]), b0);
+            r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[i][1]), b1));
+            r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[i][2]), b2));
+            alignas(16) float tmp[4];
+            _mm_store_ps(tmp, r);
+            c[i][0] = tmp[0];
+            c[i][1] = tmp[1];
+            c[i][2] = tmp[2];
+        }
+    }
+    else
+    {
+        const __m128 b0 = _mm_loadu_ps(b[0]), b1 = _mm_loadu_ps(b[1]), b2 = _mm_loadu_ps(b[2]), b3 = _mm_loadu_ps(b[3]);
+        for (size_t i = 0; i < 4; ++i)
+        {
+            __m128 r = _mm_mul_ps(_mm_set1_ps(a[i][0]), b0);
+            r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[i][1]), b1));
+            r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[i][2]), b2));
+            r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[i][3]), b3));
+            _mm_storeu_ps(c[i], r);
+        }
+    }
+}
+
+template <size_t N>
+ALWAYS_INLINE void FastMatDotSimd(const double (&a)[N][N], const double (&b)[N][N], double (&c)[N][N]) noexcept
+{
+#ifdef __AVX__
+    if constexpr (N == 4)
+    {
+        const __m256d b0 = _mm256_loadu_pd(b[0]), b1 = _mm256_loadu_pd(b[1]), b2 = _mm256_loadu_pd(b[2]), b3 = _mm256_loadu_pd(b[3]);
+        for (size_t i = 0; i < 4; ++i)
+        {
+            __m256d r = _mm256_mul_pd(_mm256_set1_pd(a[i][0]), b0);
+            r = _mm256_add_pd(r, _mm256_mul_pd(_mm256_set1_pd(a[i][1]), b1));
+            r = _mm256_add_pd(r, _mm256_mul_pd(_mm256_set1_pd(a[i][2]), b2));
+            r = _mm256_add_pd(r, _mm256_mul_pd(_mm256_set1_pd(a[i][3]), b3));
+            _mm256_storeu_pd(c[i], r);
+        }
+        return;
+    }
+#endif
+    //columns [0, 2) in one SSE2 register per row, [2, 4) in a second or a scalar tail for N = 3
+    for (size_t i = 0; i < N; ++i)
+    {
+        __m128d lo = _mm_setzero_pd();
+        [[maybe_unused]] __m128d hi = _mm_setzero_pd();
+        [[maybe_unused]] double tail = 0.0;
+        for (size_t k = 0; k < N; ++k)
+        {
+            const __m128d aik = _mm_set1_pd(a[i][k]);
+            lo = _mm_add_pd(lo, _mm_mul_pd(aik, _mm_loadu_pd(&b[k][0])));
+            if constexpr (N == 4)
+            {
+                hi = _mm_add_pd(hi, _mm_mul_pd(aik, _mm_loadu_pd(&b[k][2])));
+            }
+            else if constexpr (N == 3)
+            {
+                tail += a[i][k] * b[k][2];
+            }
+        }
+        _mm_storeu_pd(&c[i][0], lo);
+        if constexpr (N == 4)
+        {
+            _mm_storeu_pd(&c[i][2], hi);
+        }
+        else if constexpr (N == 3)
+        {
+            c[i][2] = tail;
+        }
+    }
+}
+
+//4x4 float inverse by 2x2 block adjugates, rows of A are split into the 2x2 blocks [A B; C D]
+//each 2x2 block lives in one register as (m00, m01, m10, m11)
+ALWAYS_INLINE __m128 FastMat2Mul(__m128 a, __m128 b) noexcept
+{
+    return _mm_add_ps(_mm_mul_ps(a, _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 3, 0))),
+                      _mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1)), _mm_shuffle_ps(b, b, _MM_SHUFFLE(1, 2, 1, 2))));
+}
+//adj(a) * b
+ALWAYS_INLINE __m128 FastMat2AdjMul(__m128 a, __m128 b) noexcept
+{
+    return _mm_sub_ps(_mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(0, 0, 3, 3)), b),
+                      _mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 2, 1, 1)), _mm_shuffle_ps(b, b, _MM_SHUFFLE(1, 0, 3, 2))));
+}
+//a * adj(b)
+ALWAYS_INLINE __m128 FastMat2MulAdj(__m128 a, __m128 b) noexcept
+{
+    return _mm_sub_ps(_mm_mul_ps(a, _mm_shuffle_ps(b, b, _MM_SHUFFLE(0, 3, 0, 3))),
+                      _mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1)), _mm_shuffle_ps(b, b, _MM_SHUFFLE(1, 2, 1, 2))));
+}
+
+//returns false, leaving out untouched, when the matrix is singular
+inline bool FastMatInverseSimd(const float (&m)[4][4], float (&out)[4][4]) noexcept
+{
+    const __m128 r0 = _mm_loadu_ps(m[0]), r1 = _mm_loadu_ps(m[1]), r2 = _mm_loadu_ps(m[2]), r3 = _mm_loadu_ps(m[3]);
+    const __m128 A = _mm_movelh_ps(r0, r1), B = _mm_movehl_ps(r1, r0);
+    const __m128 C = _mm_movelh_ps(r2, r3), D = _mm_movehl_ps(r3, r2);
+
+    //determinants of the four blocks, (detA, detB, detC, detD)
+    const __m128 detSub = _mm_sub_ps(_mm_mul_ps(_mm_shuffle_ps(r0, r2, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(r1, r3, _MM_SHUFFLE(3, 1, 3, 1))),
+                                     _mm_mul_ps(_mm_shuffle_ps(r0, r2, _MM_SHUFFLE(3, 1, 3, 1)), _mm_shuffle_ps(r1, r3, _MM_SHUFFLE(2, 0, 2, 0))));
+    const __m128 detA = _mm_shuffle_ps(detSub, detSub, _MM_SHUFFLE(0, 0, 0, 0));
+    const __m128 detB = _mm_shuffle_ps(detSub, detSub, _MM_SHUFFLE(1, 1, 1, 1));
+    const __m128 detC = _mm_shuffle_ps(detSub, detSub, _MM_SHUFFLE(2, 2, 2, 2));
+    const __m128 detD = _mm_shuffle_ps(detSub, detSub, _MM_SHUFFLE(3, 3, 3, 3));
+
+    const __m128 DC = FastMat2AdjMul(D, C);
+    const __m128 AB = FastMat2AdjMul(A, B);
+    __m128 X = _mm_sub_ps(_mm_mul_ps(detD, A), FastMat2Mul(B, DC));
+    __m128 W = _mm_sub_ps(_mm_mul_ps(detA, D), FastMat2Mul(C, AB));
+    __m128 Y = _mm_sub_ps(_mm_mul_ps(detB, C), FastMat2MulAdj(D, AB));
+    __m128 Z = _mm_sub_ps(_mm_mul_ps(detC, B), FastMat2MulAdj(A, DC));
+
+    //det(M) = detA detD + detB detC - tr(adj(A) B adj(D) C)
+    __m128 tr = _mm_mul_ps(AB, _mm_shuffle_ps(DC, DC, _MM_SHUFFLE(3, 1, 2, 0)));
+    tr = _mm_add_ps(tr, _mm_shuffle_ps(tr, tr, _MM_SHUFFLE(2, 3, 0, 1)));
+    tr = _mm_add_ps(tr, _mm_shuffle_ps(tr, tr, _MM_SHUFFLE(1, 0, 3, 2)));
+    const __m128 detM = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(detA, detD), _mm_mul_ps(detB, detC)), tr);
+    if (_mm_cvtss_f32(detM) == 0.0f)
+    {
+        return false;
+    }
+
+    const __m128 rDetM = _mm_div_ps(_mm_setr_ps(1.0f, -1.0f, -1.0f, 1.0f), detM);
+    X = _mm_mul_ps(X, rDetM);
+    Y = _mm_mul_ps(Y, rDetM);
+    Z = _mm_mul_ps(Z, rDetM);
+    W = _mm_mul_ps(W, rDetM);
+    _mm_storeu_ps(out[0], _mm_shuffle_ps(X, Y, _MM_SHUFFLE(1, 3, 1, 3)));
+    _mm_storeu_ps(out[1], _mm_shuffle_ps(X, Y, _MM_SHUFFLE(0, 2, 0, 2)));
+    _mm_storeu_ps(out[2], _mm_shuffle_ps(Z, W, _MM_SHUFFLE(1, 3, 1, 3)));
+    _mm_storeu_ps(out[3], _mm_shuffle_ps(Z, W, _MM_SHUFFLE(0, 2, 0, 2)));
+    return true;
+}
+#endif
 
 template <size_t W, size_t H, typename T = float>
 class FastMat
 {
-private:
+public:
+    //public so FastMat is a structural type, whole matrices can then be template arguments, e.g. ConfirmConstexpr<m.Inverse()>()
     T members[H][W];
 
+private:
+    template <size_t, size_t, typename>
+    friend class FastMat;
+
+    static constexpr T Abs(T v) noexcept { return v < T(0) ? -v : v; }
+
+    //Gauss-Jordan with partial pivoting, used for the sizes without a closed form
+    constexpr T DeterminantElimination() const
+    {
+        FastMat m = *this;
+        T det = T(1);
+        for (size_t c = 0; c < W; ++c)
+        {
+            size_t pivot = c;
+            for (size_t r = c + 1; r < H; ++r)
+            {
+                if (Abs(m.members[r][c]) > Abs(m.members[pivot][c]))
+                    pivot = r;
+            }
+            if (m.members[pivot][c] == T(0))
+                return T(0);
+            if (pivot != c)
+            {
+                for (size_t k = 0; k < W; ++k)
+                {
+                    const T tmp = m.members[c][k];
+                    m.members[c][k] = m.members[pivot][k];
+                    m.members[pivot][k] = tmp;
+                }
+                det = -det;
+            }
+            det *= m.members[c][c];
+            for (size_t r = c + 1; r < H; ++r)
+            {
+                const T f = m.members[r][c] / m.members[c][c];
+                for (size_t k = c; k < W; ++k)
+                {
+                    m.members[r][k] -= f * m.members[c][k];
+                }
+            }
+        }
+        return det;
+    }
+
+    constexpr FastMat InverseElimination() const
+    {
+        FastMat m = *this, inv = Identity();
+        for (size_t c = 0; c < W; ++c)
+        {
+            size_t pivot = c;
+            for (size_t r = c + 1; r < H; ++r)
+            {
+                if (Abs(m.members[r][c]) > Abs(m.members[pivot][c]))
+                    pivot = r;
+            }
+            if (m.members[pivot][c] == T(0))
+                throw std::domain_error("Inverse: matrix is singular");
+            for (size_t k = 0; k < W; ++k)
+            {
+                T tmp = m.members[c][k];
+                m.members[c][k] = m.members[pivot][k];
+                m.members[pivot][k] = tmp;
+                tmp = inv.members[c][k];
+                inv.members[c][k] = inv.members[pivot][k];
+                inv.members[pivot][k] = tmp;
+            }
+            const T d = m.members[c][c];
+            for (size_t k = 0; k < W; ++k)
+            {
+                m.members[c][k] /= d;
+                inv.members[c][k] /= d;
+            }
+            for (size_t r = 0; r < H; ++r)
+            {
+                if (r != c)
+                {
+                    const T f = m.members[r][c];
+                    for (size_t k = 0; k < W; ++k)
+                    {
+                        m.members[r][k] -= f * m.members[c][k];
+                        inv.members[r][k] -= f * inv.members[c][k];
+                    }
+                }
+            }
+        }
+        return inv;
+    }
+
 public:
+    using type = T;
+
     constexpr FastMat() noexcept = default;
     constexpr explicit FastMat(T &&head, auto &&...args) : members{head, args...} { static_assert(sizeof...(args) + 1 == W * H, "initilizing FastMat with an initilizer list much match the Area in size"); }
 
+    static constexpr FastMat Identity() noexcept
+    {
+        static_assert(W == H, "Identity: FastMat must be square");
+        FastMat res{};
+        static_for<W>([&](auto i) { res.members[i][i] = T(1); });
+        return res;
+    }
+
     constexpr size_t Area() const noexcept { return W * H; }
     constexpr size_t SizeX() const noexcept { return W; }
     constexpr size_t SizeY() const noexcept { return H; }
@@ -39,6 +312,229 @@ public:
         return &members[y][x];
     }
 
+    //(W x H) . (W2 x W) -> (W2 x H), the same shape rule as the first branch of Mat::Dot
+    template <size_t W2>
+    constexpr FastMat<W2, H, T> Dot(const FastMat<W2, W, T> &mat) const noexcept
+    {
+        FastMat<W2, H, T> res{};
+#ifdef FAST_MAT_SSE
+        if constexpr (W == H && W == W2 && W >= 2 && W <= 4 && (std::is_same_v<T, float> || std::is_same_v<T, double>))
+        {
+            if (!std::is_constant_evaluated())
+            {
+                FastMatDotSimd<W>(members, mat.members, res.members);
+                return res;
+            }
+        }
+#endif
+        if constexpr (H * W * W2 <= FAST_MAT_UNROLL_LIMIT)
+        {
+            static_for<H>([&](auto i)
+                          { static_for<W2>([&](auto j)
+                                           {
+                                               T acc{};
+                                               static_for<W>([&](auto k) { acc += members[i][k] * mat.members[k][j]; });
+                                               res.members[i][j] = acc;
+                                           }); });
+        }
+        else
+        {
+            for (size_t i = 0; i < H; ++i)
+            {
+                for (size_t k = 0; k < W; ++k)
+                {
+                    const T aik = members[i][k];
+                    for (size_t j = 0; j < W2; ++j)
+                    {
+                        res.members[i][j] += aik * mat.members[k][j];
+                    }
+                }
+            }
+        }
+        return res;
+    }
+
+    constexpr FastMat<H, W, T> Transpose() const noexcept
+    {
+        FastMat<H, W, T> res{};
+        static_for<H>([&](auto i)
+                      { static_for<W>([&](auto j) { res.members[j][i] = members[i][j]; }); });
+        return res;
+    }
+
+    constexpr T Determinant() const
+    {
+        static_assert(W == H, "Determinant: FastMat must be square");
+        const auto &m = members;
+        if constexpr (W == 1)
+        {
+            return m[0][0];
+        }
+        else if constexpr (W == 2)
+        {
+            return m[0][0] * m[1][1] - m[0][1] * m[1][0];
+        }
+        else if constexpr (W == 3)
+        {
+            return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+                   m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+                   m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+        }
+        else if constexpr (W == 4)
+        {
+            //Laplace expansion over the 2x2 minors of the top and bottom row pairs
+            const T s0 = m[0][0] * m[1][1] - m[1][0] * m[0][1], s1 = m[0][0] * m[1][2] - m[1][0] * m[0][2];
+            const T s2 = m[0][0] * m[1][3] - m[1][0] * m[0][3], s3 = m[0][1] * m[1][2] - m[1][1] * m[0][2];
+            const T s4 = m[0][1] * m[1][3] - m[1][1] * m[0][3], s5 = m[0][2] * m[1][3] - m[1][2] * m[0][3];
+            const T c5 = m[2][2] * m[3][3] - m[3][2] * m[2][3], c4 = m[2][1] * m[3][3] - m[3][1] * m[2][3];
+            const T c3 = m[2][1] * m[3][2] - m[3][1] * m[2][2], c2 = m[2][0] * m[3][3] - m[3][0] * m[2][3];
+            const T c1 = m[2][0] * m[3][2] - m[3][0] * m[2][2], c0 = m[2][0] * m[3][1] - m[3][0] * m[2][1];
+            return s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+        }
+        else
+        {
+            return DeterminantElimination();
+        }
+    }
+
+    //throws std::domain_error for singular matrices, which also rejects them in constant evaluation
+    constexpr FastMat Inverse() const
+    {
+        static_assert(W == H, "Inverse: FastMat must be square");
+        static_assert(std::is_floating_point_v<T>, "Inverse: FastMat must hold a floating point type");
+        const auto &m = members;
+        FastMat res{};
+        if constexpr (W == 1)
+        {
+            if (m[0][0] == T(0))
+                throw std::domain_error("Inverse: matrix is singular");
+            res.members[0][0] = T(1) / m[0][0];
+        }
+        else if constexpr (W == 2)
+        {
+            const T det = Determinant();
+            if (det == T(0))
+                throw std::domain_error("Inverse: matrix is singular");
+            const T r = T(1) / det;
+            res.members[0][0] = m[1][1] * r;
+            res.members[0][1] = -m[0][1] * r;
+            res.members[1][0] = -m[1][0] * r;
+            res.members[1][1] = m[0][0] * r;
+        }
+        else if constexpr (W == 3)
+        {
+            const T c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+            const T c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+            const T c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+            const T det = m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02;
+            if (det == T(0))
+                throw std::domain_error("Inverse: matrix is singular");
+            const T r = T(1) / det;
+            res.members[0][0] = c00 * r;
+            res.members[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * r;
+            res.members[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * r;
+            res.members[1][0] = c01 * r;
+            res.members[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * r;
+            res.members[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * r;
+            res.members[2][0] = c02 * r;
+            res.members[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * r;
+            res.members[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * r;
+        }
+        else if constexpr (W == 4)
+        {
+#ifdef FAST_MAT_SSE
+            if constexpr (std::is_same_v<T, float>)
+            {
+                if (!std::is_constant_evaluated())
+                {
+                    if (!FastMatInverseSimd(members, res.members))
+                        throw std::domain_error("Inverse: matrix is singular");
+                    return res;
+                }
+            }
+#endif
+            const T s0 = m[0][0] * m[1][1] - m[1][0] * m[0][1], s1 = m[0][0] * m[1][2] - m[1][0] * m[0][2];
+            const T s2 = m[0][0] * m[1][3] - m[1][0] * m[0][3], s3 = m[0][1] * m[1][2] - m[1][1] * m[0][2];
+            const T s4 = m[0][1] * m[1][3] - m[1][1] * m[0][3], s5 = m[0][2] * m[1][3] - m[1][2] * m[0][3];
+            const T c5 = m[2][2] * m[3][3] - m[3][2] * m[2][3], c4 = m[2][1] * m[3][3] - m[3][1] * m[2][3];
+            const T c3 = m[2][1] * m[3][2] - m[3][1] * m[2][2], c2 = m[2][0] * m[3][3] - m[3][0] * m[2][3];
+            const T c1 = m[2][0] * m[3][2] - m[3][0] * m[2][2], c0 = m[2][0] * m[3][1] - m[3][0] * m[2][1];
+            const T det = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+            if (det == T(0))
+                throw std::domain_error("Inverse: matrix is singular");
+            const T r = T(1) / det;
+            auto &o = res.members;
+            o[0][0] = (m[1][1] * c5 - m[1][2] * c4 + m[1][3] * c3) * r;
+            o[0][1] = (-m[0][1] * c5 + m[0][2] * c4 - m[0][3] * c3) * r;
+            o[0][2] = (m[3][1] * s5 - m[3][2] * s4 + m[3][3] * s3) * r;
+            o[0][3] = (-m[2][1] * s5 + m[2][2] * s4 - m[2][3] * s3) * r;
+            o[1][0] = (-m[1][0] * c5 + m[1][2] * c2 - m[1][3] * c1) * r;
+            o[1][1] = (m[0][0] * c5 - m[0][2] * c2 + m[0][3] * c1) * r;
+            o[1][2] = (-m[3][0] * s5 + m[3][2] * s2 - m[3][3] * s1) * r;
+            o[1][3] = (m[2][0] * s5 - m[2][2] * s2 + m[2][3] * s1) * r;
+            o[2][0] = (m[1][0] * c4 - m[1][1] * c2 + m[1][3] * c0) * r;
+            o[2][1] = (-m[0][0] * c4 + m[0][1] * c2 - m[0][3] * c0) * r;
+            o[2][2] = (m[3][0] * s4 - m[3][1] * s2 + m[3][3] * s0) * r;
+            o[2][3] = (-m[2][0] * s4 + m[2][1] * s2 - m[2][3] * s0) * r;
+            o[3][0] = (-m[1][0] * c3 + m[1][1] * c1 - m[1][2] * c0) * r;
+            o[3][1] = (m[0][0] * c3 - m[0][1] * c1 + m[0][2] * c0) * r;
+            o[3][2] = (-m[3][0] * s3 + m[3][1] * s1 - m[3][2] * s0) * r;
+            o[3][3] = (m[2][0] * s3 - m[2][1] * s1 + m[2][2] * s0) * r;
+        }
+        else
+        {
+            return InverseElimination();
+        }
+        return res;
+    }
+
+#define FAST_MAT_OPERATOR(op)                                                                               \
+    constexpr FastMat operator op(const FastMat &mat) const noexcept                                        \
+    {                                                                                                       \
+        FastMat res{};                                                                                      \
+        static_for<H>([&](auto i)                                                                           \
+                      { static_for<W>([&](auto j) { res.members[i][j] = members[i][j] op mat.members[i][j]; }); }); \
+        return res;                                                                                         \
+    }                                                                                                       \
+    constexpr FastMat operator op(copy_fast_t<T> value) const noexcept                                      \
+    {                                                                                                       \
+        FastMat res{};                                                                                      \
+        static_for<H>([&](auto i)                                                                           \
+                      { static_for<W>([&](auto j) { res.members[i][j] = members[i][j] op value; }); });     \
+        return res;                                                                                         \
+    }                                                                                                       \
+    constexpr FastMat &operator op##=(const FastMat &mat) noexcept                                          \
+    {                                                                                                       \
+        static_for<H>([&](auto i)                                                                           \
+                      { static_for<W>([&](auto j) { members[i][j] op## = mat.members[i][j]; }); });        \
+        return *this;                                                                                       \
+    }                                                                                                       \
+    constexpr FastMat &operator op##=(copy_fast_t<T> value) noexcept                                        \
+    {                                                                                                       \
+        static_for<H>([&](auto i)                                                                           \
+                      { static_for<W>([&](auto j) { members[i][j] op## = value; }); });                    \
+        return *this;                                                                                       \
+    }
+
+    FAST_MAT_OPERATOR(+)
+    FAST_MAT_OPERATOR(-)
+    FAST_MAT_OPERATOR(*)
+    FAST_MAT_OPERATOR(/)
+#undef FAST_MAT_OPERATOR
+
+    constexpr bool operator==(const FastMat &mat) const noexcept
+    {
+        for (size_t i = 0; i < H; ++i)
+        {
+            for (size_t j = 0; j < W; ++j)
+            {
+                if (members[i][j] != mat.members[i][j])
+                    return false;
+            }
+        }
+        return true;
+    }
+
     friend std::ostream &operator<<(std::ostream &os, const FastMat &mat)
     {
         for (size_t i = 0; i < mat.SizeY(); ++i)
@@ -52,3 +548,13 @@ public:
         return os;
     }
 };
+
+template <size_t W, size_t H, typename T>
+struct std::hash<FastMat<W, H, T>>
+{
+    size_t operator()(const FastMat<W, H, T> &mat) const noexcept
+    {
+        return size_t(HashValues(mat.begin(), W * H, HashMix64(HashMix64(W) ^ H)));
+    }
+};
+
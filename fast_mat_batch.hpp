@@ -0,0 +1,430 @@
+#pragma once
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <span>
+#include <vector>
+#include <type_traits>
+#include "utils.hpp"
+#include "simd_dispatch.hpp"
+#include "tpool.hpp"
+#include "fast_mat.hpp"
+
+//matrices per parallel_for task, small enough to balance, large enough that the fork is noise
+#ifndef FAST_MAT_BATCH_GRAIN
+#define FAST_MAT_BATCH_GRAIN size_t(4096)
+#endif
+
+//matrices per FastMatBatch tile, one cache line of each element
+template <typename T>
+inline constexpr size_t fast_mat_batch_lanes = 64 / sizeof(T) < 4 ? 4 : 64 / sizeof(T);
+
+//calls body(first, last) over [0, n) matrices, serially for batches under one grain
+template <typename F>
+ALWAYS_INLINE void FastMatBatchRange(size_t n, F &&body)
+{
+    if (n <= FAST_MAT_BATCH_GRAIN)
+    {
+        body(size_t(0), n);
+    }
+    else
+    {
+        parallel_for(0, n, FAST_MAT_BATCH_GRAIN, body);
+    }
+}
+
+//calls body(first, last) over the tiles of L matrices covering [0, n)
+template <size_t L, typename F>
+ALWAYS_INLINE void FastMatBatchTiles(size_t n, F &&body)
+{
+    const size_t tiles = (n + L - 1) / L;
+    if (n <= FAST_MAT_BATCH_GRAIN)
+    {
+        body(size_t(0), tiles);
+    }
+    else
+    {
+        parallel_for(0, tiles, std::max<size_t>(1, FAST_MAT_BATCH_GRAIN / L), body);
+    }
+}
+
+//N same shape FastMats in tiled structure of arrays layout, kernels vectorize across the batch instead of inside a matrix too small to fill a register
+//matrices are grouped in tiles of L = fast_mat_batch_lanes<T>, a tile stores element (x, y) of its L matrices as one contiguous, 64 byte aligned run of lanes
+//so a kernel streams whole tiles sequentially rather than W * H separate planes, the last tile is zero padded and every kernel keeps it zero
+template <size_t W, size_t H, typename T = float, typename Alloc = AlignedAllocator<T, 64>>
+class FastMatBatch
+{
+private:
+    static constexpr size_t L = fast_mat_batch_lanes<T>;
+
+    std::vector<T, Alloc> members;
+    size_t count = 0;
+
+    static constexpr size_t Tiles(size_t n) noexcept { return (n + L - 1) / L; }
+    static constexpr size_t Index(size_t n, size_t i) noexcept { return (n / L) * (W * H * L) + i * L + n % L; }
+
+public:
+    using type = T;
+    using mat_type = FastMat<W, H, T>;
+
+    FastMatBatch() noexcept = default;
+    explicit FastMatBatch(size_t n) : members(W * H * L * Tiles(n)), count(n) {}
+    explicit FastMatBatch(std::span<const mat_type> mats) : FastMatBatch(mats.size())
+    {
+        FastMatBatchRange(count, [this, mats](size_t first, size_t last)
+                          {
+                              for (size_t n = first; n < last; ++n)
+                              {
+                                  Set(n, mats[n]);
+                              }
+                          });
+    }
+
+    size_t Size() const noexcept { return count; }
+    static constexpr size_t SizeX() noexcept { return W; }
+    static constexpr size_t SizeY() noexcept { return H; }
+
+    static constexpr size_t Lanes() noexcept { return L; }
+    size_t TileCount() const noexcept { return Tiles(count); }
+
+    //element (x, y) of the L matrices in tile, matrix n is lane n % L of tile n / L
+    T *Tile(size_t tile, size_t x, size_t y) noexcept { return members.data() + tile * (W * H * L) + (y * W + x) * L; }
+    const T *Tile(size_t tile, size_t x, size_t y) const noexcept { return members.data() + tile * (W * H * L) + (y * W + x) * L; }
+
+    mat_type Get(size_t n) const
+    {
+        MAT_BOUNDS(n < count, MatOutOfRange("Get", n));
+        mat_type res{};
+        T *out = res.begin();
+        for (size_t i = 0; i < W * H; ++i)
+        {
+            out[i] = members[Index(n, i)];
+        }
+        return res;
+    }
+    void Set(size_t n, const mat_type &mat)
+    {
+        MAT_BOUNDS(n < count, MatOutOfRange("Set", n));
+        const T *in = mat.begin();
+        for (size_t i = 0; i < W * H; ++i)
+        {
+            members[Index(n, i)] = in[i];
+        }
+    }
+
+    //gathers back to an array of FastMats, out must hold Size() matrices
+    void ToArray(std::span<mat_type> out) const
+    {
+        if (out.size() < count)
+            throw std::invalid_argument("ToArray: output holds fewer matrices than the batch");
+        FastMatBatchRange(count, [this, out](size_t first, size_t last)
+                          {
+                              for (size_t n = first; n < last; ++n)
+                              {
+                                  out[n] = Get(n);
+                              }
+                          });
+    }
+    std::vector<mat_type> ToVector() const
+    {
+        std::vector<mat_type> res(count);
+        ToArray(res);
+        return res;
+    }
+
+    template <size_t W2>
+    FastMatBatch<W2, H, T, Alloc> Dot(const FastMatBatch<W2, W, T, Alloc> &mats) const
+    {
+        FastMatBatch<W2, H, T, Alloc> res(count);
+        DotInto(*this, mats, res);
+        return res;
+    }
+    FastMatBatch<1, H, T, Alloc> Transform(const FastMatBatch<1, W, T, Alloc> &vecs) const
+    {
+        FastMatBatch<1, H, T, Alloc> res(count);
+        TransformInto(*this, vecs, res);
+        return res;
+    }
+    FastMatBatch Inverse() const
+    {
+        FastMatBatch res(count);
+        InverseInto(*this, res);
+        return res;
+    }
+};
+
+//lanes of T one vector register holds at a dispatch level
+template <typename T, SimdLevel Level>
+inline constexpr size_t fast_mat_batch_vector = std::clamp<size_t>((Level == SimdLevel::AVX512 ? 64 : Level == SimdLevel::AVX2 ? 32 : Level == SimdLevel::SSE2 ? 16 : 0) / sizeof(T), 1, fast_mat_batch_lanes<T>);
+
+//GCC tunes its AVX-512 targets (e.g. -march=sapphirerapids) for 256 bit vectors, which would split every 512 bit lane block in two
+#if defined(__GNUC__) && !defined(__clang__) && defined(__AVX512F__)
+#define FAST_MAT_BATCH_WIDE __attribute__((target("prefer-vector-width=512")))
+#else
+#define FAST_MAT_BATCH_WIDE
+#endif
+
+//one tile of products, a block of V lanes (one vector register) at a time: the H x W2 accumulators of the block stay in registers
+//across k, each step loads a row of b and one element of a per output row, so a product costs about half a load per multiply add
+//sizes with more accumulators than registers sweep the tile one output row at a time instead
+template <size_t W, size_t H, size_t W2, size_t V, typename T, size_t L>
+ALWAYS_INLINE void FastMatBatchDotTile(const T (&a)[H][W][L], const T (&b)[W][W2][L], T (&c)[H][W2][L]) noexcept
+{
+    constexpr size_t rows = H * W2 <= 16 ? H : 1;
+#pragma GCC unroll 1
+    for (size_t i0 = 0; i0 < H; i0 += rows)
+    {
+#pragma GCC unroll 1
+        for (size_t l0 = 0; l0 < L; l0 += V)
+        {
+            T acc[rows][W2][V] = {};
+#pragma GCC unroll 16
+            for (size_t k = 0; k < W; ++k)
+            {
+#pragma GCC unroll 16
+                for (size_t i = 0; i < rows; ++i)
+                {
+#pragma GCC unroll 16
+                    for (size_t j = 0; j < W2; ++j)
+                    {
+                        for (size_t l = 0; l < V; ++l)
+                        {
+                            acc[i][j][l] += a[i0 + i][k][l0 + l] * b[k][j][l0 + l];
+                        }
+                    }
+                }
+            }
+#pragma GCC unroll 16
+            for (size_t i = 0; i < rows; ++i)
+            {
+#pragma GCC unroll 16
+                for (size_t j = 0; j < W2; ++j)
+                {
+                    for (size_t l = 0; l < V; ++l)
+                    {
+                        c[i0 + i][j][l0 + l] = acc[i][j][l];
+                    }
+                }
+            }
+        }
+    }
+}
+
+//DotInto over tiles [first, last)
+template <size_t W, size_t H, size_t W2, size_t V, typename T, typename Alloc>
+FAST_MAT_BATCH_WIDE void FastMatBatchDotTiles(const FastMatBatch<W, H, T, Alloc> &a, const FastMatBatch<W2, W, T, Alloc> &b, FastMatBatch<W2, H, T, Alloc> &out, size_t first, size_t last) noexcept
+{
+    constexpr size_t L = fast_mat_batch_lanes<T>;
+    //inputs are read in place, only the result is staged in a local so stores can't alias them
+    alignas(64) T tc[H][W2][L];
+    for (size_t tile = first; tile < last; ++tile)
+    {
+        const auto &ta = *reinterpret_cast<const T(*)[H][W][L]>(a.Tile(tile, 0, 0));
+        const auto &tb = *reinterpret_cast<const T(*)[W][W2][L]>(b.Tile(tile, 0, 0));
+        FastMatBatchDotTile<W, H, W2, V, T, L>(ta, tb, tc);
+        std::memcpy(out.Tile(tile, 0, 0), tc, sizeof(tc));
+    }
+}
+
+//out[n] = a[n] . b[n] for every n, out may be a or b
+template <size_t W, size_t H, size_t W2, typename T, typename Alloc>
+inline void DotInto(const FastMatBatch<W, H, T, Alloc> &a, const FastMatBatch<W2, W, T, Alloc> &b, FastMatBatch<W2, H, T, Alloc> &out)
+{
+    if (a.Size() != b.Size() || a.Size() != out.Size())
+        throw std::invalid_argument("DotInto: batch sizes differ");
+    FastMatBatchTiles<fast_mat_batch_lanes<T>>(a.Size(), [&a, &b, &out](size_t first, size_t last)
+                                               {
+                                                   SimdDispatch([&](auto level)
+                                                                {
+                                                                    constexpr size_t V = fast_mat_batch_vector<T, decltype(level)::value>;
+                                                                    FastMatBatchDotTiles<W, H, W2, V>(a, b, out, first, last);
+                                                                });
+                                               });
+}
+
+//out[n] = mats[n] . vecs[n], vectors are W x 1 column FastMats
+template <size_t W, size_t H, typename T, typename Alloc>
+inline void TransformInto(const FastMatBatch<W, H, T, Alloc> &mats, const FastMatBatch<1, W, T, Alloc> &vecs, FastMatBatch<1, H, T, Alloc> &out)
+{
+    DotInto(mats, vecs, out);
+}
+
+//out[n] = mat . vecs[n], one matrix broadcast over the whole batch of vectors
+template <size_t W, size_t H, typename T, typename Alloc>
+inline void TransformInto(const FastMat<W, H, T> &mat, const FastMatBatch<1, W, T, Alloc> &vecs, FastMatBatch<1, H, T, Alloc> &out)
+{
+    if (vecs.Size() != out.Size())
+        throw std::invalid_argument("TransformInto: batch sizes differ");
+    constexpr size_t L = fast_mat_batch_lanes<T>;
+    FastMatBatchTiles<L>(vecs.Size(), [&mat, &vecs, &out](size_t first, size_t last)
+                         {
+                             for (size_t tile = first; tile < last; ++tile)
+                             {
+                                 for (size_t i = 0; i < H; ++i)
+                                 {
+                                     alignas(64) T acc[L] = {};
+#pragma GCC unroll 16
+                                     for (size_t k = 0; k < W; ++k)
+                                     {
+                                         const T m = mat.At(k, i);
+                                         const T *__restrict pv = vecs.Tile(tile, 0, k);
+                                         for (size_t l = 0; l < L; ++l)
+                                         {
+                                             acc[l] += m * pv[l];
+                                         }
+                                     }
+                                     T *__restrict o = out.Tile(tile, 0, i);
+                                     for (size_t l = 0; l < L; ++l)
+                                     {
+                                         o[l] = acc[l];
+                                     }
+                                 }
+                             }
+                         });
+}
+
+//closed form inverse of one block of lanes, m and o are [row][col][lane] tiles so the lane loops carry no aliasing
+template <size_t N, typename T, size_t L>
+ALWAYS_INLINE void FastMatBatchInverseTile(const T (&m)[N][N][L], T (&o)[N][N][L], T (&det)[L]) noexcept
+{
+    if constexpr (N == 1)
+    {
+        for (size_t l = 0; l < L; ++l)
+        {
+            det[l] = m[0][0][l];
+            o[0][0][l] = T(1) / det[l];
+        }
+    }
+    else if constexpr (N == 2)
+    {
+        for (size_t l = 0; l < L; ++l)
+        {
+            det[l] = m[0][0][l] * m[1][1][l] - m[0][1][l] * m[1][0][l];
+            const T r = T(1) / det[l];
+            o[0][0][l] = m[1][1][l] * r;
+            o[0][1][l] = -m[0][1][l] * r;
+            o[1][0][l] = -m[1][0][l] * r;
+            o[1][1][l] = m[0][0][l] * r;
+        }
+    }
+    else if constexpr (N == 3)
+    {
+        for (size_t l = 0; l < L; ++l)
+        {
+            const T c00 = m[1][1][l] * m[2][2][l] - m[1][2][l] * m[2][1][l];
+            const T c01 = m[1][2][l] * m[2][0][l] - m[1][0][l] * m[2][2][l];
+            const T c02 = m[1][0][l] * m[2][1][l] - m[1][1][l] * m[2][0][l];
+            det[l] = m[0][0][l] * c00 + m[0][1][l] * c01 + m[0][2][l] * c02;
+            const T r = T(1) / det[l];
+            o[0][0][l] = c00 * r;
+            o[0][1][l] = (m[0][2][l] * m[2][1][l] - m[0][1][l] * m[2][2][l]) * r;
+            o[0][2][l] = (m[0][1][l] * m[1][2][l] - m[0][2][l] * m[1][1][l]) * r;
+            o[1][0][l] = c01 * r;
+            o[1][1][l] = (m[0][0][l] * m[2][2][l] - m[0][2][l] * m[2][0][l]) * r;
+            o[1][2][l] = (m[0][2][l] * m[1][0][l] - m[0][0][l] * m[1][2][l]) * r;
+            o[2][0][l] = c02 * r;
+            o[2][1][l] = (m[0][1][l] * m[2][0][l] - m[0][0][l] * m[2][1][l]) * r;
+            o[2][2][l] = (m[0][0][l] * m[1][1][l] - m[0][1][l] * m[1][0][l]) * r;
+        }
+    }
+    else
+    {
+        for (size_t l = 0; l < L; ++l)
+        {
+            const T s0 = m[0][0][l] * m[1][1][l] - m[1][0][l] * m[0][1][l], s1 = m[0][0][l] * m[1][2][l] - m[1][0][l] * m[0][2][l];
+            const T s2 = m[0][0][l] * m[1][3][l] - m[1][0][l] * m[0][3][l], s3 = m[0][1][l] * m[1][2][l] - m[1][1][l] * m[0][2][l];
+            const T s4 = m[0][1][l] * m[1][3][l] - m[1][1][l] * m[0][3][l], s5 = m[0][2][l] * m[1][3][l] - m[1][2][l] * m[0][3][l];
+            const T c5 = m[2][2][l] * m[3][3][l] - m[3][2][l] * m[2][3][l], c4 = m[2][1][l] * m[3][3][l] - m[3][1][l] * m[2][3][l];
+            const T c3 = m[2][1][l] * m[3][2][l] - m[3][1][l] * m[2][2][l], c2 = m[2][0][l] * m[3][3][l] - m[3][0][l] * m[2][3][l];
+            const T c1 = m[2][0][l] * m[3][2][l] - m[3][0][l] * m[2][2][l], c0 = m[2][0][l] * m[3][1][l] - m[3][0][l] * m[2][1][l];
+            det[l] = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+            const T r = T(1) / det[l];
+            o[0][0][l] = (m[1][1][l] * c5 - m[1][2][l] * c4 + m[1][3][l] * c3) * r;
+            o[0][1][l] = (-m[0][1][l] * c5 + m[0][2][l] * c4 - m[0][3][l] * c3) * r;
+            o[0][2][l] = (m[3][1][l] * s5 - m[3][2][l] * s4 + m[3][3][l] * s3) * r;
+            o[0][3][l] = (-m[2][1][l] * s5 + m[2][2][l] * s4 - m[2][3][l] * s3) * r;
+            o[1][0][l] = (-m[1][0][l] * c5 + m[1][2][l] * c2 - m[1][3][l] * c1) * r;
+            o[1][1][l] = (m[0][0][l] * c5 - m[0][2][l] * c2 + m[0][3][l] * c1) * r;
+            o[1][2][l] = (-m[3][0][l] * s5 + m[3][2][l] * s2 - m[3][3][l] * s1) * r;
+            o[1][3][l] = (m[2][0][l] * s5 - m[2][2][l] * s2 + m[2][3][l] * s1) * r;
+            o[2][0][l] = (m[1][0][l] * c4 - m[1][1][l] * c2 + m[1][3][l] * c0) * r;
+            o[2][1][l] = (-m[0][0][l] * c4 + m[0][1][l] * c2 - m[0][3][l] * c0) * r;
+            o[2][2][l] = (m[3][0][l] * s4 - m[3][1][l] * s2 + m[3][3][l] * s0) * r;
+            o[2][3][l] = (-m[2][0][l] * s4 + m[2][1][l] * s2 - m[2][3][l] * s0) * r;
+            o[3][0][l] = (-m[1][0][l] * c3 + m[1][1][l] * c1 - m[1][2][l] * c0) * r;
+            o[3][1][l] = (m[0][0][l] * c3 - m[0][1][l] * c1 + m[0][2][l] * c0) * r;
+            o[3][2][l] = (-m[3][0][l] * s3 + m[3][1][l] * s1 - m[3][2][l] * s0) * r;
+            o[3][3][l] = (m[2][0][l] * s3 - m[2][1][l] * s1 + m[2][2][l] * s0) * r;
+        }
+    }
+}
+
+//out[n] = mats[n]^-1, throws std::domain_error naming the lowest singular matrix after the whole batch is processed
+//N <= 4 runs branch free closed forms across lanes, larger N falls back to FastMat::Inverse per matrix
+template <size_t N, typename T, typename Alloc>
+inline void InverseInto(const FastMatBatch<N, N, T, Alloc> &mats, FastMatBatch<N, N, T, Alloc> &out)
+{
+    static_assert(std::is_floating_point_v<T>, "InverseInto: FastMatBatch must hold a floating point type");
+    if (mats.Size() != out.Size())
+        throw std::invalid_argument("InverseInto: batch sizes differ");
+    std::atomic<size_t> singular{mats.Size()};
+    const auto report = [&singular](size_t n) noexcept
+    {
+        size_t prev = singular.load(std::memory_order_relaxed);
+        while (n < prev && !singular.compare_exchange_weak(prev, n, std::memory_order_relaxed))
+        {
+        }
+    };
+    if constexpr (N <= 4)
+    {
+        constexpr size_t L = fast_mat_batch_lanes<T>;
+        //a tile is already a [row][col][lane] block, it is read in place and the result staged in a local so the lane loops run without alias checks
+        FastMatBatchTiles<L>(mats.Size(), [&](size_t first, size_t last)
+                             {
+                                 alignas(64) T o[N][N][L], det[L];
+                                 for (size_t tile = first; tile < last; ++tile)
+                                 {
+                                     const size_t base = tile * L;
+                                     const auto &m = *reinterpret_cast<const T(*)[N][N][L]>(mats.Tile(tile, 0, 0));
+                                     FastMatBatchInverseTile<N, T, L>(m, o, det);
+                                     const size_t lanes = std::min(L, mats.Size() - base);
+                                     //the padded lanes of the last tile invert to inf and NaN, they are written back as zeros
+                                     for (size_t i = 0; i < N * N && lanes < L; ++i)
+                                     {
+                                         std::fill(o[i / N][i % N] + lanes, o[i / N][i % N] + L, T(0));
+                                     }
+                                     std::memcpy(out.Tile(tile, 0, 0), o, sizeof(o));
+                                     for (size_t l = 0; l < lanes; ++l)
+                                     {
+                                         if (det[l] == T(0))
+                                         {
+                                             report(base + l);
+                                             break;
+                                         }
+                                     }
+                                 }
+                             });
+    }
+    else
+    {
+        FastMatBatchRange(mats.Size(), [&](size_t first, size_t last)
+                          {
+                              for (size_t n = first; n < last; ++n)
+                              {
+                                  try
+                                  {
+                                      out.Set(n, mats.Get(n).Inverse());
+                                  }
+                                  catch (const std::domain_error &)
+                                  {
+                                      report(n);
+                                  }
+                              }
+                          });
+    }
+    if (const size_t n = singular.load(std::memory_order_relaxed); n != mats.Size())
+        throw std::domain_error("InverseInto: matrix " + std::to_string(n) + " is singular");
+}
@@ -0,0 +1,409 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <algorithm>
+#include "utils.hpp"
+#include "simd_dispatch.hpp"
+#include "tpool.hpp"
+
+//GEMM engine, C += alpha * A * B on arbitrary (row stride, column stride) layouts
+//A and B may hold narrower element types than C (int8 into int32, fp16/bf16 into float), packing widens them to T
+//follows the Goto/BLIS structure: NC x KC panels of B are packed for L3/L1, MC x KC blocks of A for L2,
+//and an MR x NR register tile is accumulated by the microkernel
+//products with at most GemmBlocking::thin rows or columns of C skip packing for GEMV kernels that stream the large operand once
+
+//bytes of B consumed per k step by the microkernel, tuned so the MR x NR accumulators stay in registers
+#if defined(__AVX512F__)
+#define GEMM_TILE_BYTES 128
+#else
+#define GEMM_TILE_BYTES 32
+#endif
+
+//register tile per dispatch level, the build's own level keeps GEMM_TILE_BYTES
+template <SimdLevel L>
+inline constexpr size_t gemm_tile_bytes = L == simd_baseline ? GEMM_TILE_BYTES : L == SimdLevel::AVX512 ? 128 : L == SimdLevel::Scalar ? 16 : 32;
+
+template <typename T, size_t TileBytes = GEMM_TILE_BYTES>
+struct GemmBlocking
+{
+    static constexpr size_t NR = (TileBytes / sizeof(T)) < 4 ? 4 : (TileBytes / sizeof(T));
+    static constexpr size_t MR = 6;
+    static constexpr size_t KC = 256;
+    static constexpr size_t MC = MR * 20;
+    static constexpr size_t NC = NR * 256;
+    static constexpr size_t small_flops = 32 * 32 * 32;     //below this packing costs more than it saves
+    static constexpr size_t parallel_flops = 128 * 128 * 128; //below this forking costs more than it saves
+    static constexpr size_t thin = 4;                          //products with at most this many rows or columns of C take the GEMV kernels
+    static constexpr size_t lanes = (32 / sizeof(T)) < 4 ? 4 : (32 / sizeof(T)); //GEMV accumulators per dot product, one 256 bit register
+    static constexpr size_t parallel_thin = size_t(1) << 18; //GEMV is memory bound, so it splits across threads much sooner than GEMM
+};
+
+//grow only, 64 byte aligned, per thread scratch for packed panels
+template <typename T>
+class GemmBuffer
+{
+private:
+    T *buf = nullptr;
+    size_t cap = 0;
+
+public:
+    GemmBuffer() noexcept = default;
+    GemmBuffer(const GemmBuffer &) = delete;
+    GemmBuffer &operator=(const GemmBuffer &) = delete;
+
+    T *Get(size_t n)
+    {
+        if (n > cap)
+        {
+            //emptied first so a failed allocation leaves nothing to free twice
+            ::operator delete(buf, std::align_val_t{64});
+            buf = nullptr;
+            cap = 0;
+            buf = static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t{64}));
+            cap = n;
+        }
+        return buf;
+    }
+
+    ~GemmBuffer() noexcept { ::operator delete(buf, std::align_val_t{64}); }
+};
+
+//packs an mc x kc block of A into MR row panels, each panel stored k-major, short panels zero padded
+template <typename T, size_t MR, typename TA>
+inline void GemmPackA(size_t mc, size_t kc, const TA *a, size_t rsa, size_t csa, T *buf) noexcept
+{
+    for (size_t ir = 0; ir < mc; ir += MR)
+    {
+        const size_t mr = std::min(MR, mc - ir);
+        const TA *panel = a + ir * rsa;
+        if (mr == MR)
+        {
+            for (size_t p = 0; p < kc; ++p)
+            {
+                for (size_t i = 0; i < MR; ++i)
+                {
+                    buf[i] = T(panel[i * rsa + p * csa]);
+                }
+                buf += MR;
+            }
+        }
+        else
+        {
+            for (size_t p = 0; p < kc; ++p)
+            {
+                for (size_t i = 0; i < MR; ++i)
+                {
+                    buf[i] = i < mr ? T(panel[i * rsa + p * csa]) : T();
+                }
+                buf += MR;
+            }
+        }
+    }
+}
+
+//packs a kc x nc block of B into NR column panels, each panel stored k-major, short panels zero padded
+template <typename T, size_t NR, typename TB>
+inline void GemmPackB(size_t kc, size_t nc, const TB *b, size_t rsb, size_t csb, T *buf) noexcept
+{
+    for (size_t jr = 0; jr < nc; jr += NR)
+    {
+        const size_t nr = std::min(NR, nc - jr);
+        const TB *panel = b + jr * csb;
+        for (size_t p = 0; p < kc; ++p)
+        {
+            const TB *row = panel + p * rsb;
+            if (nr == NR && csb == 1)
+            {
+                for (size_t j = 0; j < NR; ++j)
+                {
+                    buf[j] = T(row[j]);
+                }
+            }
+            else
+            {
+                for (size_t j = 0; j < NR; ++j)
+                {
+                    buf[j] = j < nr ? T(row[j * csb]) : T();
+                }
+            }
+            buf += NR;
+        }
+    }
+}
+
+//MR x NR register tile, a and b are packed panels, only the leading m x n of the tile is written back
+template <typename T, size_t MR, size_t NR>
+ALWAYS_INLINE void GemmMicroKernel(size_t kc, T alpha, const T *__restrict a, const T *__restrict b, T *c, size_t rsc, size_t csc, size_t m, size_t n) noexcept
+{
+    T acc[MR][NR] = {};
+    for (size_t p = 0; p < kc; ++p)
+    {
+#pragma GCC unroll 16
+        for (size_t i = 0; i < MR; ++i)
+        {
+            const T ai = a[i];
+#pragma GCC unroll 64
+            for (size_t j = 0; j < NR; ++j)
+            {
+                acc[i][j] += ai * b[j];
+            }
+        }
+        a += MR;
+        b += NR;
+    }
+    if (m == MR && n == NR && csc == 1)
+    {
+        for (size_t i = 0; i < MR; ++i)
+        {
+            for (size_t j = 0; j < NR; ++j)
+            {
+                c[i * rsc + j] += alpha * acc[i][j];
+            }
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < m; ++i)
+        {
+            for (size_t j = 0; j < n; ++j)
+            {
+                c[i * rsc + j * csc] += alpha * acc[i][j];
+            }
+        }
+    }
+}
+
+//unpacked i-k-j loop for products too small to amortize packing
+template <typename T, typename TA, typename TB>
+inline void GemmSmall(size_t m, size_t n, size_t k, T alpha, const TA *a, size_t rsa, size_t csa, const TB *b, size_t rsb, size_t csb, T *c, size_t rsc, size_t csc) noexcept
+{
+    for (size_t i = 0; i < m; ++i)
+    {
+        for (size_t p = 0; p < k; ++p)
+        {
+            const T aip = alpha * T(a[i * rsa + p * csa]);
+            const TB *brow = b + p * rsb;
+            T *crow = c + i * rsc;
+            for (size_t j = 0; j < n; ++j)
+            {
+                crow[j * csc] += aip * T(brow[j * csb]);
+            }
+        }
+    }
+}
+
+//one contiguous row of A against one contiguous column of B, a register of lanes so the loop vectorizes without reassociating
+//a single pair per call on purpose, GCC packs several pairs' accumulators into shuffles instead of straight FMAs
+template <typename T, typename TA, typename TB>
+ALWAYS_INLINE T GemvDot(size_t kc, const TA *a, const TB *b) noexcept
+{
+    constexpr size_t L = GemmBlocking<T>::lanes;
+    T acc[L] = {};
+    size_t p = 0;
+    for (; p + L <= kc; p += L)
+    {
+#pragma GCC unroll 64
+        for (size_t l = 0; l < L; ++l)
+        {
+            acc[l] += T(a[p + l]) * T(b[p + l]);
+        }
+    }
+    T sum = T();
+    for (; p < kc; ++p)
+    {
+        sum += T(a[p]) * T(b[p]);
+    }
+    for (size_t l = 0; l < L; ++l)
+    {
+        sum += acc[l];
+    }
+    return sum;
+}
+
+//C (m x n) += alpha * A * B as dot products, A rows and B columns contiguous (csa == 1, rsb == 1)
+//each KC slice of a row of A stays in L1 while every column of B passes over it, so A streams from memory once whatever n is
+template <typename T, typename TA, typename TB>
+inline void GemvDots(size_t m, size_t n, size_t k, T alpha, const TA *a, size_t rsa, const TB *b, size_t csb, T *c, size_t rsc, size_t csc) noexcept
+{
+    constexpr size_t KC = GemmBlocking<T>::KC * 4;
+    for (size_t pc = 0; pc < k; pc += KC)
+    {
+        const size_t kc = std::min(KC, k - pc);
+        for (size_t i = 0; i < m; ++i)
+        {
+            const TA *ai = a + i * rsa + pc;
+            for (size_t j = 0; j < n; ++j)
+            {
+                c[i * rsc + j * csc] += alpha * GemvDot<T>(kc, ai, b + j * csb + pc);
+            }
+        }
+    }
+}
+
+//C (m x n) += alpha * A * B as scaled rows of B added to rows of C, B and C rows contiguous (csb == 1, csc == 1)
+//an L1 sized slice of the m rows of C takes every row of B in turn, four at a time, so B streams from memory once
+template <typename T, typename TA, typename TB>
+inline void GemvAxpy(size_t m, size_t n, size_t k, T alpha, const TA *a, size_t rsa, size_t csa, const TB *b, size_t rsb, T *c, size_t rsc) noexcept
+{
+    constexpr size_t L = GemmBlocking<T>::lanes;
+    const size_t nb = std::max(L, 4096 / sizeof(T) / m / L * L);
+    for (size_t j0 = 0; j0 < n; j0 += nb)
+    {
+        const size_t jn = std::min(nb, n - j0);
+        size_t p = 0;
+        for (; p + 4 <= k; p += 4)
+        {
+            const TB *b0 = b + p * rsb + j0, *b1 = b0 + rsb, *b2 = b1 + rsb, *b3 = b2 + rsb;
+            for (size_t i = 0; i < m; ++i)
+            {
+                const TA *ai = a + i * rsa + p * csa;
+                const T a0 = alpha * T(ai[0]), a1 = alpha * T(ai[csa]), a2 = alpha * T(ai[2 * csa]), a3 = alpha * T(ai[3 * csa]);
+                T *ci = c + i * rsc + j0;
+                for (size_t j = 0; j < jn; ++j)
+                {
+                    ci[j] += a0 * T(b0[j]) + a1 * T(b1[j]) + a2 * T(b2[j]) + a3 * T(b3[j]);
+                }
+            }
+        }
+        for (; p < k; ++p)
+        {
+            const TB *bp = b + p * rsb + j0;
+            for (size_t i = 0; i < m; ++i)
+            {
+                const T ap = alpha * T(a[i * rsa + p * csa]);
+                T *ci = c + i * rsc + j0;
+                for (size_t j = 0; j < jn; ++j)
+                {
+                    ci[j] += ap * T(bp[j]);
+                }
+            }
+        }
+    }
+}
+
+//matrix-vector and few-vector products, true when one of the GEMV kernels could take the layouts
+//either side of C may be the thin one, the transposed product C^T = B^T * A^T swaps the roles of A and B
+template <typename T, typename TA, typename TB>
+inline bool GemmThin(size_t m, size_t n, size_t k, T alpha, const TA *a, size_t rsa, size_t csa, const TB *b, size_t rsb, size_t csb, T *c, size_t rsc, size_t csc) noexcept
+{
+    constexpr size_t thin = GemmBlocking<T>::thin;
+    if (csa == 1 && rsb == 1 && std::min(m, n) <= thin)
+    {
+        if (n <= m)
+            GemvDots<T>(m, n, k, alpha, a, rsa, b, csb, c, rsc, csc);
+        else
+            GemvDots<T>(n, m, k, alpha, b, csb, a, rsa, c, csc, rsc);
+        return true;
+    }
+    if (m <= thin && csb == 1 && csc == 1)
+    {
+        GemvAxpy<T>(m, n, k, alpha, a, rsa, csa, b, rsb, c, rsc);
+        return true;
+    }
+    if (n <= thin && rsa == 1 && rsc == 1)
+    {
+        GemvAxpy<T>(n, m, k, alpha, b, csb, rsb, a, csa, c, csc);
+        return true;
+    }
+    return false;
+}
+
+//the serial engine for one blocking B, Gemm picks B and the instruction set at runtime
+template <typename T, typename B, typename TA, typename TB>
+inline void GemmBlocked(size_t m, size_t n, size_t k, T alpha, const TA *a, size_t rsa, size_t csa, const TB *b, size_t rsb, size_t csb, T *c, size_t rsc, size_t csc)
+{
+    if (std::min(m, n) <= B::thin && GemmThin<T>(m, n, k, alpha, a, rsa, csa, b, rsb, csb, c, rsc, csc))
+    {
+        return;
+    }
+    if (m * n * k <= B::small_flops)
+    {
+        GemmSmall<T>(m, n, k, alpha, a, rsa, csa, b, rsb, csb, c, rsc, csc);
+        return;
+    }
+
+    thread_local GemmBuffer<T> bufA, bufB;
+    T *packA = bufA.Get(B::MC * B::KC);
+    T *packB = bufB.Get(std::min(B::NC, (n + B::NR - 1) / B::NR * B::NR) * B::KC);
+
+    for (size_t jc = 0; jc < n; jc += B::NC)
+    {
+        const size_t nc = std::min(B::NC, n - jc);
+        for (size_t pc = 0; pc < k; pc += B::KC)
+        {
+            const size_t kc = std::min(B::KC, k - pc);
+            GemmPackB<T, B::NR>(kc, nc, b + pc * rsb + jc * csb, rsb, csb, packB);
+            for (size_t ic = 0; ic < m; ic += B::MC)
+            {
+                const size_t mc = std::min(B::MC, m - ic);
+                GemmPackA<T, B::MR>(mc, kc, a + ic * rsa + pc * csa, rsa, csa, packA);
+                for (size_t jr = 0; jr < nc; jr += B::NR)
+                {
+                    const T *pb = packB + jr * kc;
+                    for (size_t ir = 0; ir < mc; ir += B::MR)
+                    {
+                        GemmMicroKernel<T, B::MR, B::NR>(kc, alpha, packA + ir * kc, pb,
+                                                         c + (ic + ir) * rsc + (jc + jr) * csc, rsc, csc,
+                                                         std::min(B::MR, mc - ir), std::min(B::NR, nc - jr));
+                    }
+                }
+            }
+        }
+    }
+}
+
+//C (m x n) += alpha * A (m x k) * B (k x n), element (i, j) of X lives at x[i * rsx + j * csx]
+//runs through SimdDispatch with the register tile of the active level
+template <typename T, typename TA = T, typename TB = T>
+inline void Gemm(size_t m, size_t n, size_t k, T alpha, const TA *a, size_t rsa, size_t csa, const TB *b, size_t rsb, size_t csb, T *c, size_t rsc, size_t csc)
+{
+    if (!m || !n || !k)
+    {
+        return;
+    }
+    SimdDispatch([&](auto level)
+                 {
+                     using B = GemmBlocking<T, gemm_tile_bytes<decltype(level)::value>>;
+                     GemmBlocked<T, B>(m, n, k, alpha, a, rsa, csa, b, rsb, csb, c, rsc, csc);
+                 });
+}
+
+//Gemm split into independent tiles of C across the pool, each tile packs its own panels
+//packing B once per row tile costs O(k * n) per MC rows of C, which is noise next to the O(m * n * k) product
+template <typename T, typename TA = T, typename TB = T>
+inline void ParallelGemm(size_t m, size_t n, size_t k, T alpha, const TA *a, size_t rsa, size_t csa, const TB *b, size_t rsb, size_t csb, T *c, size_t rsc, size_t csc, ThreadPool &pool = ThreadPool::Global())
+{
+    using B = GemmBlocking<T>;
+    const size_t threads = pool.Concurrency();
+    if (std::min(m, n) <= B::thin && m * n * k >= B::parallel_thin && threads > 1)
+    {
+        //thin products split the long side of C, each piece streams its own share of the large operand
+        const bool rows = m >= n;
+        parallel_for(pool, 0, rows ? m : n, B::NR * 4, [&](size_t first, size_t last)
+                     {
+                         if (rows)
+                             Gemm<T>(last - first, n, k, alpha, a + first * rsa, rsa, csa, b, rsb, csb, c + first * rsc, rsc, csc);
+                         else
+                             Gemm<T>(m, last - first, k, alpha, a, rsa, csa, b + first * csb, rsb, csb, c + first * csc, rsc, csc);
+                     });
+        return;
+    }
+    if (threads <= 1 || m * n * k < B::parallel_flops)
+    {
+        Gemm<T>(m, n, k, alpha, a, rsa, csa, b, rsb, csb, c, rsc, csc);
+        return;
+    }
+    const size_t rowTiles = (m + B::MC - 1) / B::MC;
+    const size_t wantCols = std::max<size_t>(1, (threads * 2 + rowTiles - 1) / rowTiles);
+    const size_t tileN = std::min(B::NC, std::max(B::NR * 8, ((n + wantCols - 1) / wantCols + B::NR - 1) / B::NR * B::NR));
+    const size_t colTiles = (n + tileN - 1) / tileN;
+    parallel_for(pool, 0, rowTiles * colTiles, 1, [&](size_t first, size_t last)
+                 {
+                     for (size_t tile = first; tile < last; ++tile)
+                     {
+                         const size_t i = (tile / colTiles) * B::MC, j = (tile % colTiles) * tileN;
+                         Gemm<T>(std::min(B::MC, m - i), std::min(tileN, n - j), k, alpha,
+                              a + i * rsa, rsa, csa, b + j * csb, rsb, csb, c + i * rsc + j * csc, rsc, csc);
+                     }
+                 });
+}
@@ -0,0 +1,444 @@
+#pragma once
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+#include "utils.hpp"
+
+//bounded lock free queues for handing work between threads
+//MPMCQueue takes any number of producers and consumers (Vyukov), every cell carries a sequence number saying whose turn it is,
+//so a producer only competes with other producers for the enqueue index and a consumer with other consumers for the dequeue index
+//SPSCRing takes one producer and one consumer and is wait free, each side caches the other's index and rereads it only when the ring looks full or empty
+//indices sit on their own cache lines, batches claim a run of cells with one atomic operation
+
+//what the blocking Push / Pop do while the queue is full / empty
+enum class QueueWait
+{
+    Spin,  //pause instruction loop, lowest latency, burns a core
+    Yield, //spins briefly then yields the time slice
+    Block, //spins and yields briefly then sleeps on an atomic wait, the other side notifies only while someone sleeps
+};
+
+inline constexpr size_t queue_cache_line = 64;
+
+ALWAYS_INLINE void QueuePause() noexcept
+{
+#if defined(__SSE2__) || defined(_M_X64)
+    _mm_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+template <QueueWait W>
+class QueueWaiter
+{
+private:
+    static constexpr int spins = 64, yields = 16;
+    std::atomic<uint32_t> epoch{0};
+    std::atomic<uint32_t> sleepers{0};
+
+public:
+    //retries op until it returns true
+    template <typename F>
+    void Until(F &&op)
+    {
+        for (int i = 0;; ++i)
+        {
+            if (op())
+            {
+                return;
+            }
+            if (i < spins || W == QueueWait::Spin)
+            {
+                QueuePause();
+            }
+            else if (W == QueueWait::Yield || i < spins + yields)
+            {
+                std::this_thread::yield();
+            }
+            else
+            {
+                //the epoch is read before announcing the sleep and retrying, a notify after the retry changes it and wait returns
+                const uint32_t seen = epoch.load(std::memory_order_acquire);
+                sleepers.fetch_add(1, std::memory_order_seq_cst);
+                if (op())
+                {
+                    sleepers.fetch_sub(1, std::memory_order_relaxed);
+                    return;
+                }
+                epoch.wait(seen, std::memory_order_acquire);
+                sleepers.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    //called after every successful push / pop, free unless W is Block
+    ALWAYS_INLINE void Notify() noexcept
+    {
+        if constexpr (W == QueueWait::Block)
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (sleepers.load(std::memory_order_relaxed))
+            {
+                epoch.fetch_add(1, std::memory_order_release);
+                epoch.notify_all();
+            }
+        }
+    }
+};
+
+template <typename T>
+struct QueueSlot
+{
+    alignas(T) unsigned char bytes[sizeof(T)];
+
+    T *Ptr() noexcept { return std::launder(reinterpret_cast<T *>(bytes)); }
+};
+
+inline size_t QueueCapacity(size_t capacity)
+{
+    if (capacity < 2 || capacity > (size_t(1) << (sizeof(size_t) * 8 - 2)))
+        throw std::invalid_argument("queue capacity out of range");
+    return std::bit_ceil(capacity);
+}
+
+//capacity is rounded up to a power of two, elements must be nothrow move constructible and assignable
+template <typename T, QueueWait W = QueueWait::Yield>
+class MPMCQueue
+{
+    //pops claim their cells before moving out, a throwing move assignment would leave them claimed for good
+    static_assert(std::is_nothrow_move_constructible_v<T> && std::is_nothrow_move_assignable_v<T> && std::is_nothrow_destructible_v<T>, "MPMCQueue: T must be nothrow movable");
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> seq;
+        QueueSlot<T> slot;
+    };
+
+    const size_t mask;
+    std::unique_ptr<Cell[]> cells;
+    alignas(queue_cache_line) std::atomic<size_t> enqueuePos{0};
+    alignas(queue_cache_line) std::atomic<size_t> dequeuePos{0};
+    alignas(queue_cache_line) QueueWaiter<W> waiter;
+
+    //claims up to n cells starting at the index, a cell is free for position p when its sequence is p + offset
+    //returns the first claimed position and sets n to the count, 0 when the queue is full / empty
+    size_t Claim(std::atomic<size_t> &index, size_t offset, size_t &n) noexcept
+    {
+        size_t pos = index.load(std::memory_order_relaxed);
+        while (true)
+        {
+            const intptr_t diff = intptr_t(cells[pos & mask].seq.load(std::memory_order_acquire)) - intptr_t(pos + offset);
+            if (diff < 0)
+            {
+                n = 0;
+                return pos;
+            }
+            if (diff > 0)
+            {
+                pos = index.load(std::memory_order_relaxed);
+                continue;
+            }
+            //the later cells' sequences can't move until their positions are claimed, which needs this CAS to succeed first
+            size_t k = 1;
+            while (k < n && cells[(pos + k) & mask].seq.load(std::memory_order_acquire) == pos + k + offset)
+            {
+                ++k;
+            }
+            if (index.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed, std::memory_order_relaxed))
+            {
+                n = k;
+                return pos;
+            }
+        }
+    }
+
+public:
+    explicit MPMCQueue(size_t capacity) : mask(QueueCapacity(capacity) - 1), cells(new Cell[mask + 1])
+    {
+        for (size_t i = 0; i <= mask; ++i)
+        {
+            cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+    MPMCQueue(const MPMCQueue &) = delete;
+    MPMCQueue &operator=(const MPMCQueue &) = delete;
+
+    //no other thread may be using the queue
+    ~MPMCQueue()
+    {
+        if constexpr (!std::is_trivially_destructible_v<T>)
+        {
+            const size_t end = enqueuePos.load(std::memory_order_relaxed);
+            for (size_t pos = dequeuePos.load(std::memory_order_relaxed); pos != end; ++pos)
+            {
+                std::destroy_at(cells[pos & mask].slot.Ptr());
+            }
+        }
+    }
+
+    size_t Capacity() const noexcept { return mask + 1; }
+
+    //a snapshot, stale as soon as it is returned
+    size_t SizeApprox() const noexcept
+    {
+        const size_t d = dequeuePos.load(std::memory_order_relaxed), e = enqueuePos.load(std::memory_order_relaxed);
+        return e > d ? e - d : 0;
+    }
+
+    //constructs in place when that can't throw, otherwise builds the element first and moves it in once a cell is claimed,
+    //so an exception leaves the queue untouched
+    template <typename... Args>
+    bool TryEmplace(Args &&...args)
+    {
+        if constexpr (!std::is_nothrow_constructible_v<T, Args...>)
+        {
+            T v(std::forward<Args>(args)...);
+            return TryEmplace(std::move(v));
+        }
+        else
+        {
+            size_t n = 1;
+            const size_t pos = Claim(enqueuePos, 0, n);
+            if (!n)
+            {
+                return false;
+            }
+            Cell &c = cells[pos & mask];
+            ::new (c.slot.bytes) T(std::forward<Args>(args)...);
+            c.seq.store(pos + 1, std::memory_order_release);
+            waiter.Notify();
+            return true;
+        }
+    }
+    bool TryPush(T &&v) { return TryEmplace(std::move(v)); }
+    bool TryPush(const T &v) { return TryEmplace(v); }
+
+    bool TryPop(T &out) noexcept
+    {
+        return TryPopBatch(&out, 1) == 1;
+    }
+
+    //moves up to n items out of items, returns how many fit
+    size_t TryPushBatch(T *items, size_t n) noexcept
+    {
+        if (!n)
+        {
+            return 0;
+        }
+        const size_t pos = Claim(enqueuePos, 0, n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            Cell &c = cells[(pos + i) & mask];
+            ::new (c.slot.bytes) T(std::move(items[i]));
+            c.seq.store(pos + i + 1, std::memory_order_release);
+        }
+        if (n)
+        {
+            waiter.Notify();
+        }
+        return n;
+    }
+
+    //move assigns up to n items to out, returns how many were taken
+    size_t TryPopBatch(T *out, size_t n) noexcept
+    {
+        if (!n)
+        {
+            return 0;
+        }
+        const size_t pos = Claim(dequeuePos, 1, n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            Cell &c = cells[(pos + i) & mask];
+            T *p = c.slot.Ptr();
+            out[i] = std::move(*p);
+            std::destroy_at(p);
+            c.seq.store(pos + i + mask + 1, std::memory_order_release);
+        }
+        if (n)
+        {
+            waiter.Notify();
+        }
+        return n;
+    }
+
+    void Push(T v)
+    {
+        waiter.Until([&] { return TryEmplace(std::move(v)); });
+    }
+    void Pop(T &out)
+    {
+        waiter.Until([&] { return TryPop(out); });
+    }
+
+    //pushes all n, waiting for room as needed
+    void PushBatch(T *items, size_t n)
+    {
+        waiter.Until([&]
+                     {
+                         const size_t k = TryPushBatch(items, n);
+                         items += k;
+                         n -= k;
+                         return !n;
+                     });
+    }
+    //waits for at least one item, returns how many of the n were taken
+    size_t PopBatch(T *out, size_t n)
+    {
+        size_t k = 0;
+        waiter.Until([&] { return !n || (k = TryPopBatch(out, n)) != 0; });
+        return k;
+    }
+};
+
+//single producer single consumer ring, capacity is rounded up to a power of two
+//TryPush / Push and their batches may only be called by the producer thread, TryPop / Pop and theirs by the consumer thread
+template <typename T, QueueWait W = QueueWait::Yield>
+class SPSCRing
+{
+    static_assert(std::is_nothrow_move_constructible_v<T> && std::is_nothrow_move_assignable_v<T> && std::is_nothrow_destructible_v<T>, "SPSCRing: T must be nothrow movable");
+
+private:
+    const size_t mask;
+    std::unique_ptr<QueueSlot<T>[]> slots;
+    alignas(queue_cache_line) std::atomic<size_t> head{0}; //next to pop, written by the consumer
+    size_t cachedTail = 0;                                 //consumer's last view of tail
+    alignas(queue_cache_line) std::atomic<size_t> tail{0}; //next to push, written by the producer
+    size_t cachedHead = 0;                                 //producer's last view of head
+    alignas(queue_cache_line) QueueWaiter<W> waiter;
+
+    //free slots for the producer, rereading head only when the cached view has fewer than want
+    size_t Room(size_t t, size_t want) noexcept
+    {
+        size_t room = mask + 1 - (t - cachedHead);
+        if (room < want)
+        {
+            cachedHead = head.load(std::memory_order_acquire);
+            room = mask + 1 - (t - cachedHead);
+        }
+        return room;
+    }
+    size_t Filled(size_t h, size_t want) noexcept
+    {
+        size_t filled = cachedTail - h;
+        if (filled < want)
+        {
+            cachedTail = tail.load(std::memory_order_acquire);
+            filled = cachedTail - h;
+        }
+        return filled;
+    }
+
+public:
+    explicit SPSCRing(size_t capacity) : mask(QueueCapacity(capacity) - 1), slots(new QueueSlot<T>[mask + 1]) {}
+    SPSCRing(const SPSCRing &) = delete;
+    SPSCRing &operator=(const SPSCRing &) = delete;
+
+    ~SPSCRing()
+    {
+        if constexpr (!std::is_trivially_destructible_v<T>)
+        {
+            const size_t end = tail.load(std::memory_order_relaxed);
+            for (size_t pos = head.load(std::memory_order_relaxed); pos != end; ++pos)
+            {
+                std::destroy_at(slots[pos & mask].Ptr());
+            }
+        }
+    }
+
+    size_t Capacity() const noexcept { return mask + 1; }
+    size_t SizeApprox() const noexcept { return tail.load(std::memory_order_relaxed) - head.load(std::memory_order_relaxed); }
+
+    template <typename... Args>
+    bool TryEmplace(Args &&...args)
+    {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        //only the producer advances tail, so a throwing constructor leaves the ring untouched
+        if (!Room(t, 1))
+        {
+            return false;
+        }
+        ::new (slots[t & mask].bytes) T(std::forward<Args>(args)...);
+        tail.store(t + 1, std::memory_order_release);
+        waiter.Notify();
+        return true;
+    }
+    bool TryPush(T &&v) { return TryEmplace(std::move(v)); }
+    bool TryPush(const T &v) { return TryEmplace(v); }
+
+    bool TryPop(T &out) noexcept
+    {
+        return TryPopBatch(&out, 1) == 1;
+    }
+
+    size_t TryPushBatch(T *items, size_t n) noexcept
+    {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        n = std::min(n, Room(t, n));
+        for (size_t i = 0; i < n; ++i)
+        {
+            ::new (slots[(t + i) & mask].bytes) T(std::move(items[i]));
+        }
+        if (n)
+        {
+            tail.store(t + n, std::memory_order_release);
+            waiter.Notify();
+        }
+        return n;
+    }
+
+    size_t TryPopBatch(T *out, size_t n) noexcept
+    {
+        const size_t h = head.load(std::memory_order_relaxed);
+        n = std::min(n, Filled(h, n));
+        for (size_t i = 0; i < n; ++i)
+        {
+            T *p = slots[(h + i) & mask].Ptr();
+            out[i] = std::move(*p);
+            std::destroy_at(p);
+        }
+        if (n)
+        {
+            head.store(h + n, std::memory_order_release);
+            waiter.Notify();
+        }
+        return n;
+    }
+
+    void Push(T v)
+    {
+        waiter.Until([&] { return TryEmplace(std::move(v)); });
+    }
+    void Pop(T &out)
+    {
+        waiter.Until([&] { return TryPop(out); });
+    }
+    void PushBatch(T *items, size_t n)
+    {
+        waiter.Until([&]
+                     {
+                         const size_t k = TryPushBatch(items, n);
+                         items += k;
+                         n -= k;
+                         return !n;
+                     });
+    }
+    size_t PopBatch(T *out, size_t n)
+    {
+        size_t k = 0;
+        waiter.Until([&] { return !n || (k = TryPopBatch(out, n)) != 0; });
+        return k;
+    }
+};
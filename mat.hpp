@@ -2,48 +2,581 @@
 #include <stdexcept>
 #include <string>
 #include <ostream>
+#include <istream>
+#include <string_view>
+#include <charconv>
+#include <cctype>
 #include <concepts>
 #include <type_traits>
+#include <memory>
+#include <cstring>
+#include <algorithm>
+#include <span>
+#include <iterator>
+#include <cassert>
+#include "utils.hpp"
+#include "simd_dispatch.hpp"
+#include "gemm.hpp"
+#include "tpool.hpp"
+#include "mat_stats.hpp"
 
-template <typename T>
-struct copy_fast : std::conditional<std::is_trivially_copyable_v<T>, T, const T &>
+//elementwise loops at least this long are split across ThreadPool::Global()
+#ifndef MAT_PARALLEL_ELEMENTS
+#define MAT_PARALLEL_ELEMENTS (size_t(1) << 16)
+#endif
+
+//calls body(first, last) over [0, n) units of work each, serially while n * work is under threshold, else across
+//ThreadPool::Global() in pieces of about grain work, each piece runs through SimdDispatch, so body should be a leaf loop
+template <typename F>
+ALWAYS_INLINE void MatParallelUnits(size_t n, size_t work, size_t threshold, size_t grain, F &&body)
 {
-};
+    const auto piece = [&body](size_t first, size_t last) { SimdDispatch([&](auto) { body(first, last); }); };
+    if (n * work < threshold)
+    {
+        piece(size_t(0), n);
+    }
+    else
+    {
+        parallel_for(0, n, std::max<size_t>(1, grain / std::max<size_t>(work, 1)), piece);
+    }
+}
 
-template <typename T>
-using copy_fast_t = typename copy_fast<T>::type;
+//calls body(first, last) over [0, n) elements, serially below MAT_PARALLEL_ELEMENTS
+template <typename F>
+ALWAYS_INLINE void MatParallelRange(size_t n, F &&body)
+{
+    MatParallelUnits(n, 1, MAT_PARALLEL_ELEMENTS, MAT_PARALLEL_ELEMENTS / 4, body);
+}
 
 template <typename T>
 concept SizeType = std::is_unsigned_v<T> &&std::is_integral_v<T>;
 
-template <typename Type = float, SizeType SizeT = size_t>
-class Mat
+//CRTP base of every lazily evaluated elementwise expression, Derived provides Eval(flat index), Eval(x, y), SizeX(), SizeY()
+//and a static contiguous flag, true when every leaf is dense row major storage so the flat index can be used
+template <typename Derived>
+struct MatExpr
+{
+    ALWAYS_INLINE const Derived &Self() const noexcept { return static_cast<const Derived &>(*this); }
+};
+
+//true when evaluating e into the row major buffer [first, last) of row length w could read an element after it was written,
+//only views can point into storage they don't own, every other leaf reads its own buffer
+template <typename E>
+inline bool MatExprAliases(const E &e, const void *first, const void *last, size_t w) noexcept
+{
+    if constexpr (requires { e.Aliases(first, last, w); })
+        return e.Aliases(first, last, w);
+    else
+        return false;
+}
+
+//arithmetic per element of an expression, leaves are free, only read by instrumentation
+template <typename E>
+constexpr size_t MatExprOps() noexcept
+{
+    if constexpr (requires { E::ops; })
+        return E::ops;
+    else
+        return 0;
+}
+
+//dense operands only need matching areas, as Mat always allowed, strided ones need matching shapes
+template <typename A, typename B>
+inline bool MatShapesMatch(const A &a, const B &b) noexcept
+{
+    if constexpr (A::contiguous && B::contiguous)
+    {
+        return (a.SizeX() * a.SizeY()) == (b.SizeX() * b.SizeY());
+    }
+    else
+    {
+        return (a.SizeX() == b.SizeX()) && (a.SizeY() == b.SizeY());
+    }
+}
+
+//op(dst(x, y), e(x, y)) over a w x h block of row major storage with row stride ld
+//dense expressions over a dense block run as one flat loop, everything else row by row
+//dst must not be read out of order by e, Mat assignment evaluates such expressions into fresh storage, writes through a MatView don't check
+//OpFlops is the arithmetic op itself does per element, 0 for plain assignment
+template <size_t OpFlops, typename T, typename E, typename Op>
+inline void MatEvalInto(T *dst, size_t w, size_t h, size_t ld, const E &e, Op op)
+{
+    MAT_STATS_SCOPE(MatOp::Elementwise, uint64_t(w) * h * (MatExprOps<E>() + OpFlops));
+    if constexpr (E::contiguous)
+    {
+        if (ld == w)
+        {
+            MatParallelRange(w * h, [dst, &e, op](size_t first, size_t last)
+                             {
+                                 for (size_t i = first; i < last; ++i)
+                                 {
+                                     op(dst[i], e.Eval(i));
+                                 }
+                             });
+            return;
+        }
+    }
+    if (!w)
+    {
+        return;
+    }
+    auto rows = [dst, w, ld, &e, op](size_t first, size_t last)
+    {
+        SimdDispatch([&](auto)
+                     {
+                         for (size_t y = first; y < last; ++y)
+                         {
+                             T *row = dst + y * ld;
+                             for (size_t x = 0; x < w; ++x)
+                             {
+                                 op(row[x], e.Eval(x, y));
+                             }
+                         }
+                     });
+    };
+    if (w * h < MAT_PARALLEL_ELEMENTS)
+    {
+        rows(0, h);
+    }
+    else
+    {
+        parallel_for(0, h, std::max<size_t>(1, MAT_PARALLEL_ELEMENTS / 4 / w), rows);
+    }
+}
+
+template <typename Type = float, SizeType SizeT = size_t, typename Alloc = AlignedAllocator<Type, 64>>
+class Mat;
+
+//iterates the rows of row major storage as contiguous spans
+template <typename Type>
+class MatRowIterator
+{
+private:
+    Type *ptr = nullptr;
+    size_t width = 0, stride = 0;
+
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::span<Type>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = std::span<Type>;
+
+    MatRowIterator() noexcept = default;
+    MatRowIterator(Type *p, size_t w, size_t s) noexcept : ptr(p), width(w), stride(s) {}
+
+    std::span<Type> operator*() const noexcept { return std::span<Type>(ptr, width); }
+    MatRowIterator &operator++() noexcept
+    {
+        ptr += stride;
+        return *this;
+    }
+    MatRowIterator operator++(int) noexcept
+    {
+        MatRowIterator old = *this;
+        ptr += stride;
+        return old;
+    }
+    bool operator==(const MatRowIterator &other) const noexcept { return ptr == other.ptr; }
+};
+
+//visits every element of a strided or transposed window row by row, X() and Y() give the position
+template <typename Type>
+class MatElementIterator
+{
+private:
+    Type *row = nullptr;
+    size_t x = 0, y = 0, width = 0, rowStride = 0, colStride = 0;
+
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::remove_const_t<Type>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = Type *;
+    using reference = Type &;
+
+    MatElementIterator() noexcept = default;
+    MatElementIterator(Type *p, size_t w, size_t y0, size_t rs, size_t cs) noexcept : row(p), y(y0), width(w), rowStride(rs), colStride(cs) {}
+
+    Type &operator*() const noexcept { return row[x * colStride]; }
+    Type *operator->() const noexcept { return row + x * colStride; }
+    size_t X() const noexcept { return x; }
+    size_t Y() const noexcept { return y; }
+    MatElementIterator &operator++() noexcept
+    {
+        if (++x == width)
+        {
+            x = 0;
+            ++y;
+            row += rowStride;
+        }
+        return *this;
+    }
+    MatElementIterator operator++(int) noexcept
+    {
+        MatElementIterator old = *this;
+        ++*this;
+        return old;
+    }
+    bool operator==(const MatElementIterator &other) const noexcept { return y == other.y && x == other.x; }
+};
+
+template <typename Type>
+struct MatRowRange
+{
+    MatRowIterator<Type> first, last;
+    MatRowIterator<Type> begin() const noexcept { return first; }
+    MatRowIterator<Type> end() const noexcept { return last; }
+};
+
+//non owning strided window onto row major storage, element (x, y) is ptr[y * stride + x], or ptr[x * stride + y] once transposed
+//blocks, columns and transposes of a view are views of the same storage, nothing is copied
+//assigning to a view writes through it like std::slice_array, it never rebinds
+template <typename Type, SizeType SizeT = size_t>
+class MatView : public MatExpr<MatView<Type, SizeT>>
+{
+private:
+    Type *ptr = nullptr;
+    SizeT sizeY = 0, sizeX = 0;
+    size_t stride = 0;
+    bool transposed = false;
+
+    ALWAYS_INLINE size_t Offset(size_t x, size_t y) const noexcept { return transposed ? x * stride + y : y * stride + x; }
+
+    template <size_t OpFlops, typename E, typename Op>
+    void Apply(const E &e, Op op) const
+    {
+        if (!transposed)
+        {
+            MatEvalInto<OpFlops>(ptr, sizeX, sizeY, stride, e, op);
+            return;
+        }
+        MAT_STATS_SCOPE(MatOp::Elementwise, uint64_t(sizeX) * sizeY * (MatExprOps<E>() + OpFlops));
+        for (size_t y = 0; y < sizeY; ++y)
+        {
+            for (size_t x = 0; x < sizeX; ++x)
+            {
+                op(ptr[x * stride + y], e.Eval(x, y));
+            }
+        }
+    }
+
+    template <typename Op>
+    void ApplyScalar(const std::remove_const_t<Type> &value, Op op) const
+    {
+        MAT_STATS_SCOPE(MatOp::Scalar, uint64_t(sizeX) * sizeY);
+        for (size_t y = 0; y < sizeY; ++y)
+        {
+            for (size_t x = 0; x < sizeX; ++x)
+            {
+                op(ptr[Offset(x, y)], value);
+            }
+        }
+    }
+
+public:
+    using type = std::remove_const_t<Type>;
+    using storage_type = SizeT;
+    static constexpr bool contiguous = false;
+
+    MatView() noexcept = default;
+    MatView(Type *p, SizeT w, SizeT h, size_t rowStride, bool isTransposed = false) noexcept : ptr(p), sizeY(h), sizeX(w), stride(rowStride), transposed(isTransposed) {}
+    MatView(const MatView &) noexcept = default;
+    template <typename U>
+        requires(std::is_same_v<const U, Type> && !std::is_same_v<U, Type>)
+    MatView(const MatView<U, SizeT> &v) noexcept : ptr(v.data()), sizeY(v.SizeY()), sizeX(v.SizeX()), stride(v.Stride()), transposed(v.IsTransposed()) {}
+
+    //reading the view only overlaps safely with a destination it maps onto element for element
+    bool Aliases(const void *first, const void *last, size_t w) const noexcept
+    {
+        if (!sizeX || !sizeY)
+        {
+            return false;
+        }
+        const void *end = ptr + Offset(sizeX - 1, sizeY - 1) + 1;
+        if (end <= first || last <= static_cast<const void *>(ptr))
+        {
+            return false;
+        }
+        return !(static_cast<const void *>(ptr) == first && !transposed && stride == w);
+    }
+
+    MatView &operator=(const MatView &v)
+    {
+        if (!MatShapesMatch(*this, v))
+            throw std::invalid_argument("operator=: parameter must match the dimensions of this");
+        Apply<0>(v, [](type &d, const type &s) { d = s; });
+        return *this;
+    }
+    template <typename E>
+    MatView &operator=(const MatExpr<E> &expr)
+    {
+        if (!MatShapesMatch(*this, expr.Self()))
+            throw std::invalid_argument("operator=: parameter must match the dimensions of this");
+        Apply<0>(expr.Self(), [](type &d, const type &s) { d = s; });
+        return *this;
+    }
+    template <typename E>
+    MatView &operator+=(const MatExpr<E> &expr)
+    {
+        if (!MatShapesMatch(*this, expr.Self()))
+            throw std::invalid_argument("operator+=: parameter must match the dimensions of this");
+        Apply<1>(expr.Self(), [](type &d, const type &s) { d += s; });
+        return *this;
+    }
+    MatView &operator+=(copy_fast_t<type> value)
+    {
+        ApplyScalar(value, [](type &d, const type &s) { d += s; });
+        return *this;
+    }
+    template <typename E>
+    MatView &operator-=(const MatExpr<E> &expr)
+    {
+        if (!MatShapesMatch(*this, expr.Self()))
+            throw std::invalid_argument("operator-=: parameter must match the dimensions of this");
+        Apply<1>(expr.Self(), [](type &d, const type &s) { d -= s; });
+        return *this;
+    }
+    MatView &operator-=(copy_fast_t<type> value)
+    {
+        ApplyScalar(value, [](type &d, const type &s) { d -= s; });
+        return *this;
+    }
+    template <typename E>
+    MatView &operator*=(const MatExpr<E> &expr)
+    {
+        if (!MatShapesMatch(*this, expr.Self()))
+            throw std::invalid_argument("operator*=: parameter must match the dimensions of this");
+        Apply<1>(expr.Self(), [](type &d, const type &s) { d *= s; });
+        return *this;
+    }
+    MatView &operator*=(copy_fast_t<type> value)
+    {
+        ApplyScalar(value, [](type &d, const type &s) { d *= s; });
+        return *this;
+    }
+    template <typename E>
+    MatView &operator/=(const MatExpr<E> &expr)
+    {
+        if (!MatShapesMatch(*this, expr.Self()))
+            throw std::invalid_argument("operator/=: parameter must match the dimensions of this");
+        Apply<1>(expr.Self(), [](type &d, const type &s) { d /= s; });
+        return *this;
+    }
+    MatView &operator/=(copy_fast_t<type> value)
+    {
+        ApplyScalar(value, [](type &d, const type &s) { d /= s; });
+        return *this;
+    }
+
+    SizeT SizeX() const noexcept { return sizeX; }
+    SizeT SizeY() const noexcept { return sizeY; }
+    size_t Stride() const noexcept { return stride; }
+    bool IsTransposed() const noexcept { return transposed; }
+    Type *data() const noexcept { return ptr; }
+
+    //element steps between neighbouring rows and columns, the layout Gemm takes
+    size_t RowStride() const noexcept { return transposed ? 1 : stride; }
+    size_t ColStride() const noexcept { return transposed ? stride : 1; }
+
+    Type &At(SizeT x, SizeT y) const
+    {
+        MAT_BOUNDS((x < sizeX) && (y < sizeY), MatOutOfRange("At", x, y));
+        return ptr[Offset(x, y)];
+    }
+
+    ALWAYS_INLINE type Eval(size_t x, size_t y) const noexcept { return ptr[Offset(x, y)]; }
+    ALWAYS_INLINE type Eval(size_t index) const noexcept { return Eval(index % sizeX, index / sizeX); }
+
+    MatView Block(SizeT x, SizeT y, SizeT w, SizeT h) const
+    {
+        if ((x + w > sizeX) || (y + h > sizeY))
+            throw std::out_of_range("Block: out of range");
+        return MatView(ptr + Offset(x, y), w, h, stride, transposed);
+    }
+    MatView Col(SizeT x) const { return Block(x, 0, 1, sizeY); }
+    MatView TransposedView() const noexcept { return MatView(ptr, sizeY, sizeX, stride, !transposed); }
+
+    //rows are only contiguous while the view is not transposed
+    std::span<Type> Row(SizeT y) const
+    {
+        if (transposed)
+            throw std::logic_error("Row: rows of a transposed view are not contiguous, use Col");
+        MAT_BOUNDS(y < sizeY, MatOutOfRange("Row", y));
+        return std::span<Type>(ptr + y * stride, sizeX);
+    }
+    MatRowRange<Type> Rows() const
+    {
+        if (transposed)
+            throw std::logic_error("Rows: rows of a transposed view are not contiguous");
+        return {MatRowIterator<Type>(ptr, sizeX, stride), MatRowIterator<Type>(ptr + sizeY * stride, sizeX, stride)};
+    }
+    //every element in row major order whatever the layout, empty views begin at their end
+    MatElementIterator<Type> begin() const noexcept { return MatElementIterator<Type>(ptr, sizeX, sizeX ? 0 : sizeY, RowStride(), ColStride()); }
+    MatElementIterator<Type> end() const noexcept { return MatElementIterator<Type>(ptr, sizeX, sizeY, RowStride(), ColStride()); }
+
+    Mat<type, SizeT> Dot(MatView<const type, SizeT>) const;
+
+    friend std::ostream &operator<<(std::ostream &os, const MatView &mat)
+    {
+        for (SizeT i = 0; i < mat.SizeY(); ++i)
+        {
+            for (SizeT j = 0; j < mat.SizeX(); ++j)
+            {
+                os << mat.Eval(j, i) << ' ';
+            }
+            os << '\n';
+        }
+        return os;
+    }
+};
+
+//Dot with the same two shape branches as Mat::Dot, on strided or transposed operands
+template <typename Type, SizeType SizeT, typename Alloc = AlignedAllocator<Type, 64>>
+inline Mat<Type, SizeT, Alloc> Dot(MatView<const Type, SizeT> a, MatView<const Type, SizeT> b);
+//Dot written to res, whose storage is reused when its area matches the product, res must not overlap a or b
+template <typename Type, SizeType SizeT, typename Alloc>
+inline void DotInto(MatView<const Type, SizeT> a, MatView<const Type, SizeT> b, Mat<Type, SizeT, Alloc> &res);
+
+//tag for constructing a Mat whose elements are left uninitialized, for results that are about to be overwritten
+struct MatUninit
+{
+};
+inline constexpr MatUninit mat_uninit{};
+
+//pulls the ',' or ')' terminated tokens of the Mat text format out of a stream one chunk at a time
+class MatTextReader
+{
+private:
+    static constexpr size_t chunk = size_t(1) << 16;
+    std::istream *is = nullptr;
+    std::unique_ptr<char[]> buf;
+    const char *cur = nullptr, *last = nullptr;
+
+    //keeps the unconsumed tail and appends the next chunk after it
+    bool Refill()
+    {
+        if (!is)
+        {
+            return false;
+        }
+        const size_t rem = size_t(last - cur);
+        if (rem == chunk)
+            throw std::invalid_argument("Load: token longer than the read chunk");
+        std::memmove(buf.get(), cur, rem);
+        is->read(buf.get() + rem, std::streamsize(chunk - rem));
+        const size_t got = size_t(is->gcount());
+        cur = buf.get();
+        last = cur + rem + got;
+        return got;
+    }
+
+public:
+    explicit MatTextReader(std::istream &in) : is(&in), buf(new char[chunk]), cur(buf.get()), last(buf.get()) {}
+    explicit MatTextReader(std::string_view text) noexcept : cur(text.data()), last(text.data() + text.size()) {}
+
+    //consumes leading whitespace and the opening '('
+    void Open()
+    {
+        do
+        {
+            while (cur != last && std::isspace(static_cast<unsigned char>(*cur)))
+            {
+                ++cur;
+            }
+        } while (cur == last && Refill());
+        if (cur == last || *cur != '(')
+            throw std::invalid_argument("Load: expected '('");
+        ++cur;
+    }
+
+    //next token with surrounding whitespace trimmed, delim receives the ',' or ')' that ended it
+    std::string_view Next(char &delim)
+    {
+        while (true)
+        {
+            for (const char *p = cur; p != last; ++p)
+            {
+                if (*p == ',' || *p == ')')
+                {
+                    const char *first = cur, *end = p;
+                    delim = *p;
+                    cur = p + 1;
+                    while (first != end && std::isspace(static_cast<unsigned char>(*first)))
+                        ++first;
+                    while (end != first && std::isspace(static_cast<unsigned char>(end[-1])))
+                        --end;
+                    return std::string_view(first, size_t(end - first));
+                }
+            }
+            if (!Refill())
+                throw std::invalid_argument("Load: unexpected end of input");
+        }
+    }
+
+    template <typename T>
+    T NextNumber(char &delim)
+    {
+        const std::string_view tok = Next(delim);
+        T value{};
+        const auto [ptr, ec] = std::from_chars(tok.data(), tok.data() + tok.size(), value);
+        if (ec != std::errc() || ptr != tok.data() + tok.size() || tok.empty())
+            throw std::invalid_argument("Load: bad number '" + std::string(tok) + '\'');
+        return value;
+    }
+};
+
+template <typename Type, SizeType SizeT, typename Alloc>
+class Mat : public MatExpr<Mat<Type, SizeT, Alloc>>
 {
 private:
     Type *members = nullptr;
-    SizeT sizeY, sizeX;
+    SizeT sizeY = 0, sizeX = 0;
+    [[no_unique_address]] Alloc alloc;
+
+    using alloc_traits = std::allocator_traits<Alloc>;
+
+    template <typename Sink>
+    void SaveChunks(Sink &&) const;
+    static Mat LoadFrom(class MatTextReader &);
+
+    Type *Allocate(size_t);
+    Type *AllocateCopy(const Type *, size_t);
+    void Release() noexcept;
 
 public:
     using type = Type;
     using storage_type = SizeT;
+    using allocator_type = Alloc;
+    static constexpr bool contiguous = true;
 
     Mat() = default;
     explicit Mat(SizeT, SizeT);
+    explicit Mat(SizeT, SizeT, MatUninit);
 
     template <typename... Params>
-    explicit Mat(SizeT w, SizeT h, Params &&...membs) : sizeX(w), sizeY(h)
+    explicit Mat(SizeT w, SizeT h, Params &&...membs) : sizeY(h), sizeX(w)
     {
         if (sizeof...(membs) > (w * h))
         {
             throw std::invalid_argument("dimensions of matrix must match number of values");
         }
-        members = new Type[w * h]{membs...};
+        members = Allocate(w * h);
+        Type init[] = {static_cast<Type>(membs)...};
+        std::copy(std::begin(init), std::end(init), members);
+        std::fill(members + sizeof...(membs), members + w * h, Type());
     }
 
     Mat(const Mat &);
     Mat(Mat &&) noexcept;
-    Mat operator=(const Mat &);
-    Mat operator=(Mat &&) noexcept;
+    Mat &operator=(const Mat &);
+    Mat &operator=(Mat &&) noexcept;
+
+    //evaluates a whole elementwise expression in one pass, without temporaries
+    template <typename E>
+    Mat(const MatExpr<E> &);
+    template <typename E>
+    Mat &operator=(const MatExpr<E> &);
 
     Type &At(SizeT, SizeT);
     Type *AtP(SizeT, SizeT);
@@ -56,34 +589,53 @@ public:
     SizeT SizeX() const noexcept;
     SizeT SizeY() const noexcept;
 
+    //same dimensions and elements, consistent with std::hash<Mat>
+    bool operator==(const Mat &) const noexcept;
+
     Mat Dot(const Mat &) const;
+    Mat Dot(MatView<const Type, SizeT>) const;
+    Mat Dot(MatView<Type, SizeT> mat) const { return Dot(MatView<const Type, SizeT>(mat)); } //exact match, a mutable view also converts to Mat through the expression constructor
     void Flatten();
+    void Reshape(SizeT, SizeT);
 
-    Mat operator+(const Mat &) const;
-    Mat operator+(copy_fast_t<Type>) const noexcept;
-    Mat operator+=(const Mat &);
-    Mat operator+=(copy_fast_t<Type>) noexcept;
-
-    Mat operator-(const Mat &) const;
-    Mat operator-(copy_fast_t<Type>) const noexcept;
-    Mat operator-=(const Mat &);
-    Mat operator-=(copy_fast_t<Type>) noexcept;
+    //views over this storage, valid until it is reallocated
+    MatView<Type, SizeT> View() noexcept { return MatView<Type, SizeT>(members, sizeX, sizeY, sizeX); }
+    MatView<const Type, SizeT> View() const noexcept { return MatView<const Type, SizeT>(members, sizeX, sizeY, sizeX); }
+    operator MatView<Type, SizeT>() noexcept { return View(); }
+    operator MatView<const Type, SizeT>() const noexcept { return View(); }
+    MatView<Type, SizeT> Block(SizeT x, SizeT y, SizeT w, SizeT h) { return View().Block(x, y, w, h); }
+    MatView<const Type, SizeT> Block(SizeT x, SizeT y, SizeT w, SizeT h) const { return View().Block(x, y, w, h); }
+    MatView<Type, SizeT> Col(SizeT x) { return View().Col(x); }
+    MatView<const Type, SizeT> Col(SizeT x) const { return View().Col(x); }
+    MatView<Type, SizeT> TransposedView() noexcept { return View().TransposedView(); }
+    MatView<const Type, SizeT> TransposedView() const noexcept { return View().TransposedView(); }
+    std::span<Type> Row(SizeT y) { return View().Row(y); }
+    std::span<const Type> Row(SizeT y) const { return View().Row(y); }
+    MatRowRange<Type> Rows() noexcept { return View().Rows(); }
+    MatRowRange<const Type> Rows() const noexcept { return View().Rows(); }
 
-    Mat operator*(const Mat &) const;
-    Mat operator*(copy_fast_t<Type>) const noexcept;
-    Mat operator*=(const Mat &);
-    Mat operator*=(copy_fast_t<Type>) noexcept;
+    template <typename E>
+    Mat &operator+=(const MatExpr<E> &);
+    Mat &operator+=(copy_fast_t<Type>);
+    template <typename E>
+    Mat &operator-=(const MatExpr<E> &);
+    Mat &operator-=(copy_fast_t<Type>);
+    template <typename E>
+    Mat &operator*=(const MatExpr<E> &);
+    Mat &operator*=(copy_fast_t<Type>);
+    template <typename E>
+    Mat &operator/=(const MatExpr<E> &);
+    Mat &operator/=(copy_fast_t<Type>);
 
-    Mat operator/(const Mat &) const;
-    Mat operator/(copy_fast_t<Type>) const noexcept;
-    Mat operator/=(const Mat &);
-    Mat operator/=(copy_fast_t<Type>) noexcept;
+    ALWAYS_INLINE Type Eval(size_t index) const noexcept { return members[index]; }
+    ALWAYS_INLINE Type Eval(size_t x, size_t y) const noexcept { return members[y * sizeX + x]; }
 
     Type *begin() noexcept { return &members[0]; }
     Type *end() noexcept { return &members[sizeX * sizeY]; }
     const Type *begin() const noexcept { return &members[0]; }
     const Type *end() const noexcept { return &members[sizeX * sizeY]; }
     Type *data() noexcept { return members; } //dangerous
+    const Type *data() const noexcept { return members; }
 
     friend std::ostream &operator<<(std::ostream &os, const Mat &mat) noexcept
     {
@@ -98,382 +650,633 @@ public:
         return os;
     }
 
-    std::string Save() const noexcept
-    {
-        using namespace std;
-        std::string res('(' + std::to_string(sizeX) + ',' + std::to_string(sizeY) + ',');
-        for (copy_fast_t<Type> i : *this)
-        {
-            res += to_string(i) + ',';
-        }
-        res.back() = ')';
-        return res;
-    }
+    //(w,h,v0,v1,...) text format, shortest round trip and locale independent, written in fixed size chunks
+    std::string Save() const;
+    void Save(std::ostream &) const;
+    static Mat Load(std::istream &);
+    static Mat Load(std::string_view);
 
     ~Mat() noexcept;
 };
 
-template <typename Type, SizeType SizeT>
-inline Mat<Type, SizeT>::Mat(SizeT w, SizeT h) : sizeX(w), sizeY(h)
+template <typename Type, SizeType SizeT, typename Alloc>
+inline Type *Mat<Type, SizeT, Alloc>::Allocate(size_t n)
 {
-    members = new Type[w * h]{};
+    if (!n)
+    {
+        return nullptr;
+    }
+    Type *p = alloc_traits::allocate(alloc, n);
+    MAT_STATS_ALLOC(n * sizeof(Type));
+    if constexpr (!std::is_trivially_default_constructible_v<Type>)
+    {
+        try
+        {
+            std::uninitialized_default_construct_n(p, n);
+        }
+        catch (...)
+        {
+            alloc_traits::deallocate(alloc, p, n);
+            throw;
+        }
+    }
+    return p;
 }
 
-template <typename Type, SizeType SizeT>
-inline Mat<Type, SizeT>::Mat(const Mat<Type, SizeT> &mat)
+template <typename Type, SizeType SizeT, typename Alloc>
+inline Type *Mat<Type, SizeT, Alloc>::AllocateCopy(const Type *src, size_t n)
 {
-    sizeX = mat.sizeX;
-    sizeY = mat.sizeY;
-    if (sizeX * sizeY)
+    Type *p = Allocate(n);
+    if constexpr (std::is_trivially_copyable_v<Type>)
     {
-        members = new Type[sizeX * sizeY]{Type()};
+        if (n)
+        {
+            std::memcpy(p, src, n * sizeof(Type));
+        }
     }
-    for (size_t i = 0; i < mat.sizeX * sizeY; ++i)
+    else
     {
-        FastAt(i) = mat.FastAt(i);
+        std::copy(src, src + n, p);
     }
+    return p;
 }
 
-template <typename Type, SizeType SizeT>
-inline Mat<Type, SizeT>::Mat(Mat<Type, SizeT> &&mat) noexcept
+template <typename Type, SizeType SizeT, typename Alloc>
+inline void Mat<Type, SizeT, Alloc>::Release() noexcept
 {
-    sizeX = mat.sizeX;
-    sizeY = mat.sizeY;
-    members = mat.members;
+    if (members)
+    {
+        if constexpr (!std::is_trivially_destructible_v<Type>)
+        {
+            std::destroy_n(members, sizeX * sizeY);
+        }
+        alloc_traits::deallocate(alloc, members, sizeX * sizeY);
+        MAT_STATS_FREE();
+        members = nullptr;
+    }
+}
+
+template <typename Type, SizeType SizeT, typename Alloc>
+inline Mat<Type, SizeT, Alloc>::Mat(SizeT w, SizeT h) : sizeY(h), sizeX(w)
+{
+    members = Allocate(w * h);
+    std::fill_n(members, w * h, Type());
+}
+
+template <typename Type, SizeType SizeT, typename Alloc>
+inline Mat<Type, SizeT, Alloc>::Mat(SizeT w, SizeT h, MatUninit) : sizeY(h), sizeX(w)
+{
+    members = Allocate(w * h);
+}
+
+template <typename Type, SizeType SizeT, typename Alloc>
+inline Mat<Type, SizeT, Alloc>::Mat(const Mat<Type, SizeT, Alloc> &mat) : sizeY(mat.sizeY), sizeX(mat.sizeX), alloc(alloc_traits::select_on_container_copy_construction(mat.alloc))
+{
+    MAT_STATS_COPY(size_t(sizeX) * sizeY * sizeof(Type));
+    members = AllocateCopy(mat.members, sizeX * sizeY);
+}
+
+template <typename Type, SizeType SizeT, typename Alloc>
+inline Mat<Type, SizeT, Alloc>::Mat(Mat<Type, SizeT, Alloc> &&mat) noexcept : members(mat.members), sizeY(mat.sizeY), sizeX(mat.sizeX), alloc(std::move(mat.alloc))
+{
+    MAT_STATS_MOVE();
     mat.members = nullptr;
     mat.sizeX = mat.sizeY = 0;
 }
 
-template <typename Type, SizeType SizeT>
-inline Mat<Type, SizeT> Mat<Type, SizeT>::operator=(const Mat<Type, SizeT> &mat)
+template <typename Type, SizeType SizeT, typename Alloc>
+inline Mat<Type, SizeT, Alloc> &Mat<Type, SizeT, Alloc>::operator=(const Mat<Type, SizeT, Alloc> &mat)
 {
-    sizeX = mat.sizeX;
-    sizeY = mat.sizeY;
-    if (members)
+    if (this == &mat)
     {
-        delete[] members;
-        members = nullptr;
+        return *this;
     }
-    if (sizeX * sizeY)
+    MAT_STATS_COPY(size_t(mat.sizeX) * mat.sizeY * sizeof(Type));
+    //the copy is made before the old storage is released, so a failed allocation leaves *this as it was
+    Type *copy;
+    if constexpr (alloc_traits::propagate_on_container_copy_assignment::value)
     {
-        members = new Type[sizeX * sizeY]{Type()};
+        Alloc old = std::exchange(alloc, mat.alloc);
+        try
+        {
+            copy = AllocateCopy(mat.members, mat.sizeX * mat.sizeY);
+        }
+        catch (...)
+        {
+            alloc = std::move(old);
+            throw;
+        }
+        std::swap(alloc, old);
+        Release();
+        alloc = std::move(old);
     }
-    for (size_t i = 0; i < sizeX * sizeY; ++i)
+    else
     {
-        FastAt(i) = mat.FastAt(i);
+        copy = AllocateCopy(mat.members, mat.sizeX * mat.sizeY);
+        Release();
     }
+    members = copy;
+    sizeX = mat.sizeX;
+    sizeY = mat.sizeY;
     return *this;
 }
 
-template <typename Type, SizeType SizeT>
-inline Mat<Type, SizeT> Mat<Type, SizeT>::operator=(Mat<Type, SizeT> &&mat) noexcept
+template <typename Type, SizeType SizeT, typename Alloc>
+inline Mat<Type, SizeT, Alloc> &Mat<Type, SizeT, Alloc>::operator=(Mat<Type, SizeT, Alloc> &&mat) noexcept
 {
-    sizeX = mat.sizeX;
-    sizeY = mat.sizeY;
-    if (members)
+    if (this == &mat)
     {
-        delete[] members;
+        return *this;
     }
+    Release();
+    if constexpr (alloc_traits::propagate_on_container_move_assignment::value)
+    {
+        alloc = std::move(mat.alloc);
+    }
+    else if (!(alloc == mat.alloc))
+    {
+        //storage from an unequal allocator can't change hands, copy it instead
+        MAT_STATS_COPY(size_t(mat.sizeX) * mat.sizeY * sizeof(Type));
+        members = AllocateCopy(mat.members, mat.sizeX * mat.sizeY);
+        sizeX = mat.sizeX;
+        sizeY = mat.sizeY;
+        return *this;
+    }
+    MAT_STATS_MOVE();
     members = mat.members;
+    sizeX = mat.sizeX;
+    sizeY = mat.sizeY;
     mat.members = nullptr;
     mat.sizeX = mat.sizeY = 0;
     return *this;
 }
 
-template <typename Type, SizeType SizeT>
-inline Type &Mat<Type, SizeT>::At(SizeT x, SizeT y) //indexing matrix
+template <typename Type, SizeType SizeT, typename Alloc>
+template <typename E>
+inline Mat<Type, SizeT, Alloc>::Mat(const MatExpr<E> &expr) : sizeY(expr.Self().SizeY()), sizeX(expr.Self().SizeX())
+{
+    const E &e = expr.Self();
+    members = Allocate(sizeX * sizeY); //every element is written below
+    MatEvalInto<0>(members, sizeX, sizeY, sizeX, e, [](Type &d, const Type &v) { d = v; });
+}
+
+template <typename Type, SizeType SizeT, typename Alloc>
+template <typename E>
+inline Mat<Type, SizeT, Alloc> &Mat<Type, SizeT, Alloc>::operator=(const MatExpr<E> &expr)
 {
-    if ((x >= sizeX) || (y >= sizeY))
-        throw std::out_of_range("At: out of range, " + std::to_string(x) + ' ' + std::to_string(y));
+    const E &e = expr.Self();
+    const size_t n = size_t(e.SizeX()) * e.SizeY();
+    //the buffer is reused when the area matches and nothing in e reads it out of order, *this itself is read element for element,
+    //otherwise e is evaluated into fresh storage and the old buffer released after, so views of *this stay valid throughout
+    if (n == size_t(sizeX) * sizeY && !MatExprAliases(e, members, members + n, e.SizeX()))
+    {
+        sizeX = e.SizeX();
+        sizeY = e.SizeY();
+        MatEvalInto<0>(members, sizeX, sizeY, sizeX, e, [](Type &d, const Type &v) { d = v; });
+        return *this;
+    }
+    Type *fresh = Allocate(n);
+    try
+    {
+        MatEvalInto<0>(fresh, e.SizeX(), e.SizeY(), e.SizeX(), e, [](Type &d, const Type &v) { d = v; });
+    }
+    catch (...)
+    {
+        if constexpr (!std::is_trivially_destructible_v<Type>)
+        {
+            std::destroy_n(fresh, n);
+        }
+        alloc_traits::deallocate(alloc, fresh, n);
+        MAT_STATS_FREE();
+        throw;
+    }
+    Release();
+    members = fresh;
+    sizeX = e.SizeX();
+    sizeY = e.SizeY();
+    return *this;
+}
+
+template <typename Type, SizeType SizeT, typename Alloc>
+inline Type &Mat<Type, SizeT, Alloc>::At(SizeT x, SizeT y) //indexing matrix
+{
+    MAT_BOUNDS((x < sizeX) && (y < sizeY), MatOutOfRange("At", x, y));
     return members[(y * sizeX) + x];
 }
 
-template <typename Type, SizeType SizeT>
-inline Type *Mat<Type, SizeT>::AtP(SizeT x, SizeT y)
+template <typename Type, SizeType SizeT, typename Alloc>
+inline Type *Mat<Type, SizeT, Alloc>::AtP(SizeT x, SizeT y)
 {
-    if ((x >= sizeX) || (y >= sizeY))
-        throw std::out_of_range("At: out of range, " + std::to_string(x) + ' ' + std::to_string(y));
+    MAT_BOUNDS((x < sizeX) && (y < sizeY), MatOutOfRange("At", x, y));
     return &members[(y * sizeX) + x];
 }
 
-template <typename Type, SizeType SizeT>
-inline Type Mat<Type, SizeT>::At(SizeT x, SizeT y) const //indexing matrix
+template <typename Type, SizeType SizeT, typename Alloc>
+inline Type Mat<Type, SizeT, Alloc>::At(SizeT x, SizeT y) const //indexing matrix
 {
-    if ((x >= sizeX) || (y >= sizeY))
-        throw std::out_of_range("At: out of range, " + std::to_string(x) + ' ' + std::to_string(y));
+    MAT_BOUNDS((x < sizeX) && (y < sizeY), MatOutOfRange("At", x, y));
     return members[(y * sizeX) + x];
 }
 
-template <typename Type, SizeType SizeT>
-inline Type &Mat<Type, SizeT>::FastAt(size_t index)
+template <typename Type, SizeType SizeT, typename Alloc>
+inline Type &Mat<Type, SizeT, Alloc>::FastAt(size_t index)
 {
-    if (index >= sizeX * sizeY)
-        throw std::out_of_range("FastAt: index out of range");
+    MAT_BOUNDS(index < size_t(sizeX) * sizeY, MatOutOfRange("FastAt", index));
     return members[index];
 }
 
-template <typename Type, SizeType SizeT>
-inline Type Mat<Type, SizeT>::FastAt(size_t index) const
+template <typename Type, SizeType SizeT, typename Alloc>
+inline Type Mat<Type, SizeT, Alloc>::FastAt(size_t index) const
 {
-    if (index >= sizeX * sizeY)
-        throw std::out_of_range("FastAt: index out of range");
+    MAT_BOUNDS(index < size_t(sizeX) * sizeY, MatOutOfRange("FastAt", index));
     return members[index];
 }
 
-template <typename Type, SizeType SizeT>
-inline Type *Mat<Type, SizeT>::FastAtP(size_t index)
+template <typename Type, SizeType SizeT, typename Alloc>
+inline Type *Mat<Type, SizeT, Alloc>::FastAtP(size_t index)
 {
-    if (index >= sizeX * sizeY)
-        throw std::out_of_range("FastAt: index out of range");
+    MAT_BOUNDS(index < size_t(sizeX) * sizeY, MatOutOfRange("FastAt", index));
     return &members[index];
 }
 
-template <typename Type, SizeType SizeT>
-inline SizeT Mat<Type, SizeT>::SizeX() const noexcept { return sizeX; }
+template <typename Type, SizeType SizeT, typename Alloc>
+inline SizeT Mat<Type, SizeT, Alloc>::SizeX() const noexcept { return sizeX; }
 
-template <typename Type, SizeType SizeT>
-inline SizeT Mat<Type, SizeT>::SizeY() const noexcept { return sizeY; }
+template <typename Type, SizeType SizeT, typename Alloc>
+inline SizeT Mat<Type, SizeT, Alloc>::SizeY() const noexcept { return sizeY; }
 
-template <typename Type, SizeType SizeT>
-inline Mat<Type, SizeT> Mat<Type, SizeT>::Dot(const Mat<Type, SizeT> &mat) const
+template <typename Type, SizeType SizeT, typename Alloc>
+inline bool Mat<Type, SizeT, Alloc>::operator==(const Mat<Type, SizeT, Alloc> &mat) const noexcept
+{
+    return sizeX == mat.sizeX && sizeY == mat.sizeY && std::equal(members, members + size_t(sizeX) * sizeY, mat.members);
+}
+
+template <typename Type, SizeType SizeT, typename Alloc>
+inline Mat<Type, SizeT, Alloc> Mat<Type, SizeT, Alloc>::Dot(const Mat<Type, SizeT, Alloc> &mat) const
+{
+    return ::Dot<Type, SizeT, Alloc>(View(), mat.View());
+}
+
+template <typename Type, SizeType SizeT, typename Alloc>
+inline Mat<Type, SizeT, Alloc> Mat<Type, SizeT, Alloc>::Dot(MatView<const Type, SizeT> mat) const
+{
+    return ::Dot<Type, SizeT, Alloc>(View(), mat);
+}
+
+template <typename Type, SizeType SizeT, typename Alloc>
+inline Mat<Type, SizeT, Alloc> Dot(MatView<const Type, SizeT> a, MatView<const Type, SizeT> b)
+{
+    Mat<Type, SizeT, Alloc> res;
+    DotInto(a, b, res);
+    return res;
+}
+
+template <typename Type, SizeType SizeT, typename Alloc>
+inline void DotInto(MatView<const Type, SizeT> a, MatView<const Type, SizeT> b, Mat<Type, SizeT, Alloc> &res)
 {
-    if (!((sizeX == mat.sizeY) || (sizeY == mat.sizeX)))
+    if (!((a.SizeX() == b.SizeY()) || (a.SizeY() == b.SizeX())))
     {
         throw std::invalid_argument("Dot: dimensions invalid");
     }
-    if (sizeX == mat.sizeY)
+    MAT_STATS_SCOPE(MatOp::Dot, 2 * uint64_t(a.SizeX()) * a.SizeY() * (a.SizeX() == b.SizeY() ? b.SizeX() : b.SizeY()));
+    //product dimensions are the x of both mats, or the y of both when B * A is taken instead
+    const bool ab = a.SizeX() == b.SizeY();
+    const SizeT w = ab ? b.SizeX() : a.SizeX(), h = ab ? a.SizeY() : b.SizeY();
+    if (size_t(res.SizeX()) * res.SizeY() == size_t(w) * h)
     {
-        //std::cout << "Beep\n";
-        Mat res(mat.sizeX, sizeY);        //product dimensions are the x of both mats
-        for (SizeT i = 0; i < sizeY; ++i) //for each y on the A matrix
-        {
-            for (SizeT j = 0; j < mat.sizeX; ++j) //for each x on the B matrix
-            {
-                for (int k = 0; k < sizeX; ++k) //is equivelant to mat.sizeY()
-                {
-                    res.At(j, i) += At(k, i) * mat.At(j, k);
-                }
-            }
-        }
-        return res;
+        res.Reshape(w, h);
     }
     else
     {
-        //std::cout << "Boop\n";
-        Mat res(sizeX, mat.sizeY);
-        for (SizeT i = 0; i < mat.sizeY; ++i)
-        {
-            for (SizeT j = 0; j < sizeX; ++j)
-            {
-                for (int k = 0; k < mat.sizeX; ++k)
-                {
-                    res.At(j, i) += At(j, k) * mat.At(k, i);
-                }
-            }
-        }
-        return res;
+        res = Mat<Type, SizeT, Alloc>(w, h, mat_uninit);
+    }
+    std::fill_n(res.data(), size_t(w) * h, Type());
+    if (ab)
+    {
+        ParallelGemm<Type>(a.SizeY(), b.SizeX(), a.SizeX(), Type(1), a.data(), a.RowStride(), a.ColStride(), b.data(), b.RowStride(), b.ColStride(), res.data(), res.SizeX(), 1);
+    }
+    else
+    {
+        //res(j, i) = sum A(j, k) * B(k, i), which is B * A in row major
+        ParallelGemm<Type>(b.SizeY(), a.SizeX(), b.SizeX(), Type(1), b.data(), b.RowStride(), b.ColStride(), a.data(), a.RowStride(), a.ColStride(), res.data(), res.SizeX(), 1);
     }
 }
 
-template <typename Type, SizeType SizeT>
-inline void Mat<Type, SizeT>::Flatten()
+//a times every row of xs, row v of the result is a * xs.Row(v) (a.SizeX() == xs.SizeX()), one a.SizeY() wide row per vector
+//Y = X * A^T, batches up to GemmBlocking::thin vectors stream a from memory once, larger ones go through the packed engine
+template <typename Type, SizeType SizeT, typename Alloc = AlignedAllocator<Type, 64>>
+inline Mat<Type, SizeT, Alloc> MatVecBatch(MatView<const Type, SizeT> a, MatView<const Type, SizeT> xs)
 {
-    sizeY *= sizeX;
-    sizeX = 0;
+    if (a.SizeX() != xs.SizeX())
+        throw std::invalid_argument("MatVecBatch: vectors must be as long as a is wide");
+    MAT_STATS_SCOPE(MatOp::Dot, 2 * uint64_t(a.SizeX()) * a.SizeY() * xs.SizeY());
+    Mat<Type, SizeT, Alloc> res(a.SizeY(), xs.SizeY());
+    ParallelGemm<Type>(xs.SizeY(), a.SizeY(), a.SizeX(), Type(1), xs.data(), xs.RowStride(), xs.ColStride(), a.data(), a.ColStride(), a.RowStride(), res.data(), res.SizeX(), 1);
+    return res;
 }
 
 template <typename Type, SizeType SizeT>
-inline Mat<Type, SizeT> Mat<Type, SizeT>::operator+(const Mat<Type, SizeT> &mat) const
+inline Mat<std::remove_const_t<Type>, SizeT> MatView<Type, SizeT>::Dot(MatView<const type, SizeT> mat) const
 {
-    if ((sizeX * sizeY) != (mat.sizeX * mat.sizeY))
-        throw std::invalid_argument("operator+: parameter must match the dimensions of this");
-    Mat res(sizeX, sizeY);
-    for (size_t i = 0; i < sizeX * sizeY; ++i)
-    {
-        res.members[i] = this->members[i] + mat.members[i];
-    }
-    return res;
+    return ::Dot<type, SizeT>(*this, mat);
 }
 
-template <typename Type, SizeType SizeT>
-inline Mat<Type, SizeT> Mat<Type, SizeT>::operator+(copy_fast_t<Type> value) const noexcept
+template <typename Type, SizeType SizeT, typename Alloc>
+inline void Mat<Type, SizeT, Alloc>::Flatten()
 {
-    Mat res(sizeX, sizeY);
-    for (size_t i = 0; i < sizeX * sizeY; ++i)
-    {
-        res.members[i] = this->members[i] + value;
-    }
-    return res;
+    sizeY *= sizeX;
+    sizeX = 1;
 }
 
-template <typename Type, SizeType SizeT>
-inline Mat<Type, SizeT> Mat<Type, SizeT>::operator+=(const Mat<Type, SizeT> &mat)
+//reinterprets the same row major elements as w x h, the area must not change
+template <typename Type, SizeType SizeT, typename Alloc>
+inline void Mat<Type, SizeT, Alloc>::Reshape(SizeT w, SizeT h)
 {
-    if ((sizeX * sizeY) != (mat.sizeX * mat.sizeY))
-        throw std::invalid_argument("operator+=: parameter must match the dimensions of this");
-    for (size_t i = 0; i < sizeX * sizeY; ++i)
-    {
-        this->members[i] += mat.members[i];
-    }
+    if (size_t(w) * h != size_t(sizeX) * sizeY)
+        throw std::invalid_argument("Reshape: area must match the dimensions of this");
+    sizeX = w;
+    sizeY = h;
 }
 
-template <typename Type, SizeType SizeT>
-inline Mat<Type, SizeT> Mat<Type, SizeT>::operator+=(copy_fast_t<Type> value) noexcept
+template <typename Type, SizeType SizeT, typename Alloc>
+template <typename E>
+inline Mat<Type, SizeT, Alloc> &Mat<Type, SizeT, Alloc>::operator+=(const MatExpr<E> &expr)
 {
-    for (size_t i = 0; i < sizeX * sizeY; ++i)
-    {
-        this->members[i] += value;
-    }
+    const E &e = expr.Self();
+    if (!MatShapesMatch(*this, e))
+        throw std::invalid_argument("operator+=: parameter must match the dimensions of this");
+    MatEvalInto<1>(members, sizeX, sizeY, sizeX, e, [](Type &d, const Type &v) { d += v; });
     return *this;
 }
 
-template <typename Type, SizeType SizeT>
-inline Mat<Type, SizeT> Mat<Type, SizeT>::operator-(const Mat<Type, SizeT> &mat) const
+template <typename Type, SizeType SizeT, typename Alloc>
+inline Mat<Type, SizeT, Alloc> &Mat<Type, SizeT, Alloc>::operator+=(copy_fast_t<Type> value)
 {
-    if ((sizeX * sizeY) != (mat.sizeX * mat.sizeY))
-        throw std::invalid_argument("operator-: parameter must match the dimensions of this");
-    Mat res(sizeX, sizeY);
-    for (size_t i = 0; i < sizeX * sizeY; ++i)
-    {
-        res.members[i] = this->members[i] - mat.members[i];
-    }
-    return res;
+    MAT_STATS_SCOPE(MatOp::Scalar, uint64_t(sizeX) * sizeY);
+    Type *dst = members;
+    MatParallelRange(sizeX * sizeY, [dst, value](size_t first, size_t last)
+                     {
+                         for (size_t i = first; i < last; ++i)
+                         {
+                             dst[i] += value;
+                         }
+                     });
+    return *this;
 }
 
-template <typename Type, SizeType SizeT>
-inline Mat<Type, SizeT> Mat<Type, SizeT>::operator-(copy_fast_t<Type> value) const noexcept
+template <typename Type, SizeType SizeT, typename Alloc>
+template <typename E>
+inline Mat<Type, SizeT, Alloc> &Mat<Type, SizeT, Alloc>::operator-=(const MatExpr<E> &expr)
 {
-    Mat res(sizeX, sizeY);
-    for (size_t i = 0; i < sizeX * sizeY; ++i)
-    {
-        res.members[i] = this->members[i] - value;
-    }
-    return res;
+    const E &e = expr.Self();
+    if (!MatShapesMatch(*this, e))
+        throw std::invalid_argument("operator-=: parameter must match the dimensions of this");
+    MatEvalInto<1>(members, sizeX, sizeY, sizeX, e, [](Type &d, const Type &v) { d -= v; });
+    return *this;
 }
 
-template <typename Type, SizeType SizeT>
-inline Mat<Type, SizeT> Mat<Type, SizeT>::operator-=(const Mat<Type, SizeT> &mat)
+template <typename Type, SizeType SizeT, typename Alloc>
+inline Mat<Type, SizeT, Alloc> &Mat<Type, SizeT, Alloc>::operator-=(copy_fast_t<Type> value)
 {
-    if ((sizeX * sizeY) != (mat.sizeX * mat.sizeY))
-        throw std::invalid_argument("operator-=: parameter must match the dimensions of this");
-    for (size_t i = 0; i < sizeX * sizeY; ++i)
-    {
-        this->members[i] -= mat.members[i];
-    }
+    MAT_STATS_SCOPE(MatOp::Scalar, uint64_t(sizeX) * sizeY);
+    Type *dst = members;
+    MatParallelRange(sizeX * sizeY, [dst, value](size_t first, size_t last)
+                     {
+                         for (size_t i = first; i < last; ++i)
+                         {
+                             dst[i] -= value;
+                         }
+                     });
     return *this;
 }
 
-template <typename Type, SizeType SizeT>
-inline Mat<Type, SizeT> Mat<Type, SizeT>::operator-=(copy_fast_t<Type> value) noexcept
+template <typename Type, SizeType SizeT, typename Alloc>
+template <typename E>
+inline Mat<Type, SizeT, Alloc> &Mat<Type, SizeT, Alloc>::operator*=(const MatExpr<E> &expr)
 {
-    for (size_t i = 0; i < sizeX * sizeY; ++i)
-    {
-        this->members[i] -= value;
-    }
+    const E &e = expr.Self();
+    if (!MatShapesMatch(*this, e))
+        throw std::invalid_argument("operator*=: parameter must match the dimensions of this");
+    MatEvalInto<1>(members, sizeX, sizeY, sizeX, e, [](Type &d, const Type &v) { d *= v; });
     return *this;
 }
 
-template <typename Type, SizeType SizeT>
-inline Mat<Type, SizeT> Mat<Type, SizeT>::operator*(const Mat<Type, SizeT> &mat) const
+template <typename Type, SizeType SizeT, typename Alloc>
+inline Mat<Type, SizeT, Alloc> &Mat<Type, SizeT, Alloc>::operator*=(copy_fast_t<Type> value)
 {
-    if ((sizeX * sizeY) != (mat.sizeX * mat.sizeY))
-        throw std::invalid_argument("operator*: parameter must match the dimensions of this");
-    Mat res(sizeX, sizeY);
-    for (size_t i = 0; i < sizeX * sizeY; ++i)
-    {
-        res.members[i] = this->members[i] * mat.members[i];
-    }
-    return res;
+    MAT_STATS_SCOPE(MatOp::Scalar, uint64_t(sizeX) * sizeY);
+    Type *dst = members;
+    MatParallelRange(sizeX * sizeY, [dst, value](size_t first, size_t last)
+                     {
+                         for (size_t i = first; i < last; ++i)
+                         {
+                             dst[i] *= value;
+                         }
+                     });
+    return *this;
 }
 
-template <typename Type, SizeType SizeT>
-inline Mat<Type, SizeT> Mat<Type, SizeT>::operator*(copy_fast_t<Type> value) const noexcept
+template <typename Type, SizeType SizeT, typename Alloc>
+template <typename E>
+inline Mat<Type, SizeT, Alloc> &Mat<Type, SizeT, Alloc>::operator/=(const MatExpr<E> &expr)
 {
-    Mat res(sizeX, sizeY);
-    for (size_t i = 0; i < sizeX * sizeY; ++i)
-    {
-        res.members[i] = this->members[i] * value;
-    }
-    return res;
+    const E &e = expr.Self();
+    if (!MatShapesMatch(*this, e))
+        throw std::invalid_argument("operator/=: parameter must match the dimensions of this");
+    MatEvalInto<1>(members, sizeX, sizeY, sizeX, e, [](Type &d, const Type &v) { d /= v; });
+    return *this;
 }
 
-template <typename Type, SizeType SizeT>
-inline Mat<Type, SizeT> Mat<Type, SizeT>::operator*=(const Mat<Type, SizeT> &mat)
+template <typename Type, SizeType SizeT, typename Alloc>
+inline Mat<Type, SizeT, Alloc> &Mat<Type, SizeT, Alloc>::operator/=(copy_fast_t<Type> value)
 {
-    if ((sizeX * sizeY) != (mat.sizeX * mat.sizeY))
-        throw std::invalid_argument("operator*=: parameter must match the dimensions of this");
-    for (size_t i = 0; i < sizeX * sizeY; ++i)
-    {
-        this->members[i] *= mat.members[i];
-    }
+    MAT_STATS_SCOPE(MatOp::Scalar, uint64_t(sizeX) * sizeY);
+    Type *dst = members;
+    MatParallelRange(sizeX * sizeY, [dst, value](size_t first, size_t last)
+                     {
+                         for (size_t i = first; i < last; ++i)
+                         {
+                             dst[i] /= value;
+                         }
+                     });
     return *this;
 }
 
-template <typename Type, SizeType SizeT>
-inline Mat<Type, SizeT> Mat<Type, SizeT>::operator*=(copy_fast_t<Type> value) noexcept
+template <typename Type, SizeType SizeT, typename Alloc>
+template <typename Sink>
+inline void Mat<Type, SizeT, Alloc>::SaveChunks(Sink &&sink) const
 {
+    MAT_STATS_SCOPE(MatOp::Save, 0);
+    constexpr size_t chunk = 1 << 14, slack = 128; //slack covers the longest shortest round trip number plus a delimiter
+    char buf[chunk];
+    char *p = buf;
+    *p++ = '(';
+    p = std::to_chars(p, buf + chunk - 1, sizeX).ptr;
+    *p++ = ',';
+    p = std::to_chars(p, buf + chunk - 1, sizeY).ptr;
+    *p++ = ',';
     for (size_t i = 0; i < sizeX * sizeY; ++i)
     {
-        this->members[i] *= value;
+        if (size_t(buf + chunk - p) < slack)
+        {
+            sink(buf, size_t(p - buf));
+            p = buf;
+        }
+        p = std::to_chars(p, buf + chunk - 1, members[i]).ptr;
+        *p++ = ',';
     }
-    return *this;
+    p[-1] = ')';
+    sink(buf, size_t(p - buf));
 }
 
-template <typename Type, SizeType SizeT>
-inline Mat<Type, SizeT> Mat<Type, SizeT>::operator/(const Mat<Type, SizeT> &mat) const
+template <typename Type, SizeType SizeT, typename Alloc>
+inline std::string Mat<Type, SizeT, Alloc>::Save() const
 {
-    if ((sizeX * sizeY) != (mat.sizeX * mat.sizeY))
-        throw std::invalid_argument("operator/: parameter must match the dimensions of this");
-    Mat res(sizeX, sizeY);
-    for (size_t i = 0; i < sizeX * sizeY; ++i)
-    {
-        res.members[i] = this->members[i] / mat.members[i];
-    }
+    std::string res;
+    res.reserve(16 + sizeX * sizeY * 8);
+    SaveChunks([&res](const char *p, size_t n) { res.append(p, n); });
     return res;
 }
 
-template <typename Type, SizeType SizeT>
-inline Mat<Type, SizeT> Mat<Type, SizeT>::operator/(copy_fast_t<Type> value) const noexcept
+template <typename Type, SizeType SizeT, typename Alloc>
+inline void Mat<Type, SizeT, Alloc>::Save(std::ostream &os) const
 {
-    Mat res(sizeX, sizeY);
-    for (size_t i = 0; i < sizeX * sizeY; ++i)
+    SaveChunks([&os](const char *p, size_t n) { os.write(p, std::streamsize(n)); });
+}
+
+template <typename Type, SizeType SizeT, typename Alloc>
+inline Mat<Type, SizeT, Alloc> Mat<Type, SizeT, Alloc>::LoadFrom(MatTextReader &reader)
+{
+    MAT_STATS_SCOPE(MatOp::Load, 0);
+    char delim;
+    reader.Open();
+    const SizeT w = reader.NextNumber<SizeT>(delim);
+    if (delim != ',')
+        throw std::invalid_argument("Load: expected ','");
+    const SizeT h = reader.NextNumber<SizeT>(delim);
+    //the element count is formed in SizeT and size_t and allocated in bytes, none of them may wrap
+    constexpr size_t countMax = std::min<size_t>(std::numeric_limits<SizeT>::max(), std::numeric_limits<size_t>::max() / sizeof(Type));
+    if (h && size_t(w) > countMax / size_t(h))
+        throw std::invalid_argument("Load: dimensions too large");
+    const size_t n = size_t(w) * h;
+    Mat res(w, h, mat_uninit);
+    for (size_t i = 0; i < n; ++i)
     {
-        res.members[i] = this->members[i] / value;
+        if (delim != ',')
+            throw std::invalid_argument("Load: fewer elements than the dimensions");
+        res.members[i] = reader.NextNumber<Type>(delim);
     }
+    if (delim != ')')
+        throw std::invalid_argument("Load: more elements than the dimensions");
     return res;
 }
 
-template <typename Type, SizeType SizeT>
-inline Mat<Type, SizeT> Mat<Type, SizeT>::operator/=(const Mat<Type, SizeT> &mat)
+template <typename Type, SizeType SizeT, typename Alloc>
+inline Mat<Type, SizeT, Alloc> Mat<Type, SizeT, Alloc>::Load(std::istream &is)
 {
-    if ((sizeX * sizeY) != (mat.sizeX * mat.sizeY))
-        throw std::invalid_argument("operator/=: parameter must match the dimensions of this");
-    for (size_t i = 0; i < sizeX * sizeY; ++i)
-    {
-        this->members[i] /= mat.members[i];
-    }
-    return *this;
+    MatTextReader reader(is);
+    return LoadFrom(reader);
 }
 
-template <typename Type, SizeType SizeT>
-inline Mat<Type, SizeT> Mat<Type, SizeT>::operator/=(copy_fast_t<Type> value) noexcept
+template <typename Type, SizeType SizeT, typename Alloc>
+inline Mat<Type, SizeT, Alloc> Mat<Type, SizeT, Alloc>::Load(std::string_view text)
 {
-    for (size_t i = 0; i < sizeX * sizeY; ++i)
-    {
-        this->members[i] /= value;
-    }
-    return *this;
+    MatTextReader reader(text);
+    return LoadFrom(reader);
 }
 
-template <typename Type, SizeType SizeT>
-inline Mat<Type, SizeT>::~Mat() noexcept
+template <typename Type, SizeType SizeT, typename Alloc>
+inline Mat<Type, SizeT, Alloc>::~Mat() noexcept
 {
-    delete[] members;
+    Release();
 }
 
+//elementwise expression nodes, leaves that own or map storage are held by reference and inner nodes by value
+template <typename T>
+concept MatExprNode = T::expr_node;
+template <typename T>
+using mat_expr_ref_t = std::conditional_t<MatExprNode<T>, T, const T &>;
+
+template <typename Op, typename L, typename R>
+class MatBinaryExpr : public MatExpr<MatBinaryExpr<Op, L, R>>
+{
+private:
+    mat_expr_ref_t<L> lhs;
+    mat_expr_ref_t<R> rhs;
+
+public:
+    using type = typename L::type;
+    using storage_type = typename L::storage_type;
+    static constexpr bool expr_node = true;
+    static constexpr bool contiguous = L::contiguous && R::contiguous;
+    static constexpr size_t ops = MatExprOps<L>() + MatExprOps<R>() + 1;
+
+    MatBinaryExpr(const L &l, const R &r) noexcept : lhs(l), rhs(r) {}
+
+    ALWAYS_INLINE type Eval(size_t index) const noexcept { return static_cast<type>(Op{}(lhs.Eval(index), rhs.Eval(index))); }
+    ALWAYS_INLINE type Eval(size_t x, size_t y) const noexcept { return static_cast<type>(Op{}(lhs.Eval(x, y), rhs.Eval(x, y))); }
+    bool Aliases(const void *first, const void *last, size_t w) const noexcept { return MatExprAliases(lhs, first, last, w) || MatExprAliases(rhs, first, last, w); }
+    storage_type SizeX() const noexcept { return lhs.SizeX(); }
+    storage_type SizeY() const noexcept { return lhs.SizeY(); }
+};
+
+template <typename Op, typename L>
+class MatScalarExpr : public MatExpr<MatScalarExpr<Op, L>>
+{
+private:
+    mat_expr_ref_t<L> lhs;
+    typename L::type value;
+
+public:
+    using type = typename L::type;
+    using storage_type = typename L::storage_type;
+    static constexpr bool expr_node = true;
+    static constexpr bool contiguous = L::contiguous;
+    static constexpr size_t ops = MatExprOps<L>() + 1;
+
+    MatScalarExpr(const L &l, copy_fast_t<type> v) noexcept : lhs(l), value(v) {}
+
+    ALWAYS_INLINE type Eval(size_t index) const noexcept { return static_cast<type>(Op{}(lhs.Eval(index), value)); }
+    ALWAYS_INLINE type Eval(size_t x, size_t y) const noexcept { return static_cast<type>(Op{}(lhs.Eval(x, y), value)); }
+    bool Aliases(const void *first, const void *last, size_t w) const noexcept { return MatExprAliases(lhs, first, last, w); }
+    storage_type SizeX() const noexcept { return lhs.SizeX(); }
+    storage_type SizeY() const noexcept { return lhs.SizeY(); }
+};
+
+#define MAT_EXPR_OPERATOR(op, functor)                                                                              \
+    template <typename L, typename R>                                                                               \
+    inline MatBinaryExpr<functor, L, R> operator op(const MatExpr<L> &l, const MatExpr<R> &r)                       \
+    {                                                                                                               \
+        if (!MatShapesMatch(l.Self(), r.Self()))                                                                    \
+            throw std::invalid_argument("operator" #op ": parameter must match the dimensions of this");            \
+        return MatBinaryExpr<functor, L, R>(l.Self(), r.Self());                                                    \
+    }                                                                                                               \
+    template <typename L>                                                                                           \
+    inline MatScalarExpr<functor, L> operator op(const MatExpr<L> &l, copy_fast_t<typename L::type> value) noexcept \
+    {                                                                                                               \
+        return MatScalarExpr<functor, L>(l.Self(), value);                                                          \
+    }
+
+MAT_EXPR_OPERATOR(+, std::plus<>)
+MAT_EXPR_OPERATOR(-, std::minus<>)
+MAT_EXPR_OPERATOR(*, std::multiplies<>)
+MAT_EXPR_OPERATOR(/, std::divides<>)
+#undef MAT_EXPR_OPERATOR
+
 using fMat = Mat<float>;
 using dMat = Mat<double>;
 using iMat = Mat<int>;
 
+//hashes the dimensions and every element in one bulk pass (HashValues), e.g. to key memoized products by their operands
+template <typename Type, SizeType SizeT, typename Alloc>
+struct std::hash<Mat<Type, SizeT, Alloc>>
+{
+    size_t operator()(const Mat<Type, SizeT, Alloc> &mat) const noexcept
+    {
+        const uint64_t seed = HashMix64(HashMix64(mat.SizeX()) ^ mat.SizeY());
+        return size_t(HashValues(mat.data(), size_t(mat.SizeX()) * mat.SizeY(), seed));
+    }
+};
+
 template <typename T>
-concept Matrix = std::is_base_of_v<Mat<typename T::type, typename T::storage_type>, T>;
+concept Matrix = std::is_base_of_v<Mat<typename T::type, typename T::storage_type, typename T::allocator_type>, T>;
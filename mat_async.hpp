@@ -0,0 +1,403 @@
+#pragma once
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "mat.hpp"
+#include "mat_reduce.hpp"
+#include "tpool.hpp"
+
+//asynchronous Mat operations, every call returns a MatFuture at once and the work runs on the pool as soon as its inputs are ready
+//the futures form a dependency graph that is scheduled as it is built, independent nodes run concurrently,
+//so the latency of a pipeline is its critical path rather than the sum of its operations
+//a node holds its inputs until it has run, once nothing refers to an intermediate Mat its storage is reused by later results
+
+//dead buffers kept for reuse per MatAsync
+#ifndef MAT_ASYNC_POOL_LIMIT
+#define MAT_ASYNC_POOL_LIMIT 16
+#endif
+
+//storage of dead results, handed out again to results with the same number of elements
+template <typename M>
+class MatBufferPool
+{
+private:
+    std::mutex mtx;
+    std::vector<M> free;
+
+public:
+    //elements are uninitialized
+    M Acquire(typename M::storage_type w, typename M::storage_type h)
+    {
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            for (size_t i = free.size(); i--;)
+            {
+                if (size_t(free[i].SizeX()) * free[i].SizeY() == size_t(w) * h)
+                {
+                    M m = std::move(free[i]);
+                    free[i] = std::move(free.back());
+                    free.pop_back();
+                    m.Reshape(w, h);
+                    return m;
+                }
+            }
+        }
+        return M(w, h, mat_uninit);
+    }
+
+    void Release(M &&m)
+    {
+        if (!m.SizeX() || !m.SizeY())
+        {
+            return;
+        }
+        std::lock_guard<std::mutex> lk(mtx);
+        if (free.size() < MAT_ASYNC_POOL_LIMIT)
+        {
+            free.push_back(std::move(m));
+        }
+    }
+
+    size_t Size()
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        return free.size();
+    }
+};
+
+//completion state shared by a node, the nodes that consume it and any number of futures
+class MatAsyncNode
+{
+private:
+    std::mutex mtx;
+    std::vector<std::function<void()>> continuations;
+    std::atomic<bool> done{false};
+
+public:
+    std::exception_ptr error;
+
+    bool Ready() const noexcept { return done.load(std::memory_order_acquire); }
+
+    //runs f once the node has finished, right away if it already has, otherwise on the thread that finishes it
+    template <typename F>
+    void OnReady(F &&f)
+    {
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            if (!done.load(std::memory_order_relaxed))
+            {
+                continuations.emplace_back(std::forward<F>(f));
+                return;
+            }
+        }
+        f();
+    }
+
+    void Finish(std::exception_ptr e)
+    {
+        std::vector<std::function<void()>> run;
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            error = std::move(e);
+            done.store(true, std::memory_order_release);
+            run.swap(continuations);
+        }
+        for (auto &f : run)
+        {
+            f();
+        }
+    }
+};
+
+template <typename R>
+class MatAsyncState : public MatAsyncNode
+{
+public:
+    std::optional<R> value;
+    std::function<void(R &&)> recycle; //takes the value back when the last reference goes, set for pooled Mat results
+
+    ~MatAsyncState()
+    {
+        if (value && recycle)
+        {
+            recycle(std::move(*value));
+        }
+    }
+};
+
+//handle to the result of an asynchronous operation, copies share it
+//Get and Wait run pool work while the result is pending, co_await suspends the coroutine and resumes it on the pool
+//Get and co_await return a reference into the shared result, so await a named future rather than a temporary when keeping it
+template <typename R>
+class MatFuture
+{
+private:
+    template <typename, SizeType, typename>
+    friend class MatAsync;
+
+    std::shared_ptr<MatAsyncState<R>> state;
+    ThreadPool *pool = nullptr;
+
+    MatFuture(std::shared_ptr<MatAsyncState<R>> s, ThreadPool &p) noexcept : state(std::move(s)), pool(&p) {}
+
+public:
+    using value_type = R;
+
+    MatFuture() = default;
+
+    bool Valid() const noexcept { return state != nullptr; }
+    bool Ready() const noexcept { return state->Ready(); }
+
+    void Wait() const
+    {
+        while (!state->Ready())
+        {
+            if (!pool->RunOne())
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    //rethrows the exception of the operation, or of the first of its inputs that failed
+    //the reference is valid while a future of this result exists
+    const R &Get() const
+    {
+        Wait();
+        if (state->error)
+        {
+            std::rethrow_exception(state->error);
+        }
+        return *state->value;
+    }
+
+    bool await_ready() const noexcept { return state->Ready(); }
+    void await_suspend(std::coroutine_handle<> h) const
+    {
+        state->OnReady([p = pool, h] { p->Run([h] { h.resume(); }); });
+    }
+    const R &await_resume() const { return Get(); }
+};
+
+//builds and schedules asynchronous operations on Mat<Type, SizeT, Alloc>, the pool's threads and any thread waiting on a future run them
+//destruction waits for every operation it launched
+template <typename Type, SizeType SizeT = size_t, typename Alloc = AlignedAllocator<Type, 64>>
+class MatAsync
+{
+public:
+    using mat_type = Mat<Type, SizeT, Alloc>;
+    using real_type = mat_real_t<Type>;
+
+private:
+    ThreadPool &pool;
+    std::shared_ptr<MatBufferPool<mat_type>> buffers;
+    std::atomic<size_t> outstanding{0};
+
+    //inputs not yet ready plus one for the launch itself, the last arrival submits the node
+    struct Launch
+    {
+        std::atomic<size_t> waiting;
+        std::function<void()> run;
+
+        Launch(size_t inputs, std::function<void()> f) : waiting(inputs + 1), run(std::move(f)) {}
+
+        static void Arrive(const std::shared_ptr<Launch> &self, ThreadPool &pool)
+        {
+            if (self->waiting.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                pool.Run([self]
+                         {
+                             self->run();
+                             self->run = nullptr; //drops the inputs, so dead intermediates are recycled right away
+                         });
+            }
+        }
+    };
+
+    template <typename R, typename F, typename... Rs>
+    MatFuture<R> Schedule(F &&body, const MatFuture<Rs> &...in)
+    {
+        (CheckInput(in), ...);
+        auto out = std::make_shared<MatAsyncState<R>>();
+        if constexpr (std::is_same_v<R, mat_type>)
+        {
+            out->recycle = [b = buffers](mat_type &&m) { b->Release(std::move(m)); };
+        }
+        outstanding.fetch_add(1, std::memory_order_relaxed);
+        auto launch = std::make_shared<Launch>(sizeof...(Rs), [this, out, f = std::decay_t<F>(std::forward<F>(body)), ... s = in.state]() mutable
+                                               {
+                                                   std::exception_ptr error;
+                                                   ((error = error ? error : s->error), ...);
+                                                   if (!error)
+                                                   {
+                                                       try
+                                                       {
+                                                           out->value.emplace(f(*s->value...));
+                                                       }
+                                                       catch (...)
+                                                       {
+                                                           error = std::current_exception();
+                                                       }
+                                                   }
+                                                   out->Finish(std::move(error));
+                                                   outstanding.fetch_sub(1, std::memory_order_release);
+                                               });
+        (in.state->OnReady([launch, p = &pool] { Launch::Arrive(launch, *p); }), ...);
+        Launch::Arrive(launch, pool);
+        return MatFuture<R>(std::move(out), pool);
+    }
+
+    template <typename R>
+    void CheckInput(const MatFuture<R> &f) const
+    {
+        if (!f.Valid() || f.pool != &pool)
+            throw std::invalid_argument("MatAsync: futures must come from the same pool");
+    }
+
+    mat_type Buffer(SizeT w, SizeT h) const { return buffers->Acquire(w, h); }
+
+public:
+    explicit MatAsync(ThreadPool &p = ThreadPool::Global()) : pool(p), buffers(std::make_shared<MatBufferPool<mat_type>>()) {}
+    MatAsync(const MatAsync &) = delete;
+    MatAsync &operator=(const MatAsync &) = delete;
+
+    //wraps a value that is already computed, a Mat's storage joins the buffer pool once it is dead
+    template <typename R>
+    MatFuture<std::decay_t<R>> Value(R &&v)
+    {
+        using D = std::decay_t<R>;
+        auto out = std::make_shared<MatAsyncState<D>>();
+        out->value.emplace(std::forward<R>(v));
+        if constexpr (std::is_same_v<D, mat_type>)
+        {
+            out->recycle = [b = buffers](mat_type &&m) { b->Release(std::move(m)); };
+        }
+        out->Finish(nullptr);
+        return MatFuture<D>(std::move(out), pool);
+    }
+
+    //f(inputs...) on the pool once every input is ready, a failed input skips f and its exception is passed on
+    template <typename F, typename... Rs>
+    auto Then(F &&f, const MatFuture<Rs> &...in)
+    {
+        using R = std::decay_t<std::invoke_result_t<std::decay_t<F> &, const Rs &...>>;
+        return Schedule<R>(std::forward<F>(f), in...);
+    }
+
+    //one fused elementwise pass, f builds an expression from the inputs, e.g. [](const auto &a, const auto &b) { return a * b + a * 2; }
+    //the expression holds the inputs by reference, so f must take them by reference too
+    //the first input's shape is the result's, the result is written into a recycled buffer
+    template <typename F, typename... Ms>
+        requires(std::is_same_v<Ms, mat_type> && ...)
+    MatFuture<mat_type> Map(F &&f, const MatFuture<Ms> &...in)
+    {
+        static_assert(sizeof...(Ms) > 0, "Map: needs at least one input");
+        return Schedule<mat_type>([this, g = std::decay_t<F>(std::forward<F>(f))](const Ms &...m) mutable
+                                  {
+                                      const auto e = g(m...);
+                                      mat_type res = Buffer(e.SizeX(), e.SizeY());
+                                      res = e;
+                                      return res;
+                                  },
+                                  in...);
+    }
+
+    MatFuture<mat_type> Add(const MatFuture<mat_type> &a, const MatFuture<mat_type> &b)
+    {
+        return Map([](const auto &x, const auto &y) { return x + y; }, a, b);
+    }
+    MatFuture<mat_type> Sub(const MatFuture<mat_type> &a, const MatFuture<mat_type> &b)
+    {
+        return Map([](const auto &x, const auto &y) { return x - y; }, a, b);
+    }
+    MatFuture<mat_type> Mul(const MatFuture<mat_type> &a, const MatFuture<mat_type> &b)
+    {
+        return Map([](const auto &x, const auto &y) { return x * y; }, a, b);
+    }
+    MatFuture<mat_type> Div(const MatFuture<mat_type> &a, const MatFuture<mat_type> &b)
+    {
+        return Map([](const auto &x, const auto &y) { return x / y; }, a, b);
+    }
+
+    MatFuture<mat_type> Dot(const MatFuture<mat_type> &a, const MatFuture<mat_type> &b)
+    {
+        return Schedule<mat_type>([this](const mat_type &x, const mat_type &y)
+                                  {
+                                      mat_type res;
+                                      if ((x.SizeX() == y.SizeY()) || (x.SizeY() == y.SizeX()))
+                                          res = x.SizeX() == y.SizeY() ? Buffer(y.SizeX(), x.SizeY()) : Buffer(x.SizeX(), y.SizeY());
+                                      DotInto(x.View(), y.View(), res);
+                                      return res;
+                                  },
+                                  a, b);
+    }
+
+    MatFuture<Type> Sum(const MatFuture<mat_type> &a, MatSummation mode = MatSummation::Pairwise)
+    {
+        return Schedule<Type>([mode](const mat_type &m) { return ::Sum(m, mode); }, a);
+    }
+    MatFuture<real_type> Mean(const MatFuture<mat_type> &a, MatSummation mode = MatSummation::Pairwise)
+    {
+        return Schedule<real_type>([mode](const mat_type &m) { return ::Mean(m, mode); }, a);
+    }
+    MatFuture<real_type> Norm(const MatFuture<mat_type> &a, MatSummation mode = MatSummation::Pairwise)
+    {
+        return Schedule<real_type>([mode](const mat_type &m) { return ::Norm(m, mode); }, a);
+    }
+    MatFuture<Type> Min(const MatFuture<mat_type> &a)
+    {
+        return Schedule<Type>([](const mat_type &m) { return ::Min(m); }, a);
+    }
+    MatFuture<Type> Max(const MatFuture<mat_type> &a)
+    {
+        return Schedule<Type>([](const mat_type &m) { return ::Max(m); }, a);
+    }
+
+    //1 x SizeY() and SizeX() x 1 like RowSums / ColSums
+    MatFuture<mat_type> RowSums(const MatFuture<mat_type> &a, MatSummation mode = MatSummation::Pairwise)
+    {
+        return Schedule<mat_type>([this, mode](const mat_type &m)
+                                  {
+                                      mat_type res = Buffer(1, m.SizeY());
+                                      RowSumsInto(m, std::span<Type>(res.data(), m.SizeY()), mode);
+                                      return res;
+                                  },
+                                  a);
+    }
+    MatFuture<mat_type> ColSums(const MatFuture<mat_type> &a, MatSummation mode = MatSummation::Pairwise)
+    {
+        return Schedule<mat_type>([this, mode](const mat_type &m)
+                                  {
+                                      mat_type res = Buffer(m.SizeX(), 1);
+                                      ColSumsInto(m, std::span<Type>(res.data(), m.SizeX()), mode);
+                                      return res;
+                                  },
+                                  a);
+    }
+
+    //runs pool work until every operation launched so far has finished
+    void Wait()
+    {
+        while (outstanding.load(std::memory_order_acquire))
+        {
+            if (!pool.RunOne())
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    //dead buffers currently held for reuse
+    size_t PooledBuffers() const { return buffers->Size(); }
+
+    ~MatAsync() { Wait(); }
+};
@@ -0,0 +1,251 @@
+#pragma once
+#include <cstddef>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "mat.hpp"
+#include "mat_reduce.hpp"
+#include "gemm.hpp"
+#include "tpool.hpp"
+
+//2D convolution (cross correlation, the kernel is not flipped) of feature maps held in Mat
+//a stack of maps is one Mat: batch images of inChannels maps of SizeX() x H, image after image and channel after channel down the rows,
+//kernels likewise stack outChannels x inChannels maps of KW x KH, the result stacks batch x outChannels maps
+//two paths: direct, which slides each kernel tap along whole output rows so the inner loop is a vectorized axpy, unrolled for 3x3 and 5x5,
+//and im2col, which lays every receptive field out as a column so the whole layer is one Gemm of kernels x columns
+
+enum class ConvPath
+{
+    Auto,   //direct for 3x3 and 5x5 kernels with few channel pairs, im2col otherwise
+    Direct,
+    Im2col,
+};
+
+struct ConvParams
+{
+    size_t strideX = 1, strideY = 1;
+    size_t padX = 0, padY = 0; //zeros added on each side
+    size_t dilationX = 1, dilationY = 1;
+    size_t inChannels = 1, outChannels = 1, batch = 1;
+    ConvPath path = ConvPath::Auto;
+};
+
+//Auto takes the direct path for 3x3 and 5x5 kernels while inChannels * outChannels is at most this,
+//past it Gemm's register reuse over the channels beats rereading each output row once per tap
+#ifndef MAT_CONV_DIRECT_CHANNELS
+#define MAT_CONV_DIRECT_CHANNELS 2
+#endif
+
+//im2col columns are built in bands of output rows of about this many bytes, so each band is still cached when Gemm reads it
+#ifndef MAT_CONV_COL_BYTES
+#define MAT_CONV_COL_BYTES (1 << 18)
+#endif
+
+//output extent of one axis, throws when the dilated kernel doesn't fit the padded input
+inline size_t ConvOutSize(size_t in, size_t k, size_t stride, size_t pad, size_t dilation)
+{
+    if (!k || !stride || !dilation)
+        throw std::invalid_argument("Conv2D: kernel size, stride and dilation must be nonzero");
+    const size_t extent = dilation * (k - 1) + 1;
+    if (in + 2 * pad < extent)
+        throw std::invalid_argument("Conv2D: kernel is larger than the padded input");
+    return (in + 2 * pad - extent) / stride + 1;
+}
+
+//geometry shared by both paths
+struct ConvShape
+{
+    size_t w, h, kw, kh, ow, oh;
+};
+
+//output columns [first, last) of a tap that land inside the input, i.e. 0 <= x * stride + offset - pad < in
+inline void ConvTapRange(size_t out, size_t in, size_t stride, size_t offset, size_t pad, size_t &first, size_t &last) noexcept
+{
+    first = offset < pad ? (pad - offset + stride - 1) / stride : 0;
+    last = in + pad > offset ? std::min(out, (in + pad - offset - 1) / stride + 1) : 0;
+    first = std::min(first, last);
+}
+
+//calls body(first, last) over [0, n) units of work flops of T each, split across the pool for large layers
+template <typename T, typename F>
+inline void MatConvUnits(size_t n, size_t work, F &&body)
+{
+    MatParallelUnits(n, work, GemmBlocking<T>::parallel_flops, GemmBlocking<T>::parallel_flops, body);
+}
+
+//direct path, KW is the kernel width known at compile time (0 for any width)
+//each output row of each output map accumulates input row x kernel tap products, rows are independent and split across the pool
+template <size_t KW, typename T>
+inline void ConvDirect(const T *in, size_t ldi, const T *k, T *out, const ConvShape &s, const ConvParams &p)
+{
+    const size_t kw = KW ? KW : s.kw, cin = p.inChannels, cout = p.outChannels;
+    MatConvUnits<T>(p.batch * cout * s.oh, cin * s.kh * kw * s.ow, [=, &s, &p](size_t first, size_t last)
+                    {
+                        for (size_t row = first; row < last; ++row)
+                        {
+                            const size_t oy = row % s.oh, co = row / s.oh % cout, n = row / s.oh / cout;
+                            T *dst = out + row * s.ow;
+                            std::fill(dst, dst + s.ow, T());
+                            for (size_t ci = 0; ci < cin; ++ci)
+                            {
+                                const T *map = in + (n * cin + ci) * s.h * ldi;
+                                const T *taps = k + (co * cin + ci) * s.kh * kw;
+                                for (size_t ky = 0; ky < s.kh; ++ky)
+                                {
+                                    const size_t iy = oy * p.strideY + ky * p.dilationY;
+                                    if (iy < p.padY || iy - p.padY >= s.h)
+                                        continue;
+                                    const T *src = map + (iy - p.padY) * ldi;
+                                    const auto tap = [&](size_t kx)
+                                    {
+                                        const T wt = taps[ky * kw + kx];
+                                        size_t x0, x1;
+                                        ConvTapRange(s.ow, s.w, p.strideX, kx * p.dilationX, p.padX, x0, x1);
+                                        //x0 * stride + offset >= pad, so the first input column never underflows
+                                        const T *base = src + (x0 * p.strideX + kx * p.dilationX - p.padX);
+                                        if (p.strideX == 1)
+                                        {
+                                            for (size_t x = x0; x < x1; ++x)
+                                            {
+                                                dst[x] += wt * base[x - x0];
+                                            }
+                                        }
+                                        else
+                                        {
+                                            for (size_t x = x0; x < x1; ++x)
+                                            {
+                                                dst[x] += wt * base[(x - x0) * p.strideX];
+                                            }
+                                        }
+                                    };
+                                    if constexpr (KW != 0)
+                                    {
+                                        static_for<KW>([&](auto kx) { tap(kx); });
+                                    }
+                                    else
+                                    {
+                                        for (size_t kx = 0; kx < kw; ++kx)
+                                        {
+                                            tap(kx);
+                                        }
+                                    }
+                                }
+                            }
+                        }
+                    });
+}
+
+//lays out output rows [y0, y1) of image n as inChannels * kh * kw rows of (y1 - y0) * ow columns,
+//row (ci, ky, kx) holds that tap's input under every output position
+template <typename T>
+inline void ConvIm2col(const T *in, size_t ldi, T *col, size_t n, size_t y0, size_t y1, const ConvShape &s, const ConvParams &p)
+{
+    const size_t cin = p.inChannels, cols = (y1 - y0) * s.ow;
+    MatConvUnits<T>(cin * s.kh * s.kw, cols, [=, &s, &p](size_t first, size_t last)
+                    {
+                        for (size_t r = first; r < last; ++r)
+                        {
+                            const size_t kx = r % s.kw, ky = r / s.kw % s.kh, ci = r / s.kw / s.kh;
+                            const T *map = in + (n * cin + ci) * s.h * ldi;
+                            T *dst = col + r * cols;
+                            size_t x0, x1;
+                            ConvTapRange(s.ow, s.w, p.strideX, kx * p.dilationX, p.padX, x0, x1);
+                            for (size_t oy = y0; oy < y1; ++oy, dst += s.ow)
+                            {
+                                const size_t iy = oy * p.strideY + ky * p.dilationY;
+                                if (iy < p.padY || iy - p.padY >= s.h)
+                                {
+                                    std::fill(dst, dst + s.ow, T());
+                                    continue;
+                                }
+                                const T *src = map + (iy - p.padY) * ldi + (x0 * p.strideX + kx * p.dilationX - p.padX);
+                                std::fill(dst, dst + x0, T());
+                                if (p.strideX == 1)
+                                {
+                                    std::copy(src, src + (x1 - x0), dst + x0);
+                                }
+                                else
+                                {
+                                    for (size_t x = x0; x < x1; ++x)
+                                    {
+                                        dst[x] = src[(x - x0) * p.strideX];
+                                    }
+                                }
+                                std::fill(dst + x1, dst + s.ow, T());
+                            }
+                        }
+                    });
+}
+
+//throws std::invalid_argument when the stacks don't divide into the channel and batch counts or the kernel doesn't fit
+template <typename Type, SizeType SizeT, typename Alloc = AlignedAllocator<Type, 64>>
+inline Mat<Type, SizeT, Alloc> Conv2D(MatView<const Type, SizeT> input, MatView<const Type, SizeT> kernels, const ConvParams &p = {})
+{
+    const size_t maps = p.batch * p.inChannels, kmaps = p.outChannels * p.inChannels;
+    if (!maps || !p.outChannels || input.SizeY() % maps || kernels.SizeY() % kmaps)
+        throw std::invalid_argument("Conv2D: stacks must hold batch * inChannels maps and outChannels * inChannels kernels");
+    ConvShape s;
+    s.w = input.SizeX();
+    s.h = input.SizeY() / maps;
+    s.kw = kernels.SizeX();
+    s.kh = kernels.SizeY() / kmaps;
+    s.ow = ConvOutSize(s.w, s.kw, p.strideX, p.padX, p.dilationX);
+    s.oh = ConvOutSize(s.h, s.kh, p.strideY, p.padY, p.dilationY);
+    Mat<Type, SizeT, Alloc> res(SizeT(s.ow), SizeT(p.batch * p.outChannels * s.oh), mat_uninit);
+
+    //both paths read rows of contiguous elements, transposed operands are copied first
+    const Mat<Type, SizeT> inCopy = input.IsTransposed() ? Mat<Type, SizeT>(input) : Mat<Type, SizeT>();
+    const Mat<Type, SizeT> kCopy = kernels.IsTransposed() || kernels.Stride() != kernels.SizeX() ? Mat<Type, SizeT>(kernels) : Mat<Type, SizeT>();
+    const Type *in = inCopy.data() ? inCopy.data() : input.data();
+    const size_t ldi = inCopy.data() ? s.w : input.Stride();
+    const Type *k = kCopy.data() ? kCopy.data() : kernels.data();
+
+    const size_t taps = p.inChannels * s.kh * s.kw, cols = s.oh * s.ow;
+    MAT_STATS_SCOPE(MatOp::Conv, 2 * uint64_t(p.batch) * p.outChannels * taps * cols);
+    const bool small = s.kw == s.kh && (s.kw == 3 || s.kw == 5);
+    ConvPath path = p.path;
+    if (path == ConvPath::Auto)
+        path = small && p.inChannels * p.outChannels <= MAT_CONV_DIRECT_CHANNELS ? ConvPath::Direct : ConvPath::Im2col;
+    if (path == ConvPath::Direct)
+    {
+        if (s.kw == 3)
+            ConvDirect<3>(in, ldi, k, res.data(), s, p);
+        else if (s.kw == 5)
+            ConvDirect<5>(in, ldi, k, res.data(), s, p);
+        else
+            ConvDirect<0>(in, ldi, k, res.data(), s, p);
+        return res;
+    }
+
+    //outChannels x taps kernels times taps x cols columns is the outChannels x cols block of each image,
+    //the columns are built a band of output rows at a time so they stay in cache for the product
+    std::fill(res.data(), res.data() + p.batch * p.outChannels * cols, Type());
+    //an unpadded 1x1 kernel with unit stride already has the input as its columns
+    const bool pointwise = s.kw == 1 && s.kh == 1 && p.strideX == 1 && p.strideY == 1 && !p.padX && !p.padY && ldi == s.w;
+    const size_t band = std::clamp<size_t>(MAT_CONV_COL_BYTES / sizeof(Type) / std::max<size_t>(taps * s.ow, 1), 1, s.oh);
+    std::vector<Type, AlignedAllocator<Type, 64>> col(pointwise ? 0 : taps * band * s.ow);
+    for (size_t n = 0; n < p.batch; ++n)
+    {
+        Type *c = res.data() + n * p.outChannels * cols;
+        if (pointwise)
+        {
+            ParallelGemm<Type>(p.outChannels, cols, taps, Type(1), k, taps, 1, in + n * p.inChannels * s.h * ldi, cols, 1, c, cols, 1);
+            continue;
+        }
+        for (size_t y0 = 0; y0 < s.oh; y0 += band)
+        {
+            const size_t y1 = std::min(s.oh, y0 + band), bandCols = (y1 - y0) * s.ow;
+            ConvIm2col(in, ldi, col.data(), n, y0, y1, s, p);
+            ParallelGemm<Type>(p.outChannels, bandCols, taps, Type(1), k, taps, 1, col.data(), bandCols, 1, c + y0 * s.ow, cols, 1);
+        }
+    }
+    return res;
+}
+
+template <MatViewable M, MatViewable K>
+inline Mat<typename M::type, typename M::storage_type> Conv2D(const M &input, const K &kernels, const ConvParams &p = {})
+{
+    return Conv2D<typename M::type, typename M::storage_type>(mat_const_view_t<M>(input), mat_const_view_t<K>(kernels), p);
+}
@@ -0,0 +1,293 @@
+#pragma once
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <algorithm>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include "mat.hpp"
+
+//binary Mat format, a 64 byte header followed by the row major elements
+//the payload starts at a 64 byte offset so a mapped file keeps the alignment Mat storage has in memory
+struct MatFileHeader
+{
+    char magic[4];
+    uint8_t version;
+    uint8_t endian;   //1 little, 2 big
+    uint8_t kind;     //0 signed integer, 1 unsigned integer, 2 floating point
+    uint8_t elemSize; //bytes per element
+    uint64_t sizeX;
+    uint64_t sizeY;
+    uint64_t dataOffset;
+    uint8_t reserved[32];
+};
+static_assert(sizeof(MatFileHeader) == 64, "MatFileHeader must stay 64 bytes");
+
+inline constexpr char mat_file_magic[4] = {'O', 'H', 'M', 'T'};
+inline constexpr uint8_t mat_file_version = 1;
+
+inline constexpr uint8_t MatFileEndian() noexcept { return std::endian::native == std::endian::little ? 1 : 2; }
+
+template <typename T>
+constexpr uint8_t MatFileKind() noexcept
+{
+    static_assert(std::is_arithmetic_v<T>, "binary Mat files only hold arithmetic element types");
+    return std::is_floating_point_v<T> ? 2 : (std::is_signed_v<T> ? 0 : 1);
+}
+
+template <typename T>
+inline MatFileHeader MakeMatFileHeader(uint64_t w, uint64_t h) noexcept
+{
+    MatFileHeader head{};
+    std::memcpy(head.magic, mat_file_magic, 4);
+    head.version = mat_file_version;
+    head.endian = MatFileEndian();
+    head.kind = MatFileKind<T>();
+    head.elemSize = sizeof(T);
+    head.sizeX = w;
+    head.sizeY = h;
+    head.dataOffset = sizeof(MatFileHeader);
+    return head;
+}
+
+//throws if head can't describe a T matrix, byte order is checked separately since only mapping requires it to match
+template <typename T>
+inline void CheckMatFileHeader(const MatFileHeader &head, const char *who)
+{
+    if (std::memcmp(head.magic, mat_file_magic, 4) || head.version != mat_file_version)
+        throw std::runtime_error(std::string(who) + ": not a Mat file");
+    if (head.kind != MatFileKind<T>() || head.elemSize != sizeof(T))
+        throw std::invalid_argument(std::string(who) + ": element type does not match the file");
+    if (head.endian != 1 && head.endian != 2)
+        throw std::runtime_error(std::string(who) + ": corrupt header");
+}
+
+//throws unless the host order dimensions and offset of head fit SizeT and size_t, returns the element count
+//every product is checked by division first so hostile headers can't wrap around
+template <typename T, typename SizeT>
+inline size_t CheckMatFileExtent(const MatFileHeader &head, const char *who)
+{
+    if (head.dataOffset < sizeof(MatFileHeader))
+        throw std::runtime_error(std::string(who) + ": corrupt header");
+    constexpr uint64_t dimMax = std::min<uint64_t>(std::numeric_limits<SizeT>::max(), std::numeric_limits<size_t>::max());
+    if (head.sizeX > dimMax || head.sizeY > dimMax)
+        throw std::runtime_error(std::string(who) + ": dimensions too large");
+    if (head.sizeX && head.sizeY > std::numeric_limits<size_t>::max() / sizeof(T) / head.sizeX)
+        throw std::runtime_error(std::string(who) + ": dimensions too large");
+    return size_t(head.sizeX) * size_t(head.sizeY);
+}
+
+template <typename T>
+inline void ByteSwapInPlace(T *data, size_t n) noexcept
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        unsigned char *b = reinterpret_cast<unsigned char *>(data + i);
+        std::reverse(b, b + sizeof(T));
+    }
+}
+
+//streams header and elements straight from Mat storage, no intermediate buffer
+template <Matrix M>
+inline void SaveBinary(const M &mat, std::ostream &os)
+{
+    MAT_STATS_SCOPE(MatOp::Save, 0);
+    using T = typename M::type;
+    const MatFileHeader head = MakeMatFileHeader<T>(mat.SizeX(), mat.SizeY());
+    os.write(reinterpret_cast<const char *>(&head), sizeof(head));
+    os.write(reinterpret_cast<const char *>(mat.data()), std::streamsize(sizeof(T) * mat.SizeX() * mat.SizeY()));
+    if (!os)
+        throw std::runtime_error("SaveBinary: stream write failed");
+}
+
+inline void MatWriteAll(int fd, const void *buf, size_t bytes)
+{
+    const char *p = static_cast<const char *>(buf);
+    while (bytes)
+    {
+        const ssize_t n = ::write(fd, p, bytes);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw std::runtime_error("SaveBinary: write failed, errno " + std::to_string(errno));
+        }
+        p += n;
+        bytes -= size_t(n);
+    }
+}
+
+template <Matrix M>
+inline void SaveBinary(const M &mat, int fd)
+{
+    MAT_STATS_SCOPE(MatOp::Save, 0);
+    using T = typename M::type;
+    const MatFileHeader head = MakeMatFileHeader<T>(mat.SizeX(), mat.SizeY());
+    MatWriteAll(fd, &head, sizeof(head));
+    MatWriteAll(fd, mat.data(), sizeof(T) * mat.SizeX() * mat.SizeY());
+}
+
+template <Matrix M>
+inline void SaveBinary(const M &mat, const std::string &path)
+{
+    const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        throw std::runtime_error("SaveBinary: can't open " + path);
+    try
+    {
+        SaveBinary(mat, fd);
+    }
+    catch (...)
+    {
+        ::close(fd);
+        throw;
+    }
+    if (::close(fd))
+        throw std::runtime_error("SaveBinary: close failed for " + path);
+}
+
+//reads straight into uninitialized Mat storage, swapping bytes if the file came from the other endianness
+template <Matrix M>
+inline M LoadBinary(std::istream &is)
+{
+    MAT_STATS_SCOPE(MatOp::Load, 0);
+    using T = typename M::type;
+    using S = typename M::storage_type;
+    MatFileHeader head;
+    if (!is.read(reinterpret_cast<char *>(&head), sizeof(head)))
+        throw std::runtime_error("LoadBinary: truncated header");
+    CheckMatFileHeader<T>(head, "LoadBinary");
+    if (head.endian != MatFileEndian())
+    {
+        ByteSwapInPlace(&head.sizeX, 1);
+        ByteSwapInPlace(&head.sizeY, 1);
+        ByteSwapInPlace(&head.dataOffset, 1);
+    }
+    //validated in host order, before anything is skipped or allocated
+    const size_t n = CheckMatFileExtent<T, S>(head, "LoadBinary");
+    if (head.dataOffset - sizeof(head) > uint64_t(std::numeric_limits<std::streamsize>::max()) || n * sizeof(T) > uint64_t(std::numeric_limits<std::streamsize>::max()))
+        throw std::runtime_error("LoadBinary: file too large for the stream");
+    if (!is.ignore(std::streamsize(head.dataOffset - sizeof(head))))
+        throw std::runtime_error("LoadBinary: truncated header");
+    M res(S(head.sizeX), S(head.sizeY), mat_uninit);
+    if (!is.read(reinterpret_cast<char *>(res.data()), std::streamsize(n * sizeof(T))))
+        throw std::runtime_error("LoadBinary: truncated data");
+    if (head.endian != MatFileEndian())
+    {
+        ByteSwapInPlace(res.data(), n);
+    }
+    return res;
+}
+
+//read only, zero copy view of a binary Mat file, the pages are mapped and faulted in on demand
+//the mapping must match the host byte order since elements are never copied
+template <typename Type = float>
+class MappedMat : public MatExpr<MappedMat<Type>>
+{
+private:
+    void *base = nullptr;
+    size_t bytes = 0;
+    const Type *members = nullptr;
+    size_t sizeY = 0, sizeX = 0;
+
+public:
+    using type = Type;
+    using storage_type = size_t;
+    static constexpr bool contiguous = true;
+
+    MappedMat() noexcept = default;
+    explicit MappedMat(const std::string &path)
+    {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("MappedMat: can't open " + path);
+        struct stat st;
+        if (::fstat(fd, &st) || size_t(st.st_size) < sizeof(MatFileHeader))
+        {
+            ::close(fd);
+            throw std::runtime_error("MappedMat: " + path + " is too small");
+        }
+        bytes = size_t(st.st_size);
+        base = ::mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd); //the mapping keeps the file alive
+        if (base == MAP_FAILED)
+        {
+            base = nullptr;
+            throw std::runtime_error("MappedMat: mmap failed for " + path);
+        }
+        try
+        {
+            const MatFileHeader &head = *static_cast<const MatFileHeader *>(base);
+            CheckMatFileHeader<Type>(head, "MappedMat");
+            if (head.endian != MatFileEndian())
+                throw std::runtime_error("MappedMat: file byte order differs from the host, use LoadBinary");
+            CheckMatFileExtent<Type, size_t>(head, "MappedMat");
+            //the offset is checked before it is subtracted and the payload is compared by division, so nothing can wrap
+            if (head.dataOffset > bytes || (head.sizeX && head.sizeY > (bytes - head.dataOffset) / sizeof(Type) / head.sizeX))
+                throw std::runtime_error("MappedMat: truncated data");
+            if (head.dataOffset % alignof(Type))
+                throw std::runtime_error("MappedMat: misaligned data offset");
+            sizeX = size_t(head.sizeX);
+            sizeY = size_t(head.sizeY);
+            members = reinterpret_cast<const Type *>(static_cast<const char *>(base) + head.dataOffset);
+            ::madvise(base, bytes, MADV_SEQUENTIAL);
+        }
+        catch (...)
+        {
+            ::munmap(base, bytes);
+            throw;
+        }
+    }
+
+    MappedMat(const MappedMat &) = delete;
+    MappedMat &operator=(const MappedMat &) = delete;
+    MappedMat(MappedMat &&mat) noexcept : base(std::exchange(mat.base, nullptr)), bytes(std::exchange(mat.bytes, 0)), members(std::exchange(mat.members, nullptr)), sizeY(std::exchange(mat.sizeY, 0)), sizeX(std::exchange(mat.sizeX, 0)) {}
+    MappedMat &operator=(MappedMat &&mat) noexcept
+    {
+        if (this != &mat)
+        {
+            if (base)
+                ::munmap(base, bytes);
+            base = std::exchange(mat.base, nullptr);
+            bytes = std::exchange(mat.bytes, 0);
+            members = std::exchange(mat.members, nullptr);
+            sizeY = std::exchange(mat.sizeY, 0);
+            sizeX = std::exchange(mat.sizeX, 0);
+        }
+        return *this;
+    }
+
+    size_t SizeX() const noexcept { return sizeX; }
+    size_t SizeY() const noexcept { return sizeY; }
+
+    Type At(size_t x, size_t y) const
+    {
+        MAT_BOUNDS((x < sizeX) && (y < sizeY), MatOutOfRange("At", x, y));
+        return members[(y * sizeX) + x];
+    }
+    ALWAYS_INLINE Type Eval(size_t index) const noexcept { return members[index]; }
+    ALWAYS_INLINE Type Eval(size_t x, size_t y) const noexcept { return members[y * sizeX + x]; }
+
+    MatView<const Type, size_t> View() const noexcept { return MatView<const Type, size_t>(members, sizeX, sizeY, sizeX); }
+    operator MatView<const Type, size_t>() const noexcept { return View(); }
+
+    const Type *begin() const noexcept { return members; }
+    const Type *end() const noexcept { return members + sizeX * sizeY; }
+    const Type *data() const noexcept { return members; }
+
+    ~MappedMat() noexcept
+    {
+        if (base)
+            ::munmap(base, bytes);
+    }
+};
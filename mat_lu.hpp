@@ -0,0 +1,283 @@
+#pragma once
+#include <cstddef>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "mat.hpp"
+#include "mat_reduce.hpp"
+#include "gemm.hpp"
+#include "tpool.hpp"
+
+//LU decomposition with partial pivoting, P A = L U, and the solves built on it
+//right looking and blocked: each MAT_LU_BLOCK wide column panel is factored by recursive halving, then the rows right of it
+//are solved against its L and the trailing matrix takes one rank MAT_LU_BLOCK update through ParallelGemm,
+//so all but O(n^2 * MAT_LU_BLOCK) of the 2/3 n^3 flops are matrix products spread across the pool
+
+//columns per panel, the k of every trailing update
+#ifndef MAT_LU_BLOCK
+#define MAT_LU_BLOCK 64
+#endif
+
+//panels this narrow are factored a column at a time
+#ifndef MAT_LU_PANEL_LEAF
+#define MAT_LU_PANEL_LEAF 8
+#endif
+
+//calls body(first, last) over [0, k) right hand side columns of T, split across the pool in pieces of at least 64 columns
+//when k * flopsPerColumn is large enough
+template <typename T, typename F>
+inline void MatLUColumns(size_t k, size_t flopsPerColumn, F &&body)
+{
+    constexpr size_t flops = GemmBlocking<T>::parallel_flops;
+    MatParallelUnits(k, flopsPerColumn, flops, std::max(flops, 64 * flopsPerColumn), body);
+}
+
+//solves L X = B in place, L is m x m unit lower triangular, B is m x k, row major with leading dimensions ldl and ldb
+template <typename T>
+inline void MatTrsmLowerUnit(size_t m, size_t k, const T *l, size_t ldl, T *b, size_t ldb)
+{
+    for (size_t i0 = 0; i0 < m; i0 += MAT_LU_BLOCK)
+    {
+        const size_t i1 = std::min(m, i0 + MAT_LU_BLOCK);
+        MatLUColumns<T>(k, (i1 - i0) * (i1 - i0), [=](size_t first, size_t last)
+                        {
+                            for (size_t i = i0 + 1; i < i1; ++i)
+                            {
+                                T *row = b + i * ldb;
+                                for (size_t p = i0; p < i; ++p)
+                                {
+                                    const T f = l[i * ldl + p];
+                                    const T *src = b + p * ldb;
+                                    for (size_t j = first; j < last; ++j)
+                                    {
+                                        row[j] -= f * src[j];
+                                    }
+                                }
+                            }
+                        });
+        if (i1 < m)
+        {
+            ParallelGemm<T>(m - i1, k, i1 - i0, T(-1), l + i1 * ldl + i0, ldl, 1, b + i0 * ldb, ldb, 1, b + i1 * ldb, ldb, 1);
+        }
+    }
+}
+
+//solves U X = B in place, U is m x m upper triangular with a nonzero diagonal, B is m x k
+template <typename T>
+inline void MatTrsmUpper(size_t m, size_t k, const T *u, size_t ldu, T *b, size_t ldb)
+{
+    for (size_t i1 = m; i1 > 0;)
+    {
+        const size_t i0 = i1 > MAT_LU_BLOCK ? i1 - MAT_LU_BLOCK : 0;
+        MatLUColumns<T>(k, (i1 - i0) * (i1 - i0), [=](size_t first, size_t last)
+                        {
+                            for (size_t i = i1; i-- > i0;)
+                            {
+                                T *row = b + i * ldb;
+                                for (size_t p = i + 1; p < i1; ++p)
+                                {
+                                    const T f = u[i * ldu + p];
+                                    const T *src = b + p * ldb;
+                                    for (size_t j = first; j < last; ++j)
+                                    {
+                                        row[j] -= f * src[j];
+                                    }
+                                }
+                                const T inv = T(1) / u[i * ldu + i];
+                                for (size_t j = first; j < last; ++j)
+                                {
+                                    row[j] *= inv;
+                                }
+                            }
+                        });
+        if (i0)
+        {
+            ParallelGemm<T>(i0, k, i1 - i0, T(-1), u + i0, ldu, 1, b + i0 * ldb, ldb, 1, b, ldb, 1);
+        }
+        i1 = i0;
+    }
+}
+
+template <typename Type, SizeType SizeT = size_t>
+class MatLU
+{
+    static_assert(std::is_floating_point_v<Type>, "MatLU: element type must be floating point");
+
+private:
+    Mat<Type, SizeT> lu;
+    std::vector<size_t> pivots; //row i was swapped with row pivots[i] at step i
+    int sign = 1;
+    bool singular = false;
+
+    void SwapRows(size_t r, size_t p) noexcept
+    {
+        Type *a = lu.data();
+        const size_t n = lu.SizeX();
+        std::swap_ranges(a + r * n, a + r * n + n, a + p * n);
+    }
+
+    //factors columns [c0, c1) of rows [c0, n), pivots swap whole rows
+    void Panel(size_t c0, size_t c1);
+
+public:
+    MatLU() = default;
+    //throws std::invalid_argument unless a is square, a singular matrix factors fine, Singular() reports it
+    explicit MatLU(MatView<const Type, SizeT> a);
+
+    //U on and above the diagonal, L below it with its unit diagonal implied
+    const Mat<Type, SizeT> &Factors() const noexcept { return lu; }
+    const std::vector<size_t> &Pivots() const noexcept { return pivots; }
+    bool Singular() const noexcept { return singular; }
+    size_t Size() const noexcept { return lu.SizeX(); }
+
+    Type Determinant() const noexcept;
+    //X with A X = B for every column of B at once, B has Size() rows, throws std::domain_error when A is singular
+    Mat<Type, SizeT> Solve(MatView<const Type, SizeT> b) const;
+    //solves in place, b is Size() rows of b.SizeX() contiguous columns
+    void SolveInPlace(Mat<Type, SizeT> &b) const;
+    Mat<Type, SizeT> Inverse() const;
+};
+
+template <typename Type, SizeType SizeT>
+inline MatLU<Type, SizeT>::MatLU(MatView<const Type, SizeT> a) : lu(a), pivots(a.SizeY())
+{
+    if (a.SizeX() != a.SizeY())
+        throw std::invalid_argument("MatLU: matrix must be square");
+    const size_t n = a.SizeX();
+    Type *d = lu.data();
+    for (size_t j0 = 0; j0 < n; j0 += MAT_LU_BLOCK)
+    {
+        const size_t j1 = std::min(n, j0 + MAT_LU_BLOCK);
+        Panel(j0, j1);
+        if (j1 < n)
+        {
+            //U12 = L11^-1 A12, then A22 -= L21 U12
+            MatTrsmLowerUnit(j1 - j0, n - j1, d + j0 * n + j0, n, d + j0 * n + j1, n);
+            ParallelGemm<Type>(n - j1, n - j1, j1 - j0, Type(-1), d + j1 * n + j0, n, 1, d + j0 * n + j1, n, 1, d + j1 * n + j1, n, 1);
+        }
+    }
+}
+
+template <typename Type, SizeType SizeT>
+inline void MatLU<Type, SizeT>::Panel(size_t c0, size_t c1)
+{
+    const size_t n = lu.SizeX();
+    Type *d = lu.data();
+    if (c1 - c0 > MAT_LU_PANEL_LEAF)
+    {
+        //left half, its L solves the top of the right half, the rest of the right half takes the rank update
+        const size_t mid = c0 + (c1 - c0) / 2;
+        Panel(c0, mid);
+        MatTrsmLowerUnit(mid - c0, c1 - mid, d + c0 * n + c0, n, d + c0 * n + mid, n);
+        ParallelGemm<Type>(n - mid, c1 - mid, mid - c0, Type(-1), d + mid * n + c0, n, 1, d + c0 * n + mid, n, 1, d + mid * n + mid, n, 1);
+        Panel(mid, c1);
+        return;
+    }
+    for (size_t c = c0; c < c1; ++c)
+    {
+        size_t p = c;
+        Type best = std::abs(d[c * n + c]);
+        for (size_t r = c + 1; r < n; ++r)
+        {
+            const Type v = std::abs(d[r * n + c]);
+            if (v > best)
+            {
+                best = v;
+                p = r;
+            }
+        }
+        pivots[c] = p;
+        if (p != c)
+        {
+            SwapRows(c, p);
+            sign = -sign;
+        }
+        if (best == Type(0))
+        {
+            singular = true;
+            continue;
+        }
+        const Type inv = Type(1) / d[c * n + c];
+        const Type *top = d + c * n;
+        SimdDispatch([&](auto)
+                     {
+                         for (size_t r = c + 1; r < n; ++r)
+                         {
+                             Type *row = d + r * n;
+                             const Type f = row[c] *= inv;
+                             for (size_t j = c + 1; j < c1; ++j)
+                             {
+                                 row[j] -= f * top[j];
+                             }
+                         }
+                     });
+    }
+}
+
+template <typename Type, SizeType SizeT>
+inline Type MatLU<Type, SizeT>::Determinant() const noexcept
+{
+    if (singular)
+        return Type(0);
+    Type det = Type(sign);
+    const size_t n = Size();
+    for (size_t i = 0; i < n; ++i)
+    {
+        det *= lu.data()[i * n + i];
+    }
+    return det;
+}
+
+template <typename Type, SizeType SizeT>
+inline void MatLU<Type, SizeT>::SolveInPlace(Mat<Type, SizeT> &b) const
+{
+    const size_t n = Size(), k = b.SizeX();
+    if (b.SizeY() != n)
+        throw std::invalid_argument("Solve: right hand side must have as many rows as the matrix");
+    if (singular)
+        throw std::domain_error("Solve: matrix is singular");
+    Type *x = b.data();
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (pivots[i] != i)
+        {
+            std::swap_ranges(x + i * k, x + i * k + k, x + pivots[i] * k);
+        }
+    }
+    MatTrsmLowerUnit(n, k, lu.data(), n, x, k);
+    MatTrsmUpper(n, k, lu.data(), n, x, k);
+}
+
+template <typename Type, SizeType SizeT>
+inline Mat<Type, SizeT> MatLU<Type, SizeT>::Solve(MatView<const Type, SizeT> b) const
+{
+    Mat<Type, SizeT> x(b);
+    SolveInPlace(x);
+    return x;
+}
+
+template <typename Type, SizeType SizeT>
+inline Mat<Type, SizeT> MatLU<Type, SizeT>::Inverse() const
+{
+    const size_t n = Size();
+    Mat<Type, SizeT> x{SizeT(n), SizeT(n)};
+    for (size_t i = 0; i < n; ++i)
+    {
+        x.data()[i * n + i] = Type(1);
+    }
+    SolveInPlace(x);
+    return x;
+}
+
+//one shot helpers, factor once with MatLU to reuse it across right hand sides
+template <MatViewable M>
+inline MatLU<typename M::type, typename M::storage_type> LU(const M &a) { return MatLU<typename M::type, typename M::storage_type>(mat_const_view_t<M>(a)); }
+template <MatViewable M, MatViewable B>
+inline Mat<typename M::type, typename M::storage_type> Solve(const M &a, const B &b) { return LU(a).Solve(mat_const_view_t<B>(b)); }
+template <MatViewable M>
+inline Mat<typename M::type, typename M::storage_type> Inverse(const M &a) { return LU(a).Inverse(); }
+template <MatViewable M>
+inline typename M::type Determinant(const M &a) { return LU(a).Determinant(); }
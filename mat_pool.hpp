@@ -0,0 +1,361 @@
+#pragma once
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+#include <algorithm>
+#include "utils.hpp"
+#include "mat.hpp"
+
+//opt in pooled storage for Mat temporaries, Mat<T, SizeT, PoolAllocator<T>> (PoolMat<T>) takes its storage from a per thread cache
+//and gives it back there, freed blocks are kept in size classes four per power of two, so a buffer serves any later one
+//up to 25% smaller without locking, touching the global heap or faulting in fresh pages
+//MatArena scopes bump allocation on the calling thread for per request lifetimes
+
+//larger blocks go straight to the heap
+#ifndef MAT_POOL_MAX_BYTES
+#define MAT_POOL_MAX_BYTES (size_t(1) << 26)
+#endif
+
+//bytes each thread keeps cached per alignment, past it freed blocks go back to the heap
+#ifndef MAT_POOL_CACHE_BYTES
+#define MAT_POOL_CACHE_BYTES (size_t(1) << 28)
+#endif
+
+//counters of the calling thread, frees count on the thread that frees, so a thread freeing others' blocks can read negative live bytes
+struct MatPoolStats
+{
+    uint64_t allocations = 0;
+    uint64_t hits = 0; //allocations served from the cache or an arena instead of the heap
+    int64_t liveBytes = 0, peakLiveBytes = 0; //handed out by the pool, arena chunks included
+    size_t cachedBytes = 0, peakCachedBytes = 0;
+    size_t arenaBytes = 0, peakArenaBytes = 0; //reserved by live arenas
+};
+
+inline MatPoolStats &MatPoolLocalStats() noexcept
+{
+    static thread_local MatPoolStats stats;
+    return stats;
+}
+
+inline MatPoolStats MatPoolThreadStats() noexcept { return MatPoolLocalStats(); }
+
+//peaks restart from the current values, e.g. at the start of each request
+inline void MatPoolResetPeaks() noexcept
+{
+    MatPoolStats &s = MatPoolLocalStats();
+    s.peakLiveBytes = s.liveBytes;
+    s.peakCachedBytes = s.cachedBytes;
+    s.peakArenaBytes = s.arenaBytes;
+}
+
+struct MatPoolClass
+{
+    size_t index, bytes;
+};
+
+//64 bytes, then 4 classes per doubling: 80, 96, 112, 128, 160, 192, ...
+constexpr MatPoolClass MatPoolClassOf(size_t bytes) noexcept
+{
+    if (bytes <= 64)
+    {
+        return {0, 64};
+    }
+    const size_t e = std::bit_width(bytes - 1) - 1; //2^e < bytes <= 2^(e + 1)
+    const size_t quarter = size_t(1) << (e - 2);
+    const size_t k = (bytes - 1 - (size_t(1) << e)) / quarter;
+    return {1 + (e - 6) * 4 + k, (size_t(1) << e) + (k + 1) * quarter};
+}
+
+//the free lists of one thread for Align aligned blocks, freed blocks link through their first bytes
+template <size_t Align>
+class MatPoolCache
+{
+private:
+    struct FreeBlock
+    {
+        FreeBlock *next;
+    };
+
+    static constexpr size_t align = Align < alignof(FreeBlock) ? alignof(FreeBlock) : Align;
+    static constexpr size_t classes = MatPoolClassOf(MAT_POOL_MAX_BYTES).index + 1;
+
+    FreeBlock *heads[classes] = {};
+    static inline thread_local bool down = false; //set once this thread's cache is destroyed, later frees go to the heap
+
+    static MatPoolCache &Local() noexcept
+    {
+        static thread_local MatPoolCache cache;
+        return cache;
+    }
+
+    static void Track(int64_t live) noexcept
+    {
+        MatPoolStats &s = MatPoolLocalStats();
+        s.liveBytes += live;
+        s.peakLiveBytes = std::max(s.peakLiveBytes, s.liveBytes);
+    }
+
+    MatPoolCache() = default;
+
+public:
+    MatPoolCache(const MatPoolCache &) = delete;
+    MatPoolCache &operator=(const MatPoolCache &) = delete;
+
+    static void *Allocate(size_t bytes)
+    {
+        MatPoolStats &s = MatPoolLocalStats();
+        ++s.allocations;
+        if (bytes > MAT_POOL_MAX_BYTES)
+        {
+            void *p = ::operator new(bytes, std::align_val_t{align});
+            Track(int64_t(bytes));
+            return p;
+        }
+        const MatPoolClass c = MatPoolClassOf(bytes);
+        if (down)
+        {
+            //still the class size, the block may be freed into a live thread's cache and serve any request of its class there
+            void *p = ::operator new(c.bytes, std::align_val_t{align});
+            Track(int64_t(c.bytes));
+            return p;
+        }
+        MatPoolCache &cache = Local();
+        void *p;
+        if (FreeBlock *b = cache.heads[c.index])
+        {
+            cache.heads[c.index] = b->next;
+            s.cachedBytes -= c.bytes;
+            ++s.hits;
+            p = b;
+        }
+        else
+        {
+            p = ::operator new(c.bytes, std::align_val_t{align});
+        }
+        Track(int64_t(c.bytes));
+        return p;
+    }
+
+    static void Deallocate(void *p, size_t bytes) noexcept
+    {
+        MatPoolStats &s = MatPoolLocalStats();
+        if (bytes > MAT_POOL_MAX_BYTES)
+        {
+            ::operator delete(p, std::align_val_t{align});
+            Track(-int64_t(bytes));
+            return;
+        }
+        const MatPoolClass c = MatPoolClassOf(bytes);
+        Track(-int64_t(c.bytes));
+        if (down || s.cachedBytes + c.bytes > MAT_POOL_CACHE_BYTES)
+        {
+            ::operator delete(p, std::align_val_t{align});
+            return;
+        }
+        MatPoolCache &cache = Local();
+        FreeBlock *b = static_cast<FreeBlock *>(p);
+        b->next = cache.heads[c.index];
+        cache.heads[c.index] = b;
+        s.cachedBytes += c.bytes;
+        s.peakCachedBytes = std::max(s.peakCachedBytes, s.cachedBytes);
+    }
+
+    //returns every cached block of the calling thread to the heap
+    static void Trim() noexcept
+    {
+        if (!down)
+        {
+            Local().Release();
+        }
+    }
+
+    void Release() noexcept
+    {
+        MatPoolStats &s = MatPoolLocalStats();
+        for (size_t i = 0; i < classes; ++i)
+        {
+            while (FreeBlock *b = heads[i])
+            {
+                heads[i] = b->next;
+                ::operator delete(b, std::align_val_t{align});
+            }
+        }
+        s.cachedBytes = 0;
+    }
+
+    ~MatPoolCache()
+    {
+        Release();
+        down = true;
+    }
+};
+
+template <size_t Align = 64>
+inline void MatPoolTrim() noexcept { MatPoolCache<Align>::Trim(); }
+
+//scoped bump allocation for PoolAllocator on the constructing thread, arenas nest and must be destroyed on that thread in reverse order
+//storage allocated while an arena is the innermost one must be freed on that thread before the arena ends, freeing the most recent block
+//rewinds the bump pointer so short lived temporaries reuse the same bytes, the arena's chunks come from and go back to the pool
+//frees only search the calling thread's arenas, so no lock is taken: a block freed on another thread would join that thread's cache
+//while the arena still owns it, the arena's live count then never drops to zero and its end asserts
+class MatArena
+{
+private:
+    struct Chunk
+    {
+        char *base;
+        size_t bytes;
+    };
+
+    std::vector<Chunk> chunks;
+    char *top = nullptr, *end = nullptr;
+    size_t next;
+    size_t live = 0; //blocks not yet freed
+    MatArena *prev;
+
+    static MatArena *&Current() noexcept
+    {
+        static thread_local MatArena *current = nullptr;
+        return current;
+    }
+
+    void Grow(size_t bytes, size_t align)
+    {
+        const size_t size = std::max(next, bytes + align);
+        char *base = static_cast<char *>(MatPoolCache<64>::Allocate(size));
+        chunks.push_back({base, size});
+        top = base;
+        end = base + size;
+        next = size * 2;
+        MatPoolStats &s = MatPoolLocalStats();
+        s.arenaBytes += size;
+        s.peakArenaBytes = std::max(s.peakArenaBytes, s.arenaBytes);
+    }
+
+public:
+    explicit MatArena(size_t initialBytes = size_t(1) << 20) : next(std::max<size_t>(initialBytes, 4096)), prev(Current())
+    {
+        Current() = this;
+    }
+    MatArena(const MatArena &) = delete;
+    MatArena &operator=(const MatArena &) = delete;
+
+    ~MatArena()
+    {
+        assert(!live && "MatArena: storage allocated in the arena outlived it or was freed on another thread");
+        assert(Current() == this && "MatArena: arenas must end in reverse order");
+        Current() = prev;
+        MatPoolStats &s = MatPoolLocalStats();
+        for (const Chunk &c : chunks)
+        {
+            MatPoolCache<64>::Deallocate(c.base, c.bytes);
+            s.arenaBytes -= c.bytes;
+        }
+    }
+
+    //innermost arena of the calling thread, nullptr outside of any
+    static MatArena *Active() noexcept { return Current(); }
+    MatArena *Outer() const noexcept { return prev; }
+
+    void *Allocate(size_t bytes, size_t align)
+    {
+        char *p = reinterpret_cast<char *>((reinterpret_cast<uintptr_t>(top) + align - 1) & ~uintptr_t(align - 1));
+        if (!top || size_t(end - p) < bytes)
+        {
+            Grow(bytes, align);
+            p = reinterpret_cast<char *>((reinterpret_cast<uintptr_t>(top) + align - 1) & ~uintptr_t(align - 1));
+        }
+        top = p + bytes;
+        ++live;
+        MatPoolStats &s = MatPoolLocalStats();
+        ++s.allocations;
+        ++s.hits;
+        return p;
+    }
+
+    bool Owns(const void *p) const noexcept
+    {
+        const char *c = static_cast<const char *>(p);
+        for (const Chunk &k : chunks)
+        {
+            if (c >= k.base && c < k.base + k.bytes)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void Deallocate(void *p, size_t bytes) noexcept
+    {
+        if (static_cast<char *>(p) + bytes == top)
+        {
+            top = static_cast<char *>(p);
+        }
+        --live;
+    }
+
+    //frees p if an arena of the calling thread owns it, returns false for blocks of no arena
+    static bool DeallocateOwned(void *p, size_t bytes) noexcept
+    {
+        for (MatArena *a = Current(); a; a = a->prev)
+        {
+            if (a->Owns(p))
+            {
+                a->Deallocate(p, bytes);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //bytes between the start of the current chunk and the bump pointer
+    size_t Used() const noexcept { return chunks.empty() ? 0 : size_t(top - chunks.back().base); }
+};
+
+//std conforming allocator over MatPoolCache and MatArena, a drop in for AlignedAllocator
+//pooled blocks may be freed on any thread and then join that thread's cache, arena blocks must be freed on their arena's thread
+template <typename T, size_t Align = 64>
+struct PoolAllocator
+{
+    static_assert(Align >= alignof(T) && !(Align & (Align - 1)), "Align must be a power of two no smaller than alignof(T)");
+    using value_type = T;
+    template <typename U>
+    struct rebind
+    {
+        using other = PoolAllocator<U, Align>;
+    };
+
+    constexpr PoolAllocator() noexcept = default;
+    template <typename U>
+    constexpr PoolAllocator(const PoolAllocator<U, Align> &) noexcept {}
+
+    T *allocate(size_t n)
+    {
+        if (n > size_t(-1) / sizeof(T))
+            throw std::bad_array_new_length();
+        if (MatArena *a = MatArena::Active())
+        {
+            return static_cast<T *>(a->Allocate(n * sizeof(T), Align));
+        }
+        return static_cast<T *>(MatPoolCache<Align>::Allocate(n * sizeof(T)));
+    }
+    void deallocate(T *p, size_t n) noexcept
+    {
+        if (!MatArena::DeallocateOwned(p, n * sizeof(T)))
+        {
+            MatPoolCache<Align>::Deallocate(p, n * sizeof(T));
+        }
+    }
+
+    template <typename U>
+    constexpr bool operator==(const PoolAllocator<U, Align> &) const noexcept { return true; }
+};
+
+template <typename T, SizeType SizeT = size_t>
+using PoolMat = Mat<T, SizeT, PoolAllocator<T, 64>>;
+using pfMat = PoolMat<float>;
+using pdMat = PoolMat<double>;
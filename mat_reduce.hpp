@@ -0,0 +1,710 @@
+#pragma once
+#include <cstddef>
+#include <cmath>
+#include <algorithm>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "mat.hpp"
+#include "gemm.hpp"
+#include "tpool.hpp"
+
+//whole matrix, per row and per column reductions over Mat and MatView
+//inputs are split the same way whatever the thread count, so results are identical between runs and between serial and parallel execution
+
+enum class MatSummation
+{
+    Naive,    //one accumulator per SIMD lane, error grows with n / lanes
+    Pairwise, //recursive halving down to short lane blocks, error grows with log n at close to Naive speed
+    Kahan,    //compensated lanes, error independent of n for about 4x the adds, needs IEEE semantics (no -ffast-math)
+};
+
+//elements reduced as one task into one partial result, small enough that ArgMax's second pass hits cache
+#ifndef MAT_REDUCE_CHUNK
+#define MAT_REDUCE_CHUNK (size_t(1) << 14)
+#endif
+
+template <typename T>
+inline constexpr size_t mat_reduce_lanes = 64 / sizeof(T) < 4 ? 4 : 64 / sizeof(T);
+
+//columns reduced together, 4KB of accumulators stays in L1 while rows stream past
+template <typename T>
+inline constexpr size_t mat_reduce_col_block = 4096 / sizeof(T) < 64 ? 64 : 4096 / sizeof(T);
+
+//mean and norm of integral matrices are computed in double
+template <typename T>
+using mat_real_t = std::conditional_t<std::is_floating_point_v<T>, T, double>;
+
+template <typename M>
+using mat_const_view_t = MatView<const typename M::type, typename M::storage_type>;
+
+//Mat, MatView and anything else convertible to a read only view
+template <typename M>
+concept MatViewable = requires(const M &m) { mat_const_view_t<M>(m); };
+
+template <typename T>
+struct MatExtremum
+{
+    T value;
+    size_t x, y;
+};
+
+template <MatSummation Mode, typename A>
+ALWAYS_INLINE void MatSumStep(A &acc, A &comp, A v) noexcept
+{
+    if constexpr (Mode == MatSummation::Kahan && std::is_floating_point_v<A>)
+    {
+        const A y = v - comp;
+        const A t = acc + y;
+        comp = (t - acc) - y;
+        acc = t;
+    }
+    else
+    {
+        acc += v;
+    }
+}
+
+template <bool Greater, typename T>
+ALWAYS_INLINE T MatPick(T a, T b) noexcept
+{
+    if constexpr (Greater)
+        return a > b ? a : b;
+    else
+        return a < b ? a : b;
+}
+
+//sum of f(p[i]) over [0, n), lane j accumulates every L-th element so the loop vectorizes without reassociating
+template <MatSummation Mode, typename T, typename F, typename A = std::invoke_result_t<F, T>>
+inline A MatSumSpan(const T *p, size_t n, F f) noexcept
+{
+    constexpr size_t L = mat_reduce_lanes<A>;
+    if constexpr (Mode == MatSummation::Pairwise)
+    {
+        if (n > L * 16)
+        {
+            const size_t half = n / 2 / L * L;
+            return MatSumSpan<Mode>(p, half, f) + MatSumSpan<Mode>(p + half, n - half, f);
+        }
+    }
+    A acc[L] = {}, comp[L] = {};
+    size_t i = 0;
+    for (; i + L <= n; i += L)
+    {
+        for (size_t j = 0; j < L; ++j)
+        {
+            MatSumStep<Mode>(acc[j], comp[j], f(p[i + j]));
+        }
+    }
+    for (size_t j = 0; i < n; ++i, ++j)
+    {
+        MatSumStep<Mode>(acc[j], comp[j], f(p[i]));
+    }
+    for (size_t j = 0; j < L; ++j)
+    {
+        acc[j] -= comp[j];
+    }
+    for (size_t s = L / 2; s; s /= 2)
+    {
+        for (size_t j = 0; j < s; ++j)
+        {
+            acc[j] += acc[j + s];
+        }
+    }
+    return acc[0];
+}
+
+//folds count partial results spaced stride apart, always in the same order
+template <MatSummation Mode, typename A>
+inline A MatSumPartials(const A *p, size_t count, size_t stride = 1) noexcept
+{
+    if constexpr (Mode == MatSummation::Pairwise)
+    {
+        if (count > 8)
+        {
+            const size_t half = count / 2;
+            return MatSumPartials<Mode>(p, half, stride) + MatSumPartials<Mode>(p + half * stride, count - half, stride);
+        }
+    }
+    A acc{}, comp{};
+    for (size_t i = 0; i < count; ++i)
+    {
+        MatSumStep<Mode>(acc, comp, p[i * stride]);
+    }
+    return acc - comp;
+}
+
+//p[0, n) must not be empty, NaNs give an unspecified result
+template <bool Greater, typename T>
+inline T MatExtremeSpan(const T *p, size_t n) noexcept
+{
+    constexpr size_t L = mat_reduce_lanes<T>;
+    if (n < L)
+    {
+        T m = p[0];
+        for (size_t i = 1; i < n; ++i)
+        {
+            m = MatPick<Greater>(p[i], m);
+        }
+        return m;
+    }
+    T acc[L];
+    std::copy_n(p, L, acc);
+    size_t i = L;
+    for (; i + L <= n; i += L)
+    {
+        for (size_t j = 0; j < L; ++j)
+        {
+            acc[j] = MatPick<Greater>(p[i + j], acc[j]);
+        }
+    }
+    for (size_t j = 0; i < n; ++i, ++j)
+    {
+        acc[j] = MatPick<Greater>(p[i], acc[j]);
+    }
+    for (size_t s = L / 2; s; s /= 2)
+    {
+        for (size_t j = 0; j < s; ++j)
+        {
+            acc[j] = MatPick<Greater>(acc[j + s], acc[j]);
+        }
+    }
+    return acc[0];
+}
+
+//splits row major storage into chunks of about MAT_REDUCE_CHUNK elements in storage order, dense storage is one long row
+template <typename T>
+struct MatReduceLayout
+{
+    const T *base;
+    size_t width, height, ld, viewWidth, pieces, rows;
+    bool dense;
+
+    MatReduceLayout(const T *p, size_t n) noexcept : base(p), width(n), height(n ? 1 : 0), ld(n), viewWidth(n), dense(true) { Split(); }
+    template <SizeType SizeT>
+    explicit MatReduceLayout(MatView<const T, SizeT> v) noexcept : base(v.data()), ld(v.Stride()), viewWidth(v.SizeX()), dense(v.Stride() == v.SizeX() || v.SizeY() <= 1)
+    {
+        width = dense ? size_t(v.SizeX()) * v.SizeY() : v.SizeX();
+        height = !width ? 0 : dense ? 1 : v.SizeY();
+        Split();
+    }
+
+    void Split() noexcept
+    {
+        pieces = std::max<size_t>(1, (width + MAT_REDUCE_CHUNK - 1) / MAT_REDUCE_CHUNK);
+        rows = pieces > 1 ? 1 : std::max<size_t>(1, MAT_REDUCE_CHUNK / std::max<size_t>(width, 1));
+    }
+
+    size_t Elements() const noexcept { return width * height; }
+    size_t Chunks() const noexcept { return (height + rows - 1) / rows * pieces; }
+
+    //calls f(p, len, x, y) for each row segment of chunk c, (x, y) is the storage position of p[0]
+    template <typename F>
+    void Visit(size_t c, F &&f) const
+    {
+        const size_t x0 = c % pieces * MAT_REDUCE_CHUNK, y0 = c / pieces * rows;
+        const size_t len = std::min(MAT_REDUCE_CHUNK, width - x0), y1 = std::min(height, y0 + rows);
+        for (size_t y = y0; y < y1; ++y)
+        {
+            f(base + y * ld + x0, len, x0, y);
+        }
+    }
+
+    std::pair<size_t, size_t> Coord(size_t x, size_t y) const noexcept { return dense ? std::pair<size_t, size_t>(x % viewWidth, x / viewWidth) : std::pair<size_t, size_t>(x, y); }
+};
+
+//body(c) for every chunk, across ThreadPool::Global() once there are MAT_PARALLEL_ELEMENTS elements
+//runs of chunks go through SimdDispatch, so body should only call leaf kernels
+template <typename F>
+inline void MatReduceChunks(size_t chunks, size_t elements, F &&body)
+{
+    const auto run = [&body](size_t first, size_t last)
+    {
+        SimdDispatch([&](auto)
+                     {
+                         for (size_t c = first; c < last; ++c)
+                         {
+                             body(c);
+                         }
+                     });
+    };
+    if (chunks < 2 || elements < MAT_PARALLEL_ELEMENTS)
+    {
+        run(0, chunks);
+        return;
+    }
+    parallel_for(0, chunks, 1, run);
+}
+
+//one partial per chunk, on the stack unless the input is large
+template <typename A>
+class MatReducePartials
+{
+private:
+    A local[64];
+    std::vector<A> heap;
+    A *p;
+
+public:
+    explicit MatReducePartials(size_t n) : p(local)
+    {
+        if (n > 64)
+        {
+            heap.resize(n);
+            p = heap.data();
+        }
+    }
+    MatReducePartials(const MatReducePartials &) = delete;
+    MatReducePartials &operator=(const MatReducePartials &) = delete;
+
+    A *data() noexcept { return p; }
+    A &operator[](size_t i) noexcept { return p[i]; }
+};
+
+template <MatSummation Mode, typename T, typename F>
+inline auto MatSumLayout(const MatReduceLayout<T> &l, F f)
+{
+    using A = std::invoke_result_t<F, T>;
+    const size_t chunks = l.Chunks();
+    MatReducePartials<A> part(chunks);
+    MatReduceChunks(chunks, l.Elements(), [&](size_t c)
+                    {
+                        A acc{}, comp{};
+                        l.Visit(c, [&](const T *p, size_t n, size_t, size_t) { MatSumStep<Mode>(acc, comp, MatSumSpan<Mode>(p, n, f)); });
+                        part[c] = acc - comp;
+                    });
+    return MatSumPartials<Mode>(part.data(), chunks);
+}
+
+template <bool Greater, typename T>
+inline T MatExtremeLayout(const MatReduceLayout<T> &l)
+{
+    const size_t chunks = l.Chunks();
+    MatReducePartials<T> part(chunks);
+    MatReduceChunks(chunks, l.Elements(), [&](size_t c)
+                    {
+                        bool first = true;
+                        l.Visit(c, [&](const T *p, size_t n, size_t, size_t)
+                                {
+                                    const T m = MatExtremeSpan<Greater>(p, n);
+                                    part[c] = first ? m : MatPick<Greater>(m, part[c]);
+                                    first = false;
+                                });
+                    });
+    T best = part[0];
+    for (size_t c = 1; c < chunks; ++c)
+    {
+        best = MatPick<Greater>(part[c], best);
+    }
+    return best;
+}
+
+//first occurrence in row major storage order, the second pass over a chunk reads it from cache
+template <bool Greater, typename T>
+inline MatExtremum<T> MatArgExtremeLayout(const MatReduceLayout<T> &l)
+{
+    const size_t chunks = l.Chunks();
+    MatReducePartials<MatExtremum<T>> part(chunks);
+    MatReduceChunks(chunks, l.Elements(), [&](size_t c)
+                    {
+                        bool first = true, found = false;
+                        T best{};
+                        l.Visit(c, [&](const T *p, size_t n, size_t x, size_t y)
+                                {
+                                    const T m = MatExtremeSpan<Greater>(p, n);
+                                    best = first ? m : MatPick<Greater>(m, best);
+                                    if (first)
+                                        part[c] = {best, x, y}; //kept if best is a NaN that never compares equal
+                                    first = false;
+                                });
+                        l.Visit(c, [&](const T *p, size_t n, size_t x, size_t y)
+                                {
+                                    const T *it = found ? p + n : std::find(p, p + n, best);
+                                    if (it != p + n)
+                                    {
+                                        part[c] = {best, x + size_t(it - p), y};
+                                        found = true;
+                                    }
+                                });
+                    });
+    MatExtremum<T> best = part[0];
+    for (size_t c = 1; c < chunks; ++c)
+    {
+        if (Greater ? part[c].value > best.value : part[c].value < best.value)
+        {
+            best = part[c];
+        }
+    }
+    std::tie(best.x, best.y) = l.Coord(best.x, best.y);
+    return best;
+}
+
+//out[y] = row(p, w) for each storage row, rows go to the pool together unless each one is long enough to split itself
+template <typename T, typename R, typename Row>
+inline void MatForRows(const T *base, size_t w, size_t h, size_t ld, R *out, Row row)
+{
+    const auto rows = [&](size_t first, size_t last)
+    {
+        for (size_t y = first; y < last; ++y)
+        {
+            out[y] = row(base + y * ld, w);
+        }
+    };
+    if (w >= MAT_REDUCE_CHUNK || w * h < MAT_PARALLEL_ELEMENTS)
+        rows(0, h);
+    else
+        parallel_for(0, h, std::max<size_t>(1, MAT_REDUCE_CHUNK / std::max<size_t>(w, 1)), rows);
+}
+
+//folds the columns of w x h row major storage into out[0, w)
+//leaf(p, bw, rows, ld, dst) folds a rows x bw block into dst, combine(partials, count, stride) folds the results of row chunks
+//columns are handled in L1 sized blocks while whole rows stream past, narrow matrices are additionally split into at most 64 row chunks
+template <typename A, typename T, typename Leaf, typename Combine>
+inline void MatColReduce(const T *base, size_t w, size_t h, size_t ld, A *out, Leaf leaf, Combine combine)
+{
+    if (!w)
+    {
+        return;
+    }
+    constexpr size_t block = mat_reduce_col_block<A>;
+    const size_t blocks = (w + block - 1) / block, n = w * h;
+    const size_t target = std::max<size_t>(1, std::min(64 / blocks, n / MAT_PARALLEL_ELEMENTS));
+    const size_t rows = std::max<size_t>(1, (h + target - 1) / target);
+    const size_t rowChunks = std::max<size_t>(1, (h + rows - 1) / rows);
+    std::vector<A> partials(rowChunks > 1 ? rowChunks * w : 0);
+    MatReduceChunks(rowChunks * blocks, n, [&](size_t t)
+                    {
+                        const size_t rc = t / blocks, x0 = t % blocks * block, bw = std::min(block, w - x0);
+                        const size_t y0 = rc * rows, y1 = std::min(h, y0 + rows);
+                        leaf(base + y0 * ld + x0, bw, y1 - y0, ld, rowChunks > 1 ? partials.data() + rc * w + x0 : out + x0);
+                    });
+    if (rowChunks > 1)
+    {
+        for (size_t x = 0; x < w; ++x)
+        {
+            out[x] = combine(partials.data() + x, rowChunks, w);
+        }
+    }
+}
+
+//column sums of a rows x bw block, scratch holds bw per pairwise level (or bw for Kahan's compensation)
+template <MatSummation Mode, typename T, typename A, typename F>
+inline void MatColSumBlock(const T *p, size_t bw, size_t rows, size_t ld, A *dst, A *scratch, F f) noexcept
+{
+    if constexpr (Mode == MatSummation::Pairwise)
+    {
+        if (rows > 32)
+        {
+            const size_t top = rows / 2;
+            MatColSumBlock<Mode>(p, bw, top, ld, dst, scratch + bw, f);
+            MatColSumBlock<Mode>(p + top * ld, bw, rows - top, ld, scratch, scratch + bw, f);
+            for (size_t x = 0; x < bw; ++x)
+            {
+                dst[x] += scratch[x];
+            }
+            return;
+        }
+    }
+    A *comp = scratch;
+    std::fill_n(dst, bw, A{});
+    if constexpr (Mode == MatSummation::Kahan)
+    {
+        std::fill_n(comp, bw, A{});
+    }
+    for (size_t y = 0; y < rows; ++y)
+    {
+        const T *row = p + y * ld;
+        for (size_t x = 0; x < bw; ++x)
+        {
+            MatSumStep<Mode>(dst[x], comp[x], f(row[x]));
+        }
+    }
+    if constexpr (Mode == MatSummation::Kahan)
+    {
+        for (size_t x = 0; x < bw; ++x)
+        {
+            dst[x] -= comp[x];
+        }
+    }
+}
+
+template <MatSummation Mode, typename T, typename A, typename F>
+inline void MatRowSumsStorage(const T *base, size_t w, size_t h, size_t ld, A *out, F f)
+{
+    MatForRows(base, w, h, ld, out, [f](const T *p, size_t n) { return MatSumLayout<Mode>(MatReduceLayout<T>(p, n), f); });
+}
+
+template <MatSummation Mode, typename T, typename A, typename F>
+inline void MatColSumsStorage(const T *base, size_t w, size_t h, size_t ld, A *out, F f)
+{
+    MatColReduce(
+        base, w, h, ld, out,
+        [f](const T *p, size_t bw, size_t rows, size_t stride, A *dst)
+        {
+            thread_local GemmBuffer<A> scratch;
+            size_t levels = 1;
+            for (size_t r = rows; Mode == MatSummation::Pairwise && r > 32; r = (r + 1) / 2)
+            {
+                ++levels;
+            }
+            MatColSumBlock<Mode>(p, bw, rows, stride, dst, scratch.Get(levels * bw), f);
+        },
+        [](const A *partials, size_t count, size_t stride) { return MatSumPartials<Mode>(partials, count, stride); });
+}
+
+template <bool Greater, typename T>
+inline void MatRowExtremeStorage(const T *base, size_t w, size_t h, size_t ld, T *out)
+{
+    MatForRows(base, w, h, ld, out, [](const T *p, size_t n) { return MatExtremeLayout<Greater>(MatReduceLayout<T>(p, n)); });
+}
+
+template <bool Greater, typename T>
+inline void MatColExtremeStorage(const T *base, size_t w, size_t h, size_t ld, T *out)
+{
+    MatColReduce(
+        base, w, h, ld, out,
+        [](const T *p, size_t bw, size_t rows, size_t stride, T *dst)
+        {
+            std::copy_n(p, bw, dst);
+            for (size_t y = 1; y < rows; ++y)
+            {
+                const T *row = p + y * stride;
+                for (size_t x = 0; x < bw; ++x)
+                {
+                    dst[x] = MatPick<Greater>(row[x], dst[x]);
+                }
+            }
+        },
+        [](const T *partials, size_t count, size_t stride)
+        {
+            T m = partials[0];
+            for (size_t i = 1; i < count; ++i)
+            {
+                m = MatPick<Greater>(partials[i * stride], m);
+            }
+            return m;
+        });
+}
+
+//runs f with the summation mode as a compile time constant
+template <typename F>
+ALWAYS_INLINE decltype(auto) MatWithSummation(MatSummation mode, F &&f)
+{
+    switch (mode)
+    {
+    case MatSummation::Naive:
+        return f(std::integral_constant<MatSummation, MatSummation::Naive>{});
+    case MatSummation::Kahan:
+        return f(std::integral_constant<MatSummation, MatSummation::Kahan>{});
+    default:
+        return f(std::integral_constant<MatSummation, MatSummation::Pairwise>{});
+    }
+}
+
+//per row (Cols = false) or per column sums of f(element), a transposed view's rows are columns of its storage
+template <bool Cols, typename T, SizeType SizeT, typename A, typename F>
+inline void MatSumsInto(MatView<const T, SizeT> v, A *out, MatSummation mode, F f)
+{
+    MAT_STATS_SCOPE(MatOp::Reduce, uint64_t(v.SizeX()) * v.SizeY());
+    const MatView<const T, SizeT> s = v.IsTransposed() ? v.TransposedView() : v;
+    MatWithSummation(mode, [&](auto m)
+                     {
+                         if (Cols != v.IsTransposed())
+                             MatColSumsStorage<decltype(m)::value>(s.data(), s.SizeX(), s.SizeY(), s.Stride(), out, f);
+                         else
+                             MatRowSumsStorage<decltype(m)::value>(s.data(), s.SizeX(), s.SizeY(), s.Stride(), out, f);
+                     });
+}
+
+template <bool Cols, bool Greater, typename T, SizeType SizeT>
+inline Mat<T, SizeT> MatExtremes(MatView<const T, SizeT> v, const char *who)
+{
+    if (!v.SizeX() || !v.SizeY())
+        throw std::invalid_argument(std::string(who) + ": empty matrix");
+    MAT_STATS_SCOPE(MatOp::Reduce, uint64_t(v.SizeX()) * v.SizeY());
+    Mat<T, SizeT> res(Cols ? v.SizeX() : SizeT(1), Cols ? SizeT(1) : v.SizeY(), mat_uninit);
+    const MatView<const T, SizeT> s = v.IsTransposed() ? v.TransposedView() : v;
+    if (Cols != v.IsTransposed())
+        MatColExtremeStorage<Greater>(s.data(), s.SizeX(), s.SizeY(), s.Stride(), res.data());
+    else
+        MatRowExtremeStorage<Greater>(s.data(), s.SizeX(), s.SizeY(), s.Stride(), res.data());
+    return res;
+}
+
+template <bool Greater, typename T, SizeType SizeT>
+inline MatExtremum<T> MatArgExtreme(MatView<const T, SizeT> v, const char *who)
+{
+    if (!v.SizeX() || !v.SizeY())
+        throw std::invalid_argument(std::string(who) + ": empty matrix");
+    MAT_STATS_SCOPE(MatOp::Reduce, uint64_t(v.SizeX()) * v.SizeY());
+    if (!v.IsTransposed())
+        return MatArgExtremeLayout<Greater>(MatReduceLayout<T>(v));
+    //first in the storage order of the transpose, not row major order of v
+    MatExtremum<T> res = MatArgExtremeLayout<Greater>(MatReduceLayout<T>(v.TransposedView()));
+    std::swap(res.x, res.y);
+    return res;
+}
+
+template <typename T>
+struct MatSquare
+{
+    ALWAYS_INLINE mat_real_t<T> operator()(T v) const noexcept { return mat_real_t<T>(v) * mat_real_t<T>(v); }
+};
+template <typename T, typename R = T>
+struct MatAs
+{
+    ALWAYS_INLINE R operator()(T v) const noexcept { return R(v); }
+};
+
+template <MatViewable M>
+inline typename M::type Sum(const M &m, MatSummation mode = MatSummation::Pairwise)
+{
+    using T = typename M::type;
+    const mat_const_view_t<M> v(m);
+    MAT_STATS_SCOPE(MatOp::Reduce, uint64_t(v.SizeX()) * v.SizeY());
+    const MatReduceLayout<T> l(v.IsTransposed() ? v.TransposedView() : v);
+    return MatWithSummation(mode, [&](auto s) { return MatSumLayout<decltype(s)::value>(l, MatAs<T>{}); });
+}
+
+//NaN for an empty matrix
+template <MatViewable M>
+inline mat_real_t<typename M::type> Mean(const M &m, MatSummation mode = MatSummation::Pairwise)
+{
+    using T = typename M::type;
+    using R = mat_real_t<T>;
+    const mat_const_view_t<M> v(m);
+    MAT_STATS_SCOPE(MatOp::Reduce, uint64_t(v.SizeX()) * v.SizeY());
+    const MatReduceLayout<T> l(v.IsTransposed() ? v.TransposedView() : v);
+    return MatWithSummation(mode, [&](auto s) { return MatSumLayout<decltype(s)::value>(l, MatAs<T, R>{}); }) / R(l.Elements());
+}
+
+//Frobenius norm, the L2 norm of a single row or column
+template <MatViewable M>
+inline mat_real_t<typename M::type> Norm(const M &m, MatSummation mode = MatSummation::Pairwise)
+{
+    using T = typename M::type;
+    const mat_const_view_t<M> v(m);
+    MAT_STATS_SCOPE(MatOp::Reduce, 2 * uint64_t(v.SizeX()) * v.SizeY());
+    const MatReduceLayout<T> l(v.IsTransposed() ? v.TransposedView() : v);
+    return std::sqrt(MatWithSummation(mode, [&](auto s) { return MatSumLayout<decltype(s)::value>(l, MatSquare<T>{}); }));
+}
+
+//throw std::invalid_argument for an empty matrix, NaNs give an unspecified result
+template <MatViewable M>
+inline typename M::type Min(const M &m)
+{
+    const mat_const_view_t<M> v(m);
+    if (!v.SizeX() || !v.SizeY())
+        throw std::invalid_argument("Min: empty matrix");
+    MAT_STATS_SCOPE(MatOp::Reduce, uint64_t(v.SizeX()) * v.SizeY());
+    return MatExtremeLayout<false>(MatReduceLayout<typename M::type>(v.IsTransposed() ? v.TransposedView() : v));
+}
+template <MatViewable M>
+inline typename M::type Max(const M &m)
+{
+    const mat_const_view_t<M> v(m);
+    if (!v.SizeX() || !v.SizeY())
+        throw std::invalid_argument("Max: empty matrix");
+    MAT_STATS_SCOPE(MatOp::Reduce, uint64_t(v.SizeX()) * v.SizeY());
+    return MatExtremeLayout<true>(MatReduceLayout<typename M::type>(v.IsTransposed() ? v.TransposedView() : v));
+}
+//position of the first occurrence in row major order (column major for transposed views, which follow their storage)
+template <MatViewable M>
+inline MatExtremum<typename M::type> ArgMin(const M &m) { return MatArgExtreme<false>(mat_const_view_t<M>(m), "ArgMin"); }
+template <MatViewable M>
+inline MatExtremum<typename M::type> ArgMax(const M &m) { return MatArgExtreme<true>(mat_const_view_t<M>(m), "ArgMax"); }
+
+//out.size() must be SizeY() for row reductions and SizeX() for column reductions
+template <MatViewable M>
+inline void RowSumsInto(const M &m, std::span<typename M::type> out, MatSummation mode = MatSummation::Pairwise)
+{
+    const mat_const_view_t<M> v(m);
+    if (out.size() != v.SizeY())
+        throw std::invalid_argument("RowSumsInto: out must hold SizeY() elements");
+    MatSumsInto<false>(v, out.data(), mode, MatAs<typename M::type>{});
+}
+template <MatViewable M>
+inline void ColSumsInto(const M &m, std::span<typename M::type> out, MatSummation mode = MatSummation::Pairwise)
+{
+    const mat_const_view_t<M> v(m);
+    if (out.size() != v.SizeX())
+        throw std::invalid_argument("ColSumsInto: out must hold SizeX() elements");
+    MatSumsInto<true>(v, out.data(), mode, MatAs<typename M::type>{});
+}
+
+//row reductions return a 1 x SizeY() column, column reductions a SizeX() x 1 row
+template <MatViewable M>
+inline Mat<typename M::type, typename M::storage_type> RowSums(const M &m, MatSummation mode = MatSummation::Pairwise)
+{
+    const mat_const_view_t<M> v(m);
+    Mat<typename M::type, typename M::storage_type> res(1, v.SizeY(), mat_uninit);
+    MatSumsInto<false>(v, res.data(), mode, MatAs<typename M::type>{});
+    return res;
+}
+template <MatViewable M>
+inline Mat<typename M::type, typename M::storage_type> ColSums(const M &m, MatSummation mode = MatSummation::Pairwise)
+{
+    const mat_const_view_t<M> v(m);
+    Mat<typename M::type, typename M::storage_type> res(v.SizeX(), 1, mat_uninit);
+    MatSumsInto<true>(v, res.data(), mode, MatAs<typename M::type>{});
+    return res;
+}
+
+template <MatViewable M>
+inline Mat<mat_real_t<typename M::type>, typename M::storage_type> RowMeans(const M &m, MatSummation mode = MatSummation::Pairwise)
+{
+    using R = mat_real_t<typename M::type>;
+    const mat_const_view_t<M> v(m);
+    Mat<R, typename M::storage_type> res(1, v.SizeY(), mat_uninit);
+    MatSumsInto<false>(v, res.data(), mode, MatAs<typename M::type, R>{});
+    res /= R(v.SizeX());
+    return res;
+}
+template <MatViewable M>
+inline Mat<mat_real_t<typename M::type>, typename M::storage_type> ColMeans(const M &m, MatSummation mode = MatSummation::Pairwise)
+{
+    using R = mat_real_t<typename M::type>;
+    const mat_const_view_t<M> v(m);
+    Mat<R, typename M::storage_type> res(v.SizeX(), 1, mat_uninit);
+    MatSumsInto<true>(v, res.data(), mode, MatAs<typename M::type, R>{});
+    res /= R(v.SizeY());
+    return res;
+}
+
+template <MatViewable M>
+inline Mat<mat_real_t<typename M::type>, typename M::storage_type> RowNorms(const M &m, MatSummation mode = MatSummation::Pairwise)
+{
+    const mat_const_view_t<M> v(m);
+    Mat<mat_real_t<typename M::type>, typename M::storage_type> res(1, v.SizeY(), mat_uninit);
+    MatSumsInto<false>(v, res.data(), mode, MatSquare<typename M::type>{});
+    for (auto &x : res)
+    {
+        x = std::sqrt(x);
+    }
+    return res;
+}
+template <MatViewable M>
+inline Mat<mat_real_t<typename M::type>, typename M::storage_type> ColNorms(const M &m, MatSummation mode = MatSummation::Pairwise)
+{
+    const mat_const_view_t<M> v(m);
+    Mat<mat_real_t<typename M::type>, typename M::storage_type> res(v.SizeX(), 1, mat_uninit);
+    MatSumsInto<true>(v, res.data(), mode, MatSquare<typename M::type>{});
+    for (auto &x : res)
+    {
+        x = std::sqrt(x);
+    }
+    return res;
+}
+
+template <MatViewable M>
+inline Mat<typename M::type, typename M::storage_type> RowMin(const M &m) { return MatExtremes<false, false>(mat_const_view_t<M>(m), "RowMin"); }
+template <MatViewable M>
+inline Mat<typename M::type, typename M::storage_type> RowMax(const M &m) { return MatExtremes<false, true>(mat_const_view_t<M>(m), "RowMax"); }
+template <MatViewable M>
+inline Mat<typename M::type, typename M::storage_type> ColMin(const M &m) { return MatExtremes<true, false>(mat_const_view_t<M>(m), "ColMin"); }
+template <MatViewable M>
+inline Mat<typename M::type, typename M::storage_type> ColMax(const M &m) { return MatExtremes<true, true>(mat_const_view_t<M>(m), "ColMax"); }
@@ -0,0 +1,274 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include "utils.hpp"
+#ifdef MAT_STATS
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#endif
+
+//hot path instrumentation for Mat, compiled out unless MAT_STATS is defined before the first include
+//counters are thread local and only summed when a snapshot is taken, so enabled builds add a few plain loads and stores per
+//operation and no shared cache lines, disabled builds keep the API (snapshots read zero) but every hook expands to nothing
+
+enum class MatOp : uint8_t
+{
+    Dot,
+    Elementwise, //expression assignment and compound operators with a matrix operand
+    Scalar,      //compound operators with a scalar operand
+    Save,
+    Load,
+    Reduce,
+    Transpose,
+    Conv,        //2D convolution, both paths
+    Count,
+};
+
+inline constexpr const char *mat_op_names[size_t(MatOp::Count)] = {"Dot", "Elementwise", "Scalar", "Save", "Load", "Reduce", "Transpose", "Conv"};
+
+struct MatOpStats
+{
+    uint64_t calls = 0, flops = 0, nanoseconds = 0;
+};
+
+struct MatStats
+{
+    uint64_t allocations = 0, allocatedBytes = 0, frees = 0;
+    uint64_t copies = 0, copiedBytes = 0, moves = 0;
+    MatOpStats ops[size_t(MatOp::Count)];
+
+    const MatOpStats &operator[](MatOp op) const noexcept { return ops[size_t(op)]; }
+
+    MatStats &operator+=(const MatStats &s) noexcept
+    {
+        allocations += s.allocations;
+        allocatedBytes += s.allocatedBytes;
+        frees += s.frees;
+        copies += s.copies;
+        copiedBytes += s.copiedBytes;
+        moves += s.moves;
+        for (size_t i = 0; i < size_t(MatOp::Count); ++i)
+        {
+            ops[i].calls += s.ops[i].calls;
+            ops[i].flops += s.ops[i].flops;
+            ops[i].nanoseconds += s.ops[i].nanoseconds;
+        }
+        return *this;
+    }
+    //for the difference of two snapshots, e.g. the cost of one request
+    MatStats &operator-=(const MatStats &s) noexcept
+    {
+        allocations -= s.allocations;
+        allocatedBytes -= s.allocatedBytes;
+        frees -= s.frees;
+        copies -= s.copies;
+        copiedBytes -= s.copiedBytes;
+        moves -= s.moves;
+        for (size_t i = 0; i < size_t(MatOp::Count); ++i)
+        {
+            ops[i].calls -= s.ops[i].calls;
+            ops[i].flops -= s.ops[i].flops;
+            ops[i].nanoseconds -= s.ops[i].nanoseconds;
+        }
+        return *this;
+    }
+    friend MatStats operator-(MatStats a, const MatStats &b) noexcept { return a -= b; }
+
+    friend std::ostream &operator<<(std::ostream &os, const MatStats &s)
+    {
+        os << "allocations " << s.allocations << " (" << s.allocatedBytes << " bytes), frees " << s.frees
+           << ", copies " << s.copies << " (" << s.copiedBytes << " bytes), moves " << s.moves << '\n';
+        for (size_t i = 0; i < size_t(MatOp::Count); ++i)
+        {
+            const MatOpStats &o = s.ops[i];
+            if (o.calls)
+            {
+                os << mat_op_names[i] << ": " << o.calls << " calls, " << o.flops << " flops, " << o.nanoseconds << " ns";
+                if (o.nanoseconds)
+                    os << ", " << double(o.flops) / double(o.nanoseconds) << " GFLOPS";
+                os << '\n';
+            }
+        }
+        return os;
+    }
+};
+
+#ifdef MAT_STATS
+//per thread counter block, written only by its thread so plain load + store suffices, atomics only keep the
+//cross thread reads in snapshots well defined
+class MatStatsBlock
+{
+private:
+    enum : size_t
+    {
+        allocations,
+        allocatedBytes,
+        frees,
+        copies,
+        copiedBytes,
+        moves,
+        opBase,
+        counters = opBase + 3 * size_t(MatOp::Count),
+    };
+
+    std::atomic<uint64_t> c[counters] = {};
+    uint64_t baseline[counters] = {}; //values at the last reset, guarded by the registry mutex
+
+    ALWAYS_INLINE void Bump(size_t i, uint64_t v) noexcept { c[i].store(c[i].load(std::memory_order_relaxed) + v, std::memory_order_relaxed); }
+
+    struct Registry
+    {
+        std::mutex lock;
+        std::vector<MatStatsBlock *> live;
+        MatStats retired; //threads that have exited since the last reset
+    };
+
+public:
+    static Registry &Global()
+    {
+        static Registry reg;
+        return reg;
+    }
+
+    MatStatsBlock()
+    {
+        Registry &reg = Global();
+        std::lock_guard<std::mutex> guard(reg.lock);
+        reg.live.push_back(this);
+    }
+    MatStatsBlock(const MatStatsBlock &) = delete;
+    MatStatsBlock &operator=(const MatStatsBlock &) = delete;
+    ~MatStatsBlock()
+    {
+        Registry &reg = Global();
+        std::lock_guard<std::mutex> guard(reg.lock);
+        reg.retired += Read();
+        reg.live.erase(std::find(reg.live.begin(), reg.live.end(), this));
+    }
+
+    static MatStatsBlock &Local()
+    {
+        thread_local MatStatsBlock block;
+        return block;
+    }
+
+    ALWAYS_INLINE void Alloc(uint64_t bytes) noexcept
+    {
+        Bump(allocations, 1);
+        Bump(allocatedBytes, bytes);
+    }
+    ALWAYS_INLINE void Free() noexcept { Bump(frees, 1); }
+    ALWAYS_INLINE void Copy(uint64_t bytes) noexcept
+    {
+        Bump(copies, 1);
+        Bump(copiedBytes, bytes);
+    }
+    ALWAYS_INLINE void Move() noexcept { Bump(moves, 1); }
+    ALWAYS_INLINE void Record(MatOp op, uint64_t flops, uint64_t ns) noexcept
+    {
+        const size_t i = opBase + 3 * size_t(op);
+        Bump(i, 1);
+        Bump(i + 1, flops);
+        Bump(i + 2, ns);
+    }
+
+    //counts since the last reset, callers other than the owning thread must hold the registry mutex
+    MatStats Read() const noexcept
+    {
+        uint64_t v[counters];
+        for (size_t i = 0; i < counters; ++i)
+        {
+            v[i] = c[i].load(std::memory_order_relaxed) - baseline[i];
+        }
+        MatStats s;
+        s.allocations = v[allocations];
+        s.allocatedBytes = v[allocatedBytes];
+        s.frees = v[frees];
+        s.copies = v[copies];
+        s.copiedBytes = v[copiedBytes];
+        s.moves = v[moves];
+        for (size_t i = 0; i < size_t(MatOp::Count); ++i)
+        {
+            s.ops[i] = {v[opBase + 3 * i], v[opBase + 3 * i + 1], v[opBase + 3 * i + 2]};
+        }
+        return s;
+    }
+    void Reset() noexcept
+    {
+        for (size_t i = 0; i < counters; ++i)
+        {
+            baseline[i] = c[i].load(std::memory_order_relaxed);
+        }
+    }
+};
+
+//times the enclosing scope as one call of op on the calling thread, parallel work inside it counts as wall time
+class MatStatsScope
+{
+private:
+    MatOp op;
+    uint64_t flops;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    MatStatsScope(MatOp o, uint64_t f) noexcept : op(o), flops(f), start(std::chrono::steady_clock::now()) {}
+    MatStatsScope(const MatStatsScope &) = delete;
+    MatStatsScope &operator=(const MatStatsScope &) = delete;
+    ~MatStatsScope()
+    {
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        MatStatsBlock::Local().Record(op, flops, uint64_t(ns));
+    }
+};
+
+//sum over every thread since the last MatStatsReset
+inline MatStats MatStatsSnapshot()
+{
+    auto &reg = MatStatsBlock::Global();
+    std::lock_guard<std::mutex> guard(reg.lock);
+    MatStats s = reg.retired;
+    for (const MatStatsBlock *b : reg.live)
+    {
+        s += b->Read();
+    }
+    return s;
+}
+//the calling thread only, e.g. to attribute a request served on this thread
+inline MatStats MatStatsThreadSnapshot()
+{
+    auto &reg = MatStatsBlock::Global();
+    std::lock_guard<std::mutex> guard(reg.lock);
+    return MatStatsBlock::Local().Read();
+}
+//counts racing with the reset land on either side of it
+inline void MatStatsReset()
+{
+    auto &reg = MatStatsBlock::Global();
+    std::lock_guard<std::mutex> guard(reg.lock);
+    reg.retired = MatStats{};
+    for (MatStatsBlock *b : reg.live)
+    {
+        b->Reset();
+    }
+}
+
+#define MAT_STATS_ALLOC(bytes) MatStatsBlock::Local().Alloc(bytes)
+#define MAT_STATS_FREE() MatStatsBlock::Local().Free()
+#define MAT_STATS_COPY(bytes) MatStatsBlock::Local().Copy(bytes)
+#define MAT_STATS_MOVE() MatStatsBlock::Local().Move()
+#define MAT_STATS_SCOPE(op, flops) const MatStatsScope mat_stats_scope_(op, flops)
+#else
+inline MatStats MatStatsSnapshot() noexcept { return {}; }
+inline MatStats MatStatsThreadSnapshot() noexcept { return {}; }
+inline void MatStatsReset() noexcept {}
+
+#define MAT_STATS_ALLOC(bytes) ((void)0)
+#define MAT_STATS_FREE() ((void)0)
+#define MAT_STATS_COPY(bytes) ((void)0)
+#define MAT_STATS_MOVE() ((void)0)
+#define MAT_STATS_SCOPE(op, flops) ((void)0)
+#endif
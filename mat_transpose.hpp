@@ -0,0 +1,444 @@
+#pragma once
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define MAT_TRANSPOSE_SSE
+#endif
+#include "mat.hpp"
+#include "mat_reduce.hpp"
+#include "tpool.hpp"
+
+//out of place and in place transposes of Mat and MatView
+//out of place recursively halves the longer side down to L1 sized tiles, so every level of cache is used without knowing its size,
+//and tiles are moved as square register blocks; in place is the same recursion over block pairs for square matrices
+//and three row / column permutations (Catanzaro, Keller, Garland 2014) for rectangular ones, using O(max(w, h)) scratch
+
+//edge of the tiles the recursion stops at, a source and a destination tile fit in L1 together
+template <typename T>
+inline constexpr size_t mat_transpose_tile = sizeof(T) >= 8 ? 16 : 32;
+
+//edge of the blocks transposed in registers, 4 and 8 byte trivially copyable types go through float / double shuffles
+template <typename T>
+inline constexpr size_t mat_transpose_simd =
+#if defined(MAT_TRANSPOSE_SSE)
+    !std::is_trivially_copyable_v<T> ? 1 : sizeof(T) == 4 ? (
+#if defined(__AVX__)
+                                                                8
+#else
+                                                                4
+#endif
+                                                                )
+                                       : sizeof(T) == 8 ? (
+#if defined(__AVX__)
+                                                              4
+#else
+                                                              2
+#endif
+                                                              )
+                                                        : 1;
+#else
+    1;
+#endif
+
+//dst[x * ldd + y] = src[y * lds + x] for one mat_transpose_simd<T> square block
+template <typename T>
+ALWAYS_INLINE void MatTransposeBlock(const T *src, size_t lds, T *dst, size_t ldd) noexcept
+{
+#if defined(MAT_TRANSPOSE_SSE)
+    if constexpr (sizeof(T) == 4)
+    {
+        const float *s = reinterpret_cast<const float *>(src);
+        float *d = reinterpret_cast<float *>(dst);
+#if defined(__AVX__)
+        const __m256 r0 = _mm256_loadu_ps(s), r1 = _mm256_loadu_ps(s + lds), r2 = _mm256_loadu_ps(s + 2 * lds), r3 = _mm256_loadu_ps(s + 3 * lds);
+        const __m256 r4 = _mm256_loadu_ps(s + 4 * lds), r5 = _mm256_loadu_ps(s + 5 * lds), r6 = _mm256_loadu_ps(s + 6 * lds), r7 = _mm256_loadu_ps(s + 7 * lds);
+        const __m256 t0 = _mm256_unpacklo_ps(r0, r1), t1 = _mm256_unpackhi_ps(r0, r1), t2 = _mm256_unpacklo_ps(r2, r3), t3 = _mm256_unpackhi_ps(r2, r3);
+        const __m256 t4 = _mm256_unpacklo_ps(r4, r5), t5 = _mm256_unpackhi_ps(r4, r5), t6 = _mm256_unpacklo_ps(r6, r7), t7 = _mm256_unpackhi_ps(r6, r7);
+        const __m256 u0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0)), u1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+        const __m256 u2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0)), u3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+        const __m256 u4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0)), u5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+        const __m256 u6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0)), u7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+        _mm256_storeu_ps(d, _mm256_permute2f128_ps(u0, u4, 0x20));
+        _mm256_storeu_ps(d + ldd, _mm256_permute2f128_ps(u1, u5, 0x20));
+        _mm256_storeu_ps(d + 2 * ldd, _mm256_permute2f128_ps(u2, u6, 0x20));
+        _mm256_storeu_ps(d + 3 * ldd, _mm256_permute2f128_ps(u3, u7, 0x20));
+        _mm256_storeu_ps(d + 4 * ldd, _mm256_permute2f128_ps(u0, u4, 0x31));
+        _mm256_storeu_ps(d + 5 * ldd, _mm256_permute2f128_ps(u1, u5, 0x31));
+        _mm256_storeu_ps(d + 6 * ldd, _mm256_permute2f128_ps(u2, u6, 0x31));
+        _mm256_storeu_ps(d + 7 * ldd, _mm256_permute2f128_ps(u3, u7, 0x31));
+#else
+        __m128 r0 = _mm_loadu_ps(s), r1 = _mm_loadu_ps(s + lds), r2 = _mm_loadu_ps(s + 2 * lds), r3 = _mm_loadu_ps(s + 3 * lds);
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        _mm_storeu_ps(d, r0);
+        _mm_storeu_ps(d + ldd, r1);
+        _mm_storeu_ps(d + 2 * ldd, r2);
+        _mm_storeu_ps(d + 3 * ldd, r3);
+#endif
+    }
+    else if constexpr (sizeof(T) == 8)
+    {
+        const double *s = reinterpret_cast<const double *>(src);
+        double *d = reinterpret_cast<double *>(dst);
+#if defined(__AVX__)
+        const __m256d r0 = _mm256_loadu_pd(s), r1 = _mm256_loadu_pd(s + lds), r2 = _mm256_loadu_pd(s + 2 * lds), r3 = _mm256_loadu_pd(s + 3 * lds);
+        const __m256d t0 = _mm256_unpacklo_pd(r0, r1), t1 = _mm256_unpackhi_pd(r0, r1), t2 = _mm256_unpacklo_pd(r2, r3), t3 = _mm256_unpackhi_pd(r2, r3);
+        _mm256_storeu_pd(d, _mm256_permute2f128_pd(t0, t2, 0x20));
+        _mm256_storeu_pd(d + ldd, _mm256_permute2f128_pd(t1, t3, 0x20));
+        _mm256_storeu_pd(d + 2 * ldd, _mm256_permute2f128_pd(t0, t2, 0x31));
+        _mm256_storeu_pd(d + 3 * ldd, _mm256_permute2f128_pd(t1, t3, 0x31));
+#else
+        const __m128d r0 = _mm_loadu_pd(s), r1 = _mm_loadu_pd(s + lds);
+        _mm_storeu_pd(d, _mm_unpacklo_pd(r0, r1));
+        _mm_storeu_pd(d + ldd, _mm_unpackhi_pd(r0, r1));
+#endif
+    }
+    else
+#endif
+    {
+        for (size_t y = 0; y < mat_transpose_simd<T>; ++y)
+        {
+            for (size_t x = 0; x < mat_transpose_simd<T>; ++x)
+            {
+                dst[x * ldd + y] = src[y * lds + x];
+            }
+        }
+    }
+}
+
+//dst[x * ldd + y] = src[y * lds + x] over a w x h tile of src, register blocks first and scalar edges after
+template <typename T>
+inline void MatTransposeTile(const T *src, size_t lds, T *dst, size_t ldd, size_t w, size_t h) noexcept
+{
+    constexpr size_t B = mat_transpose_simd<T>;
+    size_t y = 0;
+    if constexpr (B > 1)
+    {
+        for (; y + B <= h; y += B)
+        {
+            size_t x = 0;
+            for (; x + B <= w; x += B)
+            {
+                MatTransposeBlock(src + y * lds + x, lds, dst + x * ldd + y, ldd);
+            }
+            for (; x < w; ++x)
+            {
+                for (size_t i = y; i < y + B; ++i)
+                {
+                    dst[x * ldd + i] = src[i * lds + x];
+                }
+            }
+        }
+    }
+    for (; y < h; ++y)
+    {
+        for (size_t x = 0; x < w; ++x)
+        {
+            dst[x * ldd + y] = src[y * lds + x];
+        }
+    }
+}
+
+//halves the longer side until the block is one tile, splits stay multiples of the register block
+template <typename T>
+inline void MatTransposeRec(const T *src, size_t lds, T *dst, size_t ldd, size_t w, size_t h) noexcept
+{
+    constexpr size_t tile = mat_transpose_tile<T>, B = mat_transpose_simd<T>;
+    if (w <= tile && h <= tile)
+    {
+        MatTransposeTile(src, lds, dst, ldd, w, h);
+    }
+    else if (w >= h)
+    {
+        const size_t w0 = w / 2 / B * B;
+        MatTransposeRec(src, lds, dst, ldd, w0, h);
+        MatTransposeRec(src + w0, lds, dst + w0 * ldd, ldd, w - w0, h);
+    }
+    else
+    {
+        const size_t h0 = h / 2 / B * B;
+        MatTransposeRec(src, lds, dst, ldd, w, h0);
+        MatTransposeRec(src + h0 * lds, lds, dst + h0, ldd, w, h - h0);
+    }
+}
+
+//dst = src transposed, dst must be src.SizeY() wide and src.SizeX() tall and must not overlap src
+//large sources are split into bands of whole tiles of rows across ThreadPool::Global()
+template <MatViewable M>
+inline void TransposeInto(const M &m, MatView<typename M::type, typename M::storage_type> dst)
+{
+    using T = typename M::type;
+    const mat_const_view_t<M> src(m);
+    if (dst.SizeX() != src.SizeY() || dst.SizeY() != src.SizeX())
+        throw std::invalid_argument("TransposeInto: dst must be src.SizeY() x src.SizeX()");
+    if (dst.IsTransposed())
+    {
+        //writing the transpose through a transposed window is a plain copy
+        dst.TransposedView() = src;
+        return;
+    }
+    const size_t w = src.SizeX(), h = src.SizeY(), ldd = dst.Stride();
+    MAT_STATS_SCOPE(MatOp::Transpose, 0);
+    if (!w || !h)
+    {
+        return;
+    }
+    T *out = dst.data();
+    if (src.IsTransposed())
+    {
+        //the source's columns are contiguous, so each one is a row of dst
+        const T *in = src.data();
+        const size_t lds = src.Stride();
+        MatParallelRange(w, [in, lds, out, ldd, h](size_t first, size_t last)
+                         {
+                             for (size_t x = first; x < last; ++x)
+                             {
+                                 std::copy_n(in + x * lds, h, out + x * ldd);
+                             }
+                         });
+        return;
+    }
+    const T *in = src.data();
+    const size_t lds = src.Stride();
+    constexpr size_t tile = mat_transpose_tile<T>;
+    if (w * h < MAT_PARALLEL_ELEMENTS)
+    {
+        MatTransposeRec(in, lds, out, ldd, w, h);
+        return;
+    }
+    const size_t band = std::max<size_t>(1, MAT_PARALLEL_ELEMENTS / 4 / w / tile) * tile;
+    parallel_for(0, (h + band - 1) / band, 1, [=](size_t first, size_t last)
+                 {
+                     for (size_t b = first; b < last; ++b)
+                     {
+                         const size_t y = b * band;
+                         MatTransposeRec(in + y * lds, lds, out + y, ldd, w, std::min(band, h - y));
+                     }
+                 });
+}
+
+//new dense matrix holding the transpose of any Mat or view
+template <MatViewable M>
+inline Mat<typename M::type, typename M::storage_type> Transpose(const M &m)
+{
+    const mat_const_view_t<M> src(m);
+    Mat<typename M::type, typename M::storage_type> res(src.SizeY(), src.SizeX(), mat_uninit);
+    TransposeInto(src, res.View());
+    return res;
+}
+
+//swaps A(x, y) with B(y, x) for a w x h block A and an h x w block B, both with row stride ld
+template <typename T>
+inline void MatTransposeSwap(T *a, T *b, size_t ld, size_t w, size_t h) noexcept
+{
+    constexpr size_t tile = mat_transpose_tile<T>, B = mat_transpose_simd<T>;
+    if (w > tile || h > tile)
+    {
+        if (w >= h)
+        {
+            const size_t w0 = w / 2 / B * B;
+            MatTransposeSwap(a, b, ld, w0, h);
+            MatTransposeSwap(a + w0, b + w0 * ld, ld, w - w0, h);
+        }
+        else
+        {
+            const size_t h0 = h / 2 / B * B;
+            MatTransposeSwap(a, b, ld, w, h0);
+            MatTransposeSwap(a + h0 * ld, b + h0, ld, w, h - h0);
+        }
+        return;
+    }
+    size_t y = 0;
+    if constexpr (B > 1)
+    {
+        //both blocks are read into registers by way of a small stack buffer before either is written
+        T ta[B * B], tb[B * B];
+        for (; y + B <= h; y += B)
+        {
+            size_t x = 0;
+            for (; x + B <= w; x += B)
+            {
+                T *pa = a + y * ld + x, *pb = b + x * ld + y;
+                MatTransposeBlock(pa, ld, ta, B);
+                MatTransposeBlock(pb, ld, tb, B);
+                for (size_t i = 0; i < B; ++i)
+                {
+                    std::copy_n(ta + i * B, B, pb + i * ld);
+                    std::copy_n(tb + i * B, B, pa + i * ld);
+                }
+            }
+            for (; x < w; ++x)
+            {
+                for (size_t i = y; i < y + B; ++i)
+                {
+                    std::swap(a[i * ld + x], b[x * ld + i]);
+                }
+            }
+        }
+    }
+    for (; y < h; ++y)
+    {
+        for (size_t x = 0; x < w; ++x)
+        {
+            std::swap(a[y * ld + x], b[x * ld + y]);
+        }
+    }
+}
+
+//transposes the n x n block at a in place, the diagonal halves recurse and the off diagonal pair is swapped
+template <typename T>
+inline void MatTransposeSquare(T *a, size_t ld, size_t n) noexcept
+{
+    constexpr size_t tile = mat_transpose_tile<T>, B = mat_transpose_simd<T>;
+    if (n <= tile)
+    {
+        for (size_t y = 0; y < n; ++y)
+        {
+            for (size_t x = y + 1; x < n; ++x)
+            {
+                std::swap(a[y * ld + x], a[x * ld + y]);
+            }
+        }
+        return;
+    }
+    const size_t n0 = n / 2 / B * B;
+    MatTransposeSquare(a, ld, n0);
+    MatTransposeSquare(a + n0 * ld + n0, ld, n - n0);
+    MatTransposeSwap(a + n0, a + n0 * ld, ld, n - n0, n0);
+}
+
+//in place transpose of a square view, strided blocks of a larger matrix included
+template <typename T, SizeType SizeT>
+inline void TransposeInPlace(MatView<T, SizeT> v)
+{
+    if (v.SizeX() != v.SizeY())
+        throw std::invalid_argument("TransposeInPlace: a view can only be transposed in place when it is square");
+    MAT_STATS_SCOPE(MatOp::Transpose, 0);
+    MatTransposeSquare(v.data(), v.Stride(), v.SizeX());
+}
+
+//in place transpose of a h x w row major buffer into w x h, three passes each permuting only within rows or only within columns:
+//columns are rotated so every row holds one element bound for each final column, rows are scattered to their final columns,
+//then columns are gathered into their final rows; the column passes work a cache line of columns at a time, row by row
+template <typename T>
+inline void MatTransposeRect(T *a, size_t w, size_t h)
+{
+    const size_t m = h, n = w, c = std::gcd(m, n), b = n / c;
+    constexpr size_t cb = std::max<size_t>(1, 64 / sizeof(T));
+    std::vector<T> col(m * cb), row(n);
+    size_t state[2][cb];
+
+    //element (i, j) of the input ends at flat index j * m + i
+    //pass 1, c > 1 only: column j rotates up by j / b, row q then holds input row (q + j / b) mod m
+    if (c > 1)
+    {
+        for (size_t j0 = 0; j0 < n; j0 += cb)
+        {
+            const size_t jw = std::min(cb, n - j0);
+            size_t *rot = state[0];
+            for (size_t dj = 0; dj < jw; ++dj)
+            {
+                rot[dj] = (j0 + dj) / b;
+            }
+            for (size_t q = 0; q < m; ++q)
+            {
+                for (size_t dj = 0; dj < jw; ++dj)
+                {
+                    const size_t i = q + rot[dj];
+                    col[q * cb + dj] = std::move(a[(i < m ? i : i - m) * n + j0 + dj]);
+                }
+            }
+            for (size_t q = 0; q < m; ++q)
+            {
+                std::move(col.begin() + q * cb, col.begin() + q * cb + jw, a + q * n + j0);
+            }
+        }
+    }
+
+    //pass 2: row q, column j = t * b + u holds input (i, j) with i = (q + t) mod m, it moves to column (j * m + i) mod n
+    const size_t mn = m % n;
+    for (size_t q = 0; q < m; ++q)
+    {
+        T *r = a + q * n;
+        size_t jm = 0; //j * m mod n
+        for (size_t t = 0, j = 0; t < c; ++t)
+        {
+            const size_t i = (q + t) % m % n;
+            for (size_t u = 0; u < b; ++u, ++j)
+            {
+                const size_t s = jm + i;
+                row[s < n ? s : s - n] = std::move(r[j]);
+                jm += mn;
+                if (jm >= n)
+                {
+                    jm -= n;
+                }
+            }
+        }
+        std::move(row.begin(), row.end(), r);
+    }
+
+    //pass 3: final (r, s) is flat p = r * n + s, i.e. input (i, j) = (p mod m, p / m), which pass 1 left in row (i - j / b) mod m
+    //i and j / b are stepped per column as r advances, p grows by n each row
+    const size_t ni = n % m, nj = n / m;
+    for (size_t s0 = 0; s0 < n; s0 += cb)
+    {
+        const size_t sw = std::min(cb, n - s0);
+        size_t *is = state[0], *js = state[1];
+        size_t jq[cb];
+        for (size_t ds = 0; ds < sw; ++ds)
+        {
+            is[ds] = (s0 + ds) % m;
+            js[ds] = (s0 + ds) / m % b;
+            jq[ds] = (s0 + ds) / m / b;
+        }
+        for (size_t r = 0; r < m; ++r)
+        {
+            for (size_t ds = 0; ds < sw; ++ds)
+            {
+                const size_t i = is[ds], q = i >= jq[ds] ? i - jq[ds] : i + m - jq[ds];
+                col[r * cb + ds] = std::move(a[q * n + s0 + ds]);
+                is[ds] += ni;
+                js[ds] += nj;
+                if (is[ds] >= m)
+                {
+                    is[ds] -= m;
+                    ++js[ds];
+                }
+                while (js[ds] >= b)
+                {
+                    js[ds] -= b;
+                    ++jq[ds];
+                }
+            }
+        }
+        for (size_t r = 0; r < m; ++r)
+        {
+            std::move(col.begin() + r * cb, col.begin() + r * cb + sw, a + r * n + s0);
+        }
+    }
+}
+
+//in place transpose of a whole Mat, square or rectangular, the result is SizeY() wide and SizeX() tall
+template <typename Type, SizeType SizeT, typename Alloc>
+inline void TransposeInPlace(Mat<Type, SizeT, Alloc> &mat)
+{
+    const size_t w = mat.SizeX(), h = mat.SizeY();
+    if (w == h)
+    {
+        TransposeInPlace(mat.View());
+        return;
+    }
+    if (w > 1 && h > 1)
+    {
+        MAT_STATS_SCOPE(MatOp::Transpose, 0);
+        MatTransposeRect(mat.data(), w, h);
+    }
+    mat.Reshape(SizeT(h), SizeT(w));
+}
@@ -0,0 +1,333 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+#include "mat.hpp"
+#include "mat_reduce.hpp"
+#include "gemm.hpp"
+
+//reduced precision element types and quantized storage for Mat, halving or quartering the memory traffic of fp32
+//the 16 bit types only store, arithmetic goes through float, kernels widen inside Gemm's packing so only packed panels are fp32
+
+//IEEE binary16, 10 bit mantissa and 5 bit exponent, finite up to 65504
+struct Half
+{
+    uint16_t bits;
+
+    static constexpr uint16_t FromFloat(float f) noexcept
+    {
+        const uint32_t x = std::bit_cast<uint32_t>(f);
+        const uint32_t sign = (x >> 16) & 0x8000;
+        uint32_t abs = x & 0x7fffffff;
+        if (abs >= 0x7f800000)
+            return uint16_t(sign | (abs > 0x7f800000 ? 0x7e00 : 0x7c00)); //NaN stays quiet NaN, inf stays inf
+        if (abs >= 0x477ff000)
+            return uint16_t(sign | 0x7c00); //rounds past 65504
+        if (abs < 0x38800000)
+        {
+            //below the smallest normal, adding 0.5 lines the 2^-24 steps up with float's last mantissa bits and rounds to nearest even
+            return uint16_t(sign | (std::bit_cast<uint32_t>(std::bit_cast<float>(abs) + 0.5f) - 0x3f000000));
+        }
+        abs += 0xc8000fff + ((abs >> 13) & 1); //rebias the exponent, round the dropped 13 bits to nearest even
+        return uint16_t(sign | (abs >> 13));
+    }
+    static constexpr float ToFloat(uint16_t h) noexcept
+    {
+        const uint32_t sign = uint32_t(h & 0x8000) << 16, em = h & 0x7fff;
+        if (em >= 0x7c00)
+            return std::bit_cast<float>(sign | 0x7f800000 | ((em & 0x3ff) << 13));
+        if (em < 0x400)
+            return std::bit_cast<float>(sign | std::bit_cast<uint32_t>(float(em) * 5.9604644775390625e-8f)); //subnormal, em * 2^-24
+        return std::bit_cast<float>(sign | ((em << 13) + 0x38000000));
+    }
+
+    Half() = default;
+    constexpr Half(float f) noexcept : bits(FromFloat(f)) {}
+    constexpr operator float() const noexcept { return ToFloat(bits); }
+    static constexpr Half FromBits(uint16_t b) noexcept
+    {
+        Half h;
+        h.bits = b;
+        return h;
+    }
+};
+
+//bfloat16, the top half of a float, same range as fp32 with an 8 bit mantissa
+struct BFloat16
+{
+    uint16_t bits;
+
+    static constexpr uint16_t FromFloat(float f) noexcept
+    {
+        const uint32_t x = std::bit_cast<uint32_t>(f);
+        return (x & 0x7fffffff) > 0x7f800000 ? uint16_t((x >> 16) | 0x40) : uint16_t((x + 0x7fff + ((x >> 16) & 1)) >> 16);
+    }
+    static constexpr float ToFloat(uint16_t b) noexcept { return std::bit_cast<float>(uint32_t(b) << 16); }
+
+    BFloat16() = default;
+    constexpr BFloat16(float f) noexcept : bits(FromFloat(f)) {}
+    constexpr operator float() const noexcept { return ToFloat(bits); }
+    static constexpr BFloat16 FromBits(uint16_t b) noexcept
+    {
+        BFloat16 h;
+        h.bits = b;
+        return h;
+    }
+};
+
+using hMat = Mat<Half>;
+using bfMat = Mat<BFloat16>;
+
+//dst[i] = To(src[i]), the integer bit tricks for bf16 vectorize as written, fp16 uses F16C where available
+template <typename From, typename To>
+inline void MatConvert(const From *src, To *dst, size_t n) noexcept
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        dst[i] = To(src[i]);
+    }
+}
+#if defined(__F16C__)
+inline void MatConvert(const float *src, Half *dst, size_t n) noexcept
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+    }
+    for (; i < n; ++i)
+    {
+        dst[i] = Half(src[i]);
+    }
+}
+inline void MatConvert(const Half *src, float *dst, size_t n) noexcept
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i))));
+    }
+    for (; i < n; ++i)
+    {
+        dst[i] = float(src[i]);
+    }
+}
+#endif
+
+//element type conversion of any Mat or view into a new dense Mat, e.g. MatCast<BFloat16>(weights) or MatCast<float>(hidden)
+template <typename To, MatViewable M>
+inline Mat<To, typename M::storage_type> MatCast(const M &m)
+{
+    using SizeT = typename M::storage_type;
+    const mat_const_view_t<M> v(m);
+    const size_t w = v.SizeX(), h = v.SizeY();
+    Mat<To, SizeT> res(v.SizeX(), v.SizeY(), mat_uninit);
+    To *dst = res.data();
+    if (!v.IsTransposed() && (v.Stride() == w || h <= 1))
+    {
+        const auto *src = v.data();
+        MatParallelRange(w * h, [src, dst](size_t first, size_t last) { MatConvert(src + first, dst + first, last - first); });
+    }
+    else if (!v.IsTransposed())
+    {
+        for (size_t y = 0; y < h; ++y)
+        {
+            MatConvert(v.data() + y * v.Stride(), dst + y * w, w);
+        }
+    }
+    else
+    {
+        for (size_t y = 0; y < h; ++y)
+        {
+            for (size_t x = 0; x < w; ++x)
+            {
+                dst[y * w + x] = To(v.Eval(x, y));
+            }
+        }
+    }
+    return res;
+}
+
+//A * B accumulated in Acc whatever the element types of A and B, fp16/bf16/fp32 mixes into float, int8 into int32
+//A.SizeX() must equal B.SizeY(), both may be strided or transposed views
+template <typename Acc = float, MatViewable MA, MatViewable MB>
+inline Mat<Acc, typename MA::storage_type> MixedDot(const MA &ma, const MB &mb)
+{
+    const mat_const_view_t<MA> a(ma);
+    const mat_const_view_t<MB> b(mb);
+    if (a.SizeX() != b.SizeY())
+        throw std::invalid_argument("MixedDot: dimensions invalid");
+    MAT_STATS_SCOPE(MatOp::Dot, 2 * uint64_t(a.SizeY()) * b.SizeX() * a.SizeX());
+    Mat<Acc, typename MA::storage_type> res(b.SizeX(), a.SizeY());
+    ParallelGemm<Acc>(a.SizeY(), b.SizeX(), a.SizeX(), Acc(1), a.data(), a.RowStride(), a.ColStride(), b.data(), b.RowStride(), b.ColStride(), res.data(), res.SizeX(), 1);
+    return res;
+}
+
+//affine int8 mapping, real = scale * (q - zeroPoint)
+struct QuantParams
+{
+    float scale = 1;
+    int32_t zeroPoint = 0;
+
+    //smallest scale covering [lo, hi] widened to contain 0, so zero is exact, e.g. for ReLU outputs and padding
+    static QuantParams FromRange(float lo, float hi) noexcept
+    {
+        lo = std::min(lo, 0.0f);
+        hi = std::max(hi, 0.0f);
+        QuantParams p;
+        p.scale = hi > lo ? (hi - lo) / 255.0f : 1.0f;
+        p.zeroPoint = std::clamp(int32_t(std::lround(-128.0f - lo / p.scale)), -128, 127);
+        return p;
+    }
+    //zeroPoint 0 and the range mirrored around it, the cheaper choice for weights
+    static QuantParams Symmetric(float absMax) noexcept
+    {
+        QuantParams p;
+        p.scale = absMax > 0 ? absMax / 127.0f : 1.0f;
+        return p;
+    }
+};
+
+//int8 storage with one scale and zero point for the whole matrix
+template <SizeType SizeT = size_t>
+class QuantMat
+{
+private:
+    Mat<int8_t, SizeT> values;
+    QuantParams params;
+
+public:
+    using type = int8_t;
+    using storage_type = SizeT;
+
+    QuantMat() = default;
+    //adopts already quantized values
+    static QuantMat FromValues(Mat<int8_t, SizeT> q, QuantParams p) noexcept
+    {
+        QuantMat res;
+        res.values = std::move(q);
+        res.params = p;
+        return res;
+    }
+    //rounds half away from zero and saturates to [-128, 127]
+    QuantMat(MatView<const float, SizeT> m, QuantParams p);
+    //parameters from the range of m
+    explicit QuantMat(MatView<const float, SizeT> m) : QuantMat(m, QuantParams::FromRange(Min(m), Max(m))) {}
+
+    SizeT SizeX() const noexcept { return values.SizeX(); }
+    SizeT SizeY() const noexcept { return values.SizeY(); }
+    const QuantParams &Params() const noexcept { return params; }
+    const Mat<int8_t, SizeT> &Values() const noexcept { return values; }
+    operator MatView<const int8_t, SizeT>() const noexcept { return values.View(); }
+
+    Mat<float, SizeT> ToFloat() const;
+};
+
+template <SizeType SizeT>
+inline QuantMat<SizeT>::QuantMat(MatView<const float, SizeT> m, QuantParams p) : values(m.SizeX(), m.SizeY(), mat_uninit), params(p)
+{
+    const Mat<float, SizeT> dense = (m.IsTransposed() || m.Stride() != m.SizeX()) ? MatCast<float>(m) : Mat<float, SizeT>();
+    const float *src = dense.data() ? dense.data() : m.data();
+    int8_t *dst = values.data();
+    const float inv = 1.0f / p.scale, zp = float(p.zeroPoint);
+    MatParallelRange(size_t(m.SizeX()) * m.SizeY(), [src, dst, inv, zp](size_t first, size_t last)
+                     {
+                         for (size_t i = first; i < last; ++i)
+                         {
+                             const float v = std::clamp(src[i] * inv + zp, -128.0f, 127.0f);
+                             dst[i] = int8_t(int32_t(v + (v < 0 ? -0.5f : 0.5f)));
+                         }
+                     });
+}
+
+template <SizeType SizeT>
+inline Mat<float, SizeT> QuantMat<SizeT>::ToFloat() const
+{
+    Mat<float, SizeT> res(SizeX(), SizeY(), mat_uninit);
+    const int8_t *src = values.data();
+    float *dst = res.data();
+    const float scale = params.scale, zp = float(params.zeroPoint);
+    MatParallelRange(size_t(SizeX()) * SizeY(), [src, dst, scale, zp](size_t first, size_t last)
+                     {
+                         for (size_t i = first; i < last; ++i)
+                         {
+                             dst[i] = scale * (float(src[i]) - zp);
+                         }
+                     });
+    return res;
+}
+
+//exact sum over k of (a - za) * (b - zb) for each output element, int32 holds it for a.SizeX() up to 32768
+template <SizeType SizeT>
+inline Mat<int32_t, SizeT> DotAccumulate(const QuantMat<SizeT> &a, const QuantMat<SizeT> &b)
+{
+    Mat<int32_t, SizeT> res = MixedDot<int32_t>(a, b);
+    const int32_t za = a.Params().zeroPoint, zb = b.Params().zeroPoint;
+    if (!za && !zb)
+    {
+        return res;
+    }
+    //sum (a - za)(b - zb) = sum ab - zb * rowsum(a) - za * colsum(b) + k za zb
+    const size_t m = a.SizeY(), n = b.SizeX(), k = a.SizeX();
+    std::vector<int32_t> rowA(m, 0), colB(n, 0);
+    const int8_t *pa = a.Values().data(), *pb = b.Values().data();
+    for (size_t i = 0; i < m; ++i)
+    {
+        for (size_t p = 0; p < k; ++p)
+        {
+            rowA[i] += pa[i * k + p];
+        }
+    }
+    for (size_t p = 0; p < k; ++p)
+    {
+        for (size_t j = 0; j < n; ++j)
+        {
+            colB[j] += pb[p * n + j];
+        }
+    }
+    const int32_t bias = int32_t(k) * za * zb;
+    int32_t *c = res.data();
+    const auto rows = [&](size_t first, size_t last)
+    {
+        for (size_t i = first; i < last; ++i)
+        {
+            const int32_t ri = bias - zb * rowA[i];
+            for (size_t j = 0; j < n; ++j)
+            {
+                c[i * n + j] += ri - za * colB[j];
+            }
+        }
+    };
+    if (m * n < MAT_PARALLEL_ELEMENTS)
+        rows(0, m);
+    else
+        parallel_for(0, m, std::max<size_t>(1, MAT_PARALLEL_ELEMENTS / 4 / std::max<size_t>(n, 1)), rows);
+    return res;
+}
+
+//dequantized product, a.scale * b.scale * DotAccumulate(a, b)
+template <SizeType SizeT>
+inline Mat<float, SizeT> Dot(const QuantMat<SizeT> &a, const QuantMat<SizeT> &b)
+{
+    const Mat<int32_t, SizeT> acc = DotAccumulate(a, b);
+    Mat<float, SizeT> res(acc.SizeX(), acc.SizeY(), mat_uninit);
+    const float scale = a.Params().scale * b.Params().scale;
+    const int32_t *src = acc.data();
+    float *dst = res.data();
+    MatParallelRange(size_t(acc.SizeX()) * acc.SizeY(), [src, dst, scale](size_t first, size_t last)
+                     {
+                         for (size_t i = first; i < last; ++i)
+                         {
+                             dst[i] = scale * float(src[i]);
+                         }
+                     });
+    return res;
+}
@@ -0,0 +1,155 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <string_view>
+#include <type_traits>
+#include "utils.hpp"
+
+//runtime instruction set dispatch for the Mat kernels, so one binary built for a baseline target uses AVX2 or AVX-512 where the CPU has them
+//the CPU is probed once, SimdDispatch(f) then calls f through a copy compiled for the active level: each copy is a target attributed,
+//flattened function, so f and everything it inlines is vectorized for that level, f also gets the level as a constant to pick its blocking
+//levels at or below what the build already enables (-march) reuse the build's code, only Scalar is honored below it, by turning the vectorizer off
+//the MAT_SIMD environment variable (scalar, sse2, avx2, avx512) or SimdForce lower the level for testing and benchmarking,
+//MAT_NO_SIMD_DISPATCH compiles dispatch out
+
+enum class SimdLevel : uint8_t
+{
+    Scalar, //portable C++, not vectorized
+    SSE2,
+    AVX2,   //with FMA and F16C
+    AVX512, //F, VL, BW, DQ
+    Count,
+};
+
+inline constexpr const char *simd_level_names[size_t(SimdLevel::Count)] = {"scalar", "sse2", "avx2", "avx512"};
+
+template <SimdLevel L>
+using simd_level_t = std::integral_constant<SimdLevel, L>;
+
+#if !defined(MAT_NO_SIMD_DISPATCH) && (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define MAT_SIMD_DISPATCH
+#endif
+
+//the level the compiler flags already guarantee
+inline constexpr SimdLevel simd_baseline =
+#if defined(__AVX512F__) && defined(__AVX512VL__) && defined(__AVX512BW__) && defined(__AVX512DQ__)
+    SimdLevel::AVX512;
+#elif defined(__AVX2__) && defined(__FMA__)
+    SimdLevel::AVX2;
+#elif defined(__SSE2__) || defined(_M_X64)
+    SimdLevel::SSE2;
+#else
+    SimdLevel::Scalar;
+#endif
+
+inline SimdLevel SimdDetect() noexcept
+{
+#if defined(MAT_SIMD_DISPATCH)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512dq"))
+        return SimdLevel::AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return SimdLevel::AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return SimdLevel::SSE2;
+    return SimdLevel::Scalar;
+#else
+    return simd_baseline;
+#endif
+}
+
+//best level of this CPU, probed on first use
+inline SimdLevel SimdDetected() noexcept
+{
+    static const SimdLevel level = SimdDetect();
+    return level;
+}
+
+inline SimdLevel SimdParse(std::string_view name, SimdLevel fallback) noexcept
+{
+    for (size_t i = 0; i < size_t(SimdLevel::Count); ++i)
+    {
+        if (name == simd_level_names[i])
+            return SimdLevel(i);
+    }
+    return fallback;
+}
+
+inline std::atomic<SimdLevel> &SimdActiveLevel() noexcept
+{
+    static std::atomic<SimdLevel> level = []
+    {
+        const char *env = std::getenv("MAT_SIMD");
+        const SimdLevel want = env ? SimdParse(env, SimdDetected()) : SimdDetected();
+        return std::min(want, SimdDetected());
+    }();
+    return level;
+}
+
+//level the kernels currently run at
+inline SimdLevel SimdActive() noexcept { return SimdActiveLevel().load(std::memory_order_relaxed); }
+
+//caps the level for every thread, levels the CPU lacks are clamped to SimdDetected(), returns the level in effect
+inline SimdLevel SimdForce(SimdLevel level) noexcept
+{
+    level = std::min(level, SimdDetected());
+    SimdActiveLevel().store(level, std::memory_order_relaxed);
+    return level;
+}
+
+#if defined(MAT_SIMD_DISPATCH)
+//the Scalar copy turns GCC's vectorizer off with the optimize attribute, MAT_SIMD_SCALAR_VECTORIZE disables that
+#if defined(__clang__) || defined(MAT_SIMD_SCALAR_VECTORIZE)
+#define MAT_SIMD_NO_VECTORIZE
+#else
+#define MAT_SIMD_NO_VECTORIZE optimize("no-tree-vectorize", "no-tree-slp-vectorize"),
+#endif
+
+template <typename F>
+__attribute__((MAT_SIMD_NO_VECTORIZE flatten)) inline decltype(auto) SimdRunScalar(F &f)
+{
+    return f(simd_level_t<SimdLevel::Scalar>{});
+}
+template <typename F>
+__attribute__((target("avx2,fma,f16c,bmi,bmi2,popcnt"), flatten)) inline decltype(auto) SimdRunAVX2(F &f)
+{
+    return f(simd_level_t<SimdLevel::AVX2>{});
+}
+template <typename F>
+__attribute__((target("avx512f,avx512vl,avx512bw,avx512dq,avx2,fma,f16c,bmi,bmi2,popcnt"), flatten)) inline decltype(auto) SimdRunAVX512(F &f)
+{
+    return f(simd_level_t<SimdLevel::AVX512>{});
+}
+#undef MAT_SIMD_NO_VECTORIZE
+#endif
+
+//f(simd_level_t<L>) for the active level L, through a copy of f compiled for L when the build doesn't already cover it
+//keep f to leaf loops, everything it calls is inlined into each copy
+template <typename F>
+ALWAYS_INLINE decltype(auto) SimdDispatch(F &&f)
+{
+#if defined(MAT_SIMD_DISPATCH)
+    switch (SimdActive())
+    {
+    case SimdLevel::Scalar:
+        return SimdRunScalar(f);
+    case SimdLevel::AVX2:
+        if constexpr (simd_baseline < SimdLevel::AVX2)
+            return SimdRunAVX2(f);
+        else
+            return f(simd_level_t<SimdLevel::AVX2>{});
+    case SimdLevel::AVX512:
+        if constexpr (simd_baseline < SimdLevel::AVX512)
+            return SimdRunAVX512(f);
+        else
+            return f(simd_level_t<SimdLevel::AVX512>{});
+    default:
+        break;
+    }
+    return f(simd_level_t<SimdLevel::SSE2>{});
+#else
+    return f(simd_level_t<simd_baseline>{});
+#endif
+}
@@ -0,0 +1,474 @@
+#pragma once
+#include <cstddef>
+#include <algorithm>
+#include <numeric>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "mat.hpp"
+#include "tpool.hpp"
+
+enum class SparseFormat
+{
+    CSR, //compressed rows, each row stores its column indices
+    CSC, //compressed columns, each column stores its row indices
+};
+
+template <typename Type, SizeType SizeT = size_t>
+struct SparseTriplet
+{
+    SizeT x, y;
+    Type value;
+};
+
+//compressed sparse matrix, memory and kernel time scale with the stored element count rather than SizeX() * SizeY()
+//storage is split into "major" segments (rows for CSR, columns for CSC), segment m holds the minor indices and values
+//of [offsets[m], offsets[m + 1]) in ascending index order
+template <typename Type = float, SizeType SizeT = size_t, SparseFormat Format = SparseFormat::CSR>
+class SparseMat
+{
+private:
+    template <typename, SizeType, SparseFormat>
+    friend class SparseMat;
+
+    static constexpr bool row_major = Format == SparseFormat::CSR;
+    static constexpr SparseFormat other_format = row_major ? SparseFormat::CSC : SparseFormat::CSR;
+
+    std::vector<size_t> offsets;
+    std::vector<SizeT> indices;
+    std::vector<Type> values;
+    SizeT sizeY = 0, sizeX = 0;
+
+    size_t Majors() const noexcept { return row_major ? sizeY : sizeX; }
+
+    //calls body(first, last) over major segments, split into ranges holding about the same number of stored elements
+    //so a few dense rows don't serialize the kernel, work is the cost per stored element used for the serial cutoff
+    template <typename F>
+    void ForMajors(size_t work, F &&body) const
+    {
+        const size_t nnz = values.size(), majors = Majors();
+        ThreadPool &pool = ThreadPool::Global();
+        if (nnz * work < MAT_PARALLEL_ELEMENTS || pool.Concurrency() <= 1 || majors < 2)
+        {
+            body(size_t(0), majors);
+            return;
+        }
+        const size_t parts = std::min(majors, pool.Concurrency() * 4);
+        const auto boundary = [&](size_t p)
+        {
+            if (p >= parts)
+                return majors;
+            return std::min(majors, size_t(std::lower_bound(offsets.begin(), offsets.end(), p * nnz / parts) - offsets.begin()));
+        };
+        parallel_for(pool, 0, parts, 1, [&](size_t first, size_t last)
+                     {
+                         for (size_t p = first; p < last; ++p)
+                         {
+                             const size_t lo = boundary(p), hi = boundary(p + 1);
+                             if (lo < hi)
+                                 body(lo, hi);
+                         }
+                     });
+    }
+
+    //same elements stored along the other dimension, one counting pass so minor indices come out sorted
+    SparseMat<Type, SizeT, other_format> Transpose() const
+    {
+        SparseMat<Type, SizeT, other_format> res(sizeX, sizeY);
+        const size_t minors = res.Majors();
+        std::vector<size_t> &cursor = res.offsets;
+        for (const SizeT i : indices)
+        {
+            ++cursor[size_t(i) + 1];
+        }
+        std::partial_sum(cursor.begin(), cursor.end(), cursor.begin());
+        res.indices.resize(values.size());
+        res.values.resize(values.size());
+        std::vector<size_t> next(cursor.begin(), cursor.begin() + minors);
+        for (size_t m = 0; m < Majors(); ++m)
+        {
+            for (size_t e = offsets[m]; e < offsets[m + 1]; ++e)
+            {
+                const size_t dst = next[indices[e]]++;
+                res.indices[dst] = SizeT(m);
+                res.values[dst] = values[e];
+            }
+        }
+        return res;
+    }
+
+public:
+    using type = Type;
+    using storage_type = SizeT;
+    static constexpr SparseFormat format = Format;
+
+    SparseMat() : offsets(1) {}
+    SparseMat(SizeT w, SizeT h) : offsets(size_t(row_major ? h : w) + 1), sizeY(h), sizeX(w) {}
+
+    //keeps every element that compares unequal to zero
+    explicit SparseMat(MatView<const Type, SizeT> mat);
+
+    //duplicate coordinates are summed, throws std::out_of_range for coordinates outside w x h
+    static SparseMat FromTriplets(SizeT w, SizeT h, std::span<const SparseTriplet<Type, SizeT>> triplets);
+
+    SizeT SizeX() const noexcept { return sizeX; }
+    SizeT SizeY() const noexcept { return sizeY; }
+    size_t NonZeros() const noexcept { return values.size(); }
+
+    std::span<const size_t> Offsets() const noexcept { return offsets; }
+    std::span<const SizeT> Indices() const noexcept { return indices; }
+    std::span<const Type> Values() const noexcept { return values; }
+    std::span<Type> Values() noexcept { return values; }
+
+    //zero for elements that aren't stored, O(log) in the segment length
+    Type At(SizeT x, SizeT y) const;
+
+    SparseMat<Type, SizeT, SparseFormat::CSR> ToCSR() const;
+    SparseMat<Type, SizeT, SparseFormat::CSC> ToCSC() const;
+    //the transpose shares this storage layout with the other format, so it is a copy of the arrays and no reordering
+    SparseMat<Type, SizeT, other_format> Transposed() const;
+
+    Mat<Type, SizeT> ToMat() const;
+
+    //y = A * x, x holds SizeX() elements and y SizeY()
+    void SpMV(std::span<const Type> x, std::span<Type> y) const;
+    std::vector<Type> SpMV(std::span<const Type> x) const;
+
+    //A * B with B dense and B.SizeY() == SizeX(), result is B.SizeX() wide and SizeY() tall, B may be strided or transposed
+    Mat<Type, SizeT> SpMM(MatView<const Type, SizeT> b) const;
+};
+
+template <typename Type, SizeType SizeT, SparseFormat Format>
+inline SparseMat<Type, SizeT, Format>::SparseMat(MatView<const Type, SizeT> mat) : SparseMat(mat.SizeX(), mat.SizeY())
+{
+    if constexpr (!row_major)
+    {
+        *this = SparseMat<Type, SizeT, SparseFormat::CSR>(mat).ToCSC();
+    }
+    else
+    {
+        //count, prefix sum, then fill, both passes over rows in parallel since rows never share output
+        const size_t w = sizeX, h = sizeY;
+        const auto rows = [w, h](auto &&body)
+        {
+            if (w * h < MAT_PARALLEL_ELEMENTS)
+                body(size_t(0), h);
+            else
+                parallel_for(0, h, std::max<size_t>(1, MAT_PARALLEL_ELEMENTS / 4 / std::max<size_t>(w, 1)), body);
+        };
+        rows([&](size_t first, size_t last)
+             {
+                 for (size_t y = first; y < last; ++y)
+                 {
+                     size_t n = 0;
+                     for (size_t x = 0; x < w; ++x)
+                     {
+                         n += mat.Eval(x, y) != Type(0);
+                     }
+                     offsets[y + 1] = n;
+                 }
+             });
+        std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+        indices.resize(offsets[h]);
+        values.resize(offsets[h]);
+        rows([&](size_t first, size_t last)
+             {
+                 for (size_t y = first; y < last; ++y)
+                 {
+                     size_t e = offsets[y];
+                     for (size_t x = 0; x < w; ++x)
+                     {
+                         const Type v = mat.Eval(x, y);
+                         if (v != Type(0))
+                         {
+                             indices[e] = SizeT(x);
+                             values[e++] = v;
+                         }
+                     }
+                 }
+             });
+    }
+}
+
+template <typename Type, SizeType SizeT, SparseFormat Format>
+inline SparseMat<Type, SizeT, Format> SparseMat<Type, SizeT, Format>::FromTriplets(SizeT w, SizeT h, std::span<const SparseTriplet<Type, SizeT>> triplets)
+{
+    SparseMat res(w, h);
+    const auto major = [](const SparseTriplet<Type, SizeT> &t) { return size_t(row_major ? t.y : t.x); };
+    const auto minor = [](const SparseTriplet<Type, SizeT> &t) { return row_major ? t.x : t.y; };
+    for (const auto &t : triplets)
+    {
+        if (t.x >= w || t.y >= h)
+            throw std::out_of_range("FromTriplets: out of range, " + std::to_string(t.x) + ' ' + std::to_string(t.y));
+        ++res.offsets[major(t) + 1];
+    }
+    std::partial_sum(res.offsets.begin(), res.offsets.end(), res.offsets.begin());
+
+    //bucket by major, then sort each segment by minor and fold duplicates in place
+    res.indices.resize(triplets.size());
+    res.values.resize(triplets.size());
+    std::vector<size_t> next(res.offsets.begin(), res.offsets.end() - 1);
+    for (const auto &t : triplets)
+    {
+        const size_t dst = next[major(t)]++;
+        res.indices[dst] = minor(t);
+        res.values[dst] = t.value;
+    }
+    std::vector<size_t> order;
+    std::vector<SizeT> sortedIdx;
+    std::vector<Type> sortedVal;
+    size_t out = 0;
+    for (size_t m = 0; m < res.Majors(); ++m)
+    {
+        const size_t first = res.offsets[m], last = res.offsets[m + 1];
+        res.offsets[m] = out;
+        if (!std::is_sorted(res.indices.begin() + first, res.indices.begin() + last))
+        {
+            order.resize(last - first);
+            std::iota(order.begin(), order.end(), first);
+            std::stable_sort(order.begin(), order.end(), [&res](size_t a, size_t b) { return res.indices[a] < res.indices[b]; });
+            sortedIdx.resize(order.size());
+            sortedVal.resize(order.size());
+            for (size_t i = 0; i < order.size(); ++i)
+            {
+                sortedIdx[i] = res.indices[order[i]];
+                sortedVal[i] = res.values[order[i]];
+            }
+            std::copy(sortedIdx.begin(), sortedIdx.end(), res.indices.begin() + first);
+            std::copy(sortedVal.begin(), sortedVal.end(), res.values.begin() + first);
+        }
+        for (size_t e = first; e < last; ++e)
+        {
+            if (out > res.offsets[m] && res.indices[out - 1] == res.indices[e])
+            {
+                res.values[out - 1] += res.values[e];
+            }
+            else
+            {
+                res.indices[out] = res.indices[e];
+                res.values[out++] = res.values[e];
+            }
+        }
+    }
+    res.offsets[res.Majors()] = out;
+    res.indices.resize(out);
+    res.values.resize(out);
+    return res;
+}
+
+template <typename Type, SizeType SizeT, SparseFormat Format>
+inline Type SparseMat<Type, SizeT, Format>::At(SizeT x, SizeT y) const
+{
+    MAT_BOUNDS((x < sizeX) && (y < sizeY), MatOutOfRange("At", x, y));
+    const size_t m = row_major ? y : x;
+    const SizeT i = row_major ? x : y;
+    const auto first = indices.begin() + offsets[m], last = indices.begin() + offsets[m + 1];
+    const auto it = std::lower_bound(first, last, i);
+    return (it != last && *it == i) ? values[size_t(it - indices.begin())] : Type(0);
+}
+
+template <typename Type, SizeType SizeT, SparseFormat Format>
+inline SparseMat<Type, SizeT, SparseFormat::CSR> SparseMat<Type, SizeT, Format>::ToCSR() const
+{
+    if constexpr (row_major)
+        return *this;
+    else
+        return Transpose();
+}
+
+template <typename Type, SizeType SizeT, SparseFormat Format>
+inline SparseMat<Type, SizeT, SparseFormat::CSC> SparseMat<Type, SizeT, Format>::ToCSC() const
+{
+    if constexpr (!row_major)
+        return *this;
+    else
+        return Transpose();
+}
+
+template <typename Type, SizeType SizeT, SparseFormat Format>
+inline SparseMat<Type, SizeT, SparseMat<Type, SizeT, Format>::other_format> SparseMat<Type, SizeT, Format>::Transposed() const
+{
+    SparseMat<Type, SizeT, other_format> res;
+    res.offsets = offsets;
+    res.indices = indices;
+    res.values = values;
+    res.sizeY = sizeX;
+    res.sizeX = sizeY;
+    return res;
+}
+
+template <typename Type, SizeType SizeT, SparseFormat Format>
+inline Mat<Type, SizeT> SparseMat<Type, SizeT, Format>::ToMat() const
+{
+    Mat<Type, SizeT> res(sizeX, sizeY);
+    Type *dst = res.data();
+    const size_t w = sizeX;
+    //segments write disjoint elements in either format
+    ForMajors(1, [&](size_t first, size_t last)
+              {
+                  for (size_t m = first; m < last; ++m)
+                  {
+                      for (size_t e = offsets[m]; e < offsets[m + 1]; ++e)
+                      {
+                          dst[row_major ? m * w + indices[e] : size_t(indices[e]) * w + m] = values[e];
+                      }
+                  }
+              });
+    return res;
+}
+
+template <typename Type, SizeType SizeT, SparseFormat Format>
+inline void SparseMat<Type, SizeT, Format>::SpMV(std::span<const Type> x, std::span<Type> y) const
+{
+    if (x.size() != sizeX || y.size() != sizeY)
+        throw std::invalid_argument("SpMV: vector lengths must match SizeX() and SizeY()");
+    if constexpr (row_major)
+    {
+        ForMajors(1, [&](size_t first, size_t last)
+                  {
+                      for (size_t r = first; r < last; ++r)
+                      {
+                          Type acc{};
+                          for (size_t e = offsets[r]; e < offsets[r + 1]; ++e)
+                          {
+                              acc += values[e] * x[indices[e]];
+                          }
+                          y[r] = acc;
+                      }
+                  });
+    }
+    else
+    {
+        //columns scatter into every row, so each column range accumulates into its own buffer and the buffers are summed after
+        std::fill(y.begin(), y.end(), Type(0));
+        ThreadPool &pool = ThreadPool::Global();
+        const size_t parts = std::min<size_t>(pool.Concurrency(), values.size() / std::max<size_t>(sizeY, MAT_PARALLEL_ELEMENTS / 4));
+        if (parts <= 1)
+        {
+            for (size_t c = 0; c < sizeX; ++c)
+            {
+                const Type xc = x[c];
+                for (size_t e = offsets[c]; e < offsets[c + 1]; ++e)
+                {
+                    y[indices[e]] += values[e] * xc;
+                }
+            }
+            return;
+        }
+        std::vector<Type> partial(parts * sizeY);
+        const size_t nnz = values.size();
+        parallel_for(pool, 0, parts, 1, [&](size_t first, size_t last)
+                     {
+                         for (size_t p = first; p < last; ++p)
+                         {
+                             const size_t lo = std::lower_bound(offsets.begin(), offsets.end(), p * nnz / parts) - offsets.begin();
+                             const size_t hi = p + 1 == parts ? sizeX : std::lower_bound(offsets.begin(), offsets.end(), (p + 1) * nnz / parts) - offsets.begin();
+                             Type *acc = partial.data() + p * sizeY;
+                             for (size_t c = lo; c < std::min<size_t>(hi, sizeX); ++c)
+                             {
+                                 const Type xc = x[c];
+                                 for (size_t e = offsets[c]; e < offsets[c + 1]; ++e)
+                                 {
+                                     acc[indices[e]] += values[e] * xc;
+                                 }
+                             }
+                         }
+                     });
+        MatParallelRange(sizeY, [&](size_t first, size_t last)
+                         {
+                             for (size_t p = 0; p < parts; ++p)
+                             {
+                                 const Type *acc = partial.data() + p * sizeY;
+                                 for (size_t r = first; r < last; ++r)
+                                 {
+                                     y[r] += acc[r];
+                                 }
+                             }
+                         });
+    }
+}
+
+template <typename Type, SizeType SizeT, SparseFormat Format>
+inline std::vector<Type> SparseMat<Type, SizeT, Format>::SpMV(std::span<const Type> x) const
+{
+    std::vector<Type> y(sizeY);
+    SpMV(x, y);
+    return y;
+}
+
+template <typename Type, SizeType SizeT, SparseFormat Format>
+inline Mat<Type, SizeT> SparseMat<Type, SizeT, Format>::SpMM(MatView<const Type, SizeT> b) const
+{
+    if (b.SizeY() != sizeX)
+        throw std::invalid_argument("SpMM: dimensions invalid");
+    const size_t n = b.SizeX(), rsb = b.RowStride(), csb = b.ColStride();
+    Mat<Type, SizeT> res(b.SizeX(), sizeY);
+    const Type *src = b.data();
+    Type *dst = res.data();
+    //C row r += a * B row k, contiguous rows of B vectorize, strided ones (transposed views) take the general loop
+    const auto axpy = [n, rsb, csb, src, dst](size_t r, size_t k, Type a, size_t j0, size_t j1)
+    {
+        Type *crow = dst + r * n;
+        const Type *brow = src + k * rsb;
+        if (csb == 1)
+        {
+            for (size_t j = j0; j < j1; ++j)
+            {
+                crow[j] += a * brow[j];
+            }
+        }
+        else
+        {
+            for (size_t j = j0; j < j1; ++j)
+            {
+                crow[j] += a * brow[j * csb];
+            }
+        }
+    };
+    if constexpr (row_major)
+    {
+        ForMajors(n, [&](size_t first, size_t last)
+                  {
+                      for (size_t r = first; r < last; ++r)
+                      {
+                          for (size_t e = offsets[r]; e < offsets[r + 1]; ++e)
+                          {
+                              axpy(r, indices[e], values[e], 0, n);
+                          }
+                      }
+                  });
+    }
+    else
+    {
+        //columns of A scatter into every row of C, so tasks split C by column block instead and each walks all of A
+        const size_t threads = ThreadPool::Global().Concurrency();
+        const bool serial = threads <= 1 || values.size() * n < MAT_PARALLEL_ELEMENTS;
+        const size_t block = serial ? std::max<size_t>(n, 1) : std::max<size_t>(16, (n + threads * 4 - 1) / (threads * 4));
+        const auto cols = [&](size_t first, size_t last)
+        {
+            for (size_t blk = first; blk < last; ++blk)
+            {
+                const size_t j0 = blk * block, j1 = std::min(n, j0 + block);
+                for (size_t c = 0; c < sizeX; ++c)
+                {
+                    for (size_t e = offsets[c]; e < offsets[c + 1]; ++e)
+                    {
+                        axpy(indices[e], c, values[e], j0, j1);
+                    }
+                }
+            }
+        };
+        const size_t blocks = (n + block - 1) / block;
+        if (serial || blocks < 2)
+            cols(0, blocks);
+        else
+            parallel_for(0, blocks, 1, cols);
+    }
+    return res;
+}
+
+template <typename Type = float, SizeType SizeT = size_t>
+using CsrMat = SparseMat<Type, SizeT, SparseFormat::CSR>;
+template <typename Type = float, SizeType SizeT = size_t>
+using CscMat = SparseMat<Type, SizeT, SparseFormat::CSC>;
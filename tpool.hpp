@@ -0,0 +1,434 @@
+#pragma once
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <exception>
+#include <algorithm>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+#include "utils.hpp"
+
+//type erased unit of work, deleted by whoever runs it
+struct PoolTask
+{
+    virtual void Run() = 0;
+    virtual ~PoolTask() = default;
+};
+
+template <typename F>
+struct PoolFuncTask final : PoolTask
+{
+    F func;
+    explicit PoolFuncTask(F &&f) : func(std::move(f)) {}
+    void Run() override { func(); }
+};
+
+//Chase-Lev deque (Le, Pop, Cohen, Zappa Nardelli 2013), the owner pushes and pops the bottom, thieves steal the top
+class WorkStealingDeque
+{
+private:
+    struct Ring
+    {
+        int64_t cap;
+        std::unique_ptr<std::atomic<PoolTask *>[]> slots;
+
+        explicit Ring(int64_t c) : cap(c), slots(new std::atomic<PoolTask *>[c]) {}
+        PoolTask *Get(int64_t i) const noexcept { return slots[i & (cap - 1)].load(std::memory_order_relaxed); }
+        void Put(int64_t i, PoolTask *t) noexcept { slots[i & (cap - 1)].store(t, std::memory_order_relaxed); }
+    };
+
+    alignas(64) std::atomic<int64_t> top{0};
+    alignas(64) std::atomic<int64_t> bottom{0};
+    alignas(64) std::atomic<Ring *> ring;
+    std::vector<std::unique_ptr<Ring>> rings; //old rings stay alive until destruction, a thief may still be reading them
+
+public:
+    explicit WorkStealingDeque(int64_t cap = 256)
+    {
+        rings.emplace_back(new Ring(cap));
+        ring.store(rings.back().get(), std::memory_order_relaxed);
+    }
+    WorkStealingDeque(const WorkStealingDeque &) = delete;
+    WorkStealingDeque &operator=(const WorkStealingDeque &) = delete;
+
+    void Push(PoolTask *task) //owner only
+    {
+        const int64_t b = bottom.load(std::memory_order_relaxed);
+        const int64_t t = top.load(std::memory_order_acquire);
+        Ring *r = ring.load(std::memory_order_relaxed);
+        if (b - t > r->cap - 1)
+        {
+            Ring *grown = new Ring(r->cap * 2);
+            for (int64_t i = t; i < b; ++i)
+            {
+                grown->Put(i, r->Get(i));
+            }
+            rings.emplace_back(grown);
+            ring.store(grown, std::memory_order_release);
+            r = grown;
+        }
+        r->Put(b, task);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    PoolTask *Pop() noexcept //owner only
+    {
+        const int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        Ring *r = ring.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+        PoolTask *task = nullptr;
+        if (t <= b)
+        {
+            task = r->Get(b);
+            if (t == b)
+            {
+                //last element, race the thieves for it
+                if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                {
+                    task = nullptr;
+                }
+                bottom.store(b + 1, std::memory_order_relaxed);
+            }
+        }
+        else
+        {
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return task;
+    }
+
+    PoolTask *Steal() noexcept //any thread
+    {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t b = bottom.load(std::memory_order_acquire);
+        if (t < b)
+        {
+            PoolTask *task = ring.load(std::memory_order_acquire)->Get(t);
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            {
+                return nullptr;
+            }
+            return task;
+        }
+        return nullptr;
+    }
+
+    bool Empty() const noexcept { return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed); }
+};
+
+//work stealing thread pool, one deque per worker, external submissions go through a shared injection queue
+//threads that wait on a TaskGroup execute queued work instead of blocking, so nested fork/join cannot deadlock
+class ThreadPool
+{
+private:
+    struct alignas(64) Worker
+    {
+        WorkStealingDeque deque;
+        uint32_t rng;
+
+        explicit Worker(uint32_t seed) : rng(seed) {}
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+
+    std::mutex injectMtx;
+    std::deque<PoolTask *> inject;
+
+    std::mutex sleepMtx;
+    std::condition_variable sleepCv;
+    std::atomic<size_t> pending{0};
+    std::atomic<size_t> sleepers{0};
+    std::atomic<bool> stop{false};
+
+    static inline thread_local ThreadPool *tlPool = nullptr;
+    static inline thread_local size_t tlIndex = 0;
+
+    PoolTask *TakeInjected()
+    {
+        std::lock_guard<std::mutex> lk(injectMtx);
+        if (inject.empty())
+        {
+            return nullptr;
+        }
+        PoolTask *task = inject.front();
+        inject.pop_front();
+        return task;
+    }
+
+    PoolTask *TrySteal(size_t self)
+    {
+        const size_t n = workers.size();
+        if (!n)
+        {
+            return nullptr;
+        }
+        uint32_t &rng = self < n ? workers[self]->rng : tlRng();
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        const size_t start = rng % n;
+        for (size_t i = 0; i < n; ++i)
+        {
+            const size_t victim = (start + i) % n;
+            if (victim == self)
+            {
+                continue;
+            }
+            if (PoolTask *task = workers[victim]->deque.Steal())
+            {
+                return task;
+            }
+        }
+        return nullptr;
+    }
+
+    static uint32_t &tlRng() noexcept
+    {
+        static thread_local uint32_t rng = 0x9e3779b9u ^ static_cast<uint32_t>(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+        return rng;
+    }
+
+    void WorkerLoop(size_t index)
+    {
+        tlPool = this;
+        tlIndex = index;
+        while (true)
+        {
+            if (RunOne())
+            {
+                continue;
+            }
+            bool ran = false;
+            for (int spin = 0; spin < 64 && !ran; ++spin)
+            {
+                std::this_thread::yield();
+                ran = RunOne();
+            }
+            if (ran)
+            {
+                continue;
+            }
+            std::unique_lock<std::mutex> lk(sleepMtx);
+            sleepers.fetch_add(1, std::memory_order_seq_cst);
+            sleepCv.wait(lk, [this] { return stop.load(std::memory_order_relaxed) || pending.load(std::memory_order_seq_cst); });
+            sleepers.fetch_sub(1, std::memory_order_relaxed);
+            if (stop.load(std::memory_order_relaxed) && !pending.load(std::memory_order_relaxed))
+            {
+                return;
+            }
+        }
+    }
+
+public:
+    //the calling thread takes part when it waits, so by default one thread fewer than the hardware is spawned
+    explicit ThreadPool(size_t threadCount = std::max(1u, std::thread::hardware_concurrency()) - 1)
+    {
+        workers.reserve(threadCount);
+        for (size_t i = 0; i < threadCount; ++i)
+        {
+            workers.emplace_back(new Worker(static_cast<uint32_t>(0x9e3779b9u * (i + 1))));
+        }
+        threads.reserve(threadCount);
+        for (size_t i = 0; i < threadCount; ++i)
+        {
+            threads.emplace_back(&ThreadPool::WorkerLoop, this, i);
+        }
+    }
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    static ThreadPool &Global()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    //threads that can run work concurrently, the spawned workers plus the waiting caller
+    size_t Concurrency() const noexcept { return workers.size() + 1; }
+
+    bool OnWorker() const noexcept { return tlPool == this; }
+
+    //takes ownership of task
+    void Submit(PoolTask *task)
+    {
+        pending.fetch_add(1, std::memory_order_seq_cst);
+        if (OnWorker())
+        {
+            workers[tlIndex]->deque.Push(task);
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lk(injectMtx);
+            inject.push_back(task);
+        }
+        if (sleepers.load(std::memory_order_seq_cst))
+        {
+            {
+                std::lock_guard<std::mutex> lk(sleepMtx);
+            }
+            sleepCv.notify_one();
+        }
+    }
+
+    template <typename F>
+    void Run(F &&func)
+    {
+        Submit(new PoolFuncTask<std::decay_t<F>>(std::decay_t<F>(std::forward<F>(func))));
+    }
+
+    //executes at most one queued task on the calling thread, returns whether one ran
+    bool RunOne()
+    {
+        const size_t self = OnWorker() ? tlIndex : workers.size();
+        PoolTask *task = self < workers.size() ? workers[self]->deque.Pop() : nullptr;
+        if (!task)
+        {
+            task = TakeInjected();
+        }
+        if (!task)
+        {
+            task = TrySteal(self);
+        }
+        if (!task)
+        {
+            return false;
+        }
+        pending.fetch_sub(1, std::memory_order_relaxed);
+        task->Run();
+        delete task;
+        return true;
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lk(sleepMtx);
+            stop.store(true, std::memory_order_relaxed);
+        }
+        sleepCv.notify_all();
+        for (std::thread &t : threads)
+        {
+            t.join();
+        }
+    }
+};
+
+//fork/join scope, Run forks a task and Wait joins all of them, running pool work while it waits
+//the first exception thrown by a task is rethrown from Wait
+class TaskGroup
+{
+private:
+    ThreadPool &pool;
+    std::atomic<size_t> outstanding{0};
+    std::atomic<bool> failed{false};
+    std::exception_ptr error;
+
+public:
+    explicit TaskGroup(ThreadPool &p = ThreadPool::Global()) noexcept : pool(p) {}
+    TaskGroup(const TaskGroup &) = delete;
+    TaskGroup &operator=(const TaskGroup &) = delete;
+
+    template <typename F>
+    void Run(F &&func)
+    {
+        outstanding.fetch_add(1, std::memory_order_relaxed);
+        pool.Run([this, f = std::decay_t<F>(std::forward<F>(func))]() mutable
+                 {
+                     try
+                     {
+                         f();
+                     }
+                     catch (...)
+                     {
+                         if (!failed.exchange(true))
+                         {
+                             error = std::current_exception();
+                         }
+                     }
+                     outstanding.fetch_sub(1, std::memory_order_release);
+                 });
+    }
+
+    void Wait()
+    {
+        while (outstanding.load(std::memory_order_acquire))
+        {
+            if (!pool.RunOne())
+            {
+                std::this_thread::yield();
+            }
+        }
+        if (failed.load(std::memory_order_acquire))
+        {
+            failed.store(false, std::memory_order_relaxed);
+            std::rethrow_exception(std::exchange(error, nullptr));
+        }
+    }
+
+    ~TaskGroup()
+    {
+        while (outstanding.load(std::memory_order_acquire))
+        {
+            if (!pool.RunOne())
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+};
+
+//calls body(first, last) over disjoint chunks of [begin, end), chunks are at least grain long
+//ranges that fit in one grain run inline on the caller
+template <typename F>
+inline void parallel_for(ThreadPool &pool, size_t begin, size_t end, size_t grain, F &&body)
+{
+    if (end <= begin)
+    {
+        return;
+    }
+    const size_t n = end - begin;
+    grain = std::max<size_t>(grain, 1);
+    const size_t chunks = std::min((n + grain - 1) / grain, pool.Concurrency() * 4);
+    if (chunks <= 1)
+    {
+        body(begin, end);
+        return;
+    }
+    const size_t step = n / chunks, extra = n % chunks;
+    TaskGroup group(pool);
+    size_t first = begin + step + (extra ? 1 : 0);
+    for (size_t c = 1; c < chunks; ++c)
+    {
+        const size_t last = first + step + (c < extra ? 1 : 0);
+        group.Run([&body, first, last] { body(first, last); });
+        first = last;
+    }
+    body(begin, begin + step + (extra ? 1 : 0));
+    group.Wait();
+}
+
+template <typename F>
+inline void parallel_for(size_t begin, size_t end, size_t grain, F &&body)
+{
+    parallel_for(ThreadPool::Global(), begin, end, grain, std::forward<F>(body));
+}
+
+//runs every callable concurrently and returns once all have finished
+template <typename F, typename... Fs>
+inline void parallel_invoke(F &&first, Fs &&...rest)
+{
+    TaskGroup group;
+    (group.Run(std::forward<Fs>(rest)), ...);
+    first();
+    group.Wait();
+}
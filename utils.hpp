@@ -1,5 +1,20 @@
 #pragma once
+#include <algorithm>
+#include <cassert>
 #include <type_traits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
 
 #ifdef _MSC_VER
 #define ALWAYS_INLINE __forceinline
@@ -7,6 +22,39 @@
 #define ALWAYS_INLINE inline __attribute((__always_inline__))
 #endif
 
+//bounds checks on element accessors (Mat, MatView, MappedMat, SparseMat, BitMat, FastMatBatch), 2 throws std::out_of_range, 1 only asserts, 0 trusts the caller
+//defaults to throwing in debug builds and unchecked under NDEBUG, Block and shape checks always throw
+#ifndef MAT_BOUNDS_CHECK
+#ifdef NDEBUG
+#define MAT_BOUNDS_CHECK 0
+#else
+#define MAT_BOUNDS_CHECK 2
+#endif
+#endif
+
+//kept out of line so building the message never weighs on the inlined accessors
+[[noreturn]] inline void MatOutOfRange(const char *who, size_t x, size_t y)
+{
+    throw std::out_of_range(std::string(who) + ": out of range, " + std::to_string(x) + ' ' + std::to_string(y));
+}
+[[noreturn]] inline void MatOutOfRange(const char *who, size_t index)
+{
+    throw std::out_of_range(std::string(who) + ": index out of range, " + std::to_string(index));
+}
+
+#if MAT_BOUNDS_CHECK >= 2
+#define MAT_BOUNDS(cond, fail)        \
+    do                                \
+    {                                 \
+        if (!(cond)) [[unlikely]]     \
+            fail;                     \
+    } while (0)
+#elif MAT_BOUNDS_CHECK == 1
+#define MAT_BOUNDS(cond, fail) assert(cond)
+#else
+#define MAT_BOUNDS(cond, fail) ((void)0)
+#endif
+
 template <class T>
 inline void hash_combine(std::size_t& seed, const T& v)
 {
@@ -24,6 +72,211 @@ struct copy_fast : std::conditional<std::is_trivially_copyable_v<T>, T, const T
 template <typename T>
 using copy_fast_t = typename copy_fast<T>::type;
 
+//std conforming allocator handing out Align byte aligned storage, for SIMD loads and cache line aligned rows
+template <typename T, size_t Align = 64>
+struct AlignedAllocator
+{
+    static_assert(Align >= alignof(T) && !(Align & (Align - 1)), "Align must be a power of two no smaller than alignof(T)");
+    using value_type = T;
+    template <typename U>
+    struct rebind
+    {
+        using other = AlignedAllocator<U, Align>;
+    };
+
+    constexpr AlignedAllocator() noexcept = default;
+    template <typename U>
+    constexpr AlignedAllocator(const AlignedAllocator<U, Align> &) noexcept {}
+
+    T *allocate(size_t n)
+    {
+        if (n > size_t(-1) / sizeof(T))
+            throw std::bad_array_new_length();
+        return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t{Align}));
+    }
+    void deallocate(T *p, size_t) noexcept { ::operator delete(p, std::align_val_t{Align}); }
+
+    template <typename U>
+    constexpr bool operator==(const AlignedAllocator<U, Align> &) const noexcept { return true; }
+};
+
+//compile time unrolled loop, f receives std::integral_constant<size_t, I> for I in [0, N) so the index stays constexpr
+template <typename F, size_t... I>
+constexpr void static_for_impl(F &&f, std::index_sequence<I...>) { (f(std::integral_constant<size_t, I>{}), ...); }
+template <size_t N, typename F>
+constexpr void static_for(F &&f) { static_for_impl(f, std::make_index_sequence<N>{}); }
+
+//murmur3 finalizer, every input bit affects every output bit
+constexpr uint64_t HashMix64(uint64_t h) noexcept
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    return h ^ (h >> 33);
+}
+
+//bulk hash of contiguous memory, the XXH3 construction: 8 independent 64 bit lanes eat 64 byte stripes with 32x32->64 bit multiplies
+//(SSE2 pmuludq, two stripes per step with AVX2), lanes are scrambled every 1KiB and folded with the length and seed at the end
+//every path gives the same value, but it depends on endianness, don't persist it
+inline constexpr uint64_t hash_keys[8] = {0xbe4ba423396cfeb8ull, 0x1cad21f72c81017cull, 0xdb979083e96dd4deull, 0x1f67b3b7a4a44072ull,
+                                          0x78e5c0cc4ee679cbull, 0x2172ffcc7dd05a82ull, 0x8e2443f7744608b8ull, 0x4c263a81e69035e0ull};
+
+//element types hashed by their bytes, -0.0 and +0.0 are made equal first, other types fall back to std::hash per element
+template <typename T>
+inline constexpr bool hash_bulk_v = std::is_floating_point_v<T> ? std::numeric_limits<T>::is_iec559 && (sizeof(T) == 4 || sizeof(T) == 8) : std::has_unique_object_representations_v<T>;
+
+//stripes in groups of 16, each group followed by a scramble
+template <typename T>
+inline void HashStripes(uint64_t (&acc)[8], const unsigned char *p, size_t stripes, uint64_t seed) noexcept
+{
+#if defined(__AVX2__)
+    __m256i a[2], k[2];
+    for (size_t j = 0; j < 2; ++j)
+    {
+        a[j] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(acc + 4 * j));
+        k[j] = _mm256_add_epi64(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(hash_keys + 4 * j)), _mm256_set1_epi64x(int64_t(seed)));
+    }
+    const __m256i sk[2] = {_mm256_setr_epi64x(int64_t(hash_keys[7]), int64_t(hash_keys[6]), int64_t(hash_keys[5]), int64_t(hash_keys[4])),
+                           _mm256_setr_epi64x(int64_t(hash_keys[3]), int64_t(hash_keys[2]), int64_t(hash_keys[1]), int64_t(hash_keys[0]))};
+    const __m256i prime = _mm256_set1_epi64x(0x9e3779b1);
+    while (stripes)
+    {
+        const size_t group = std::min<size_t>(stripes, 16);
+        for (size_t s = 0; s < group; ++s, p += 64)
+        {
+            static_for<2>([&](auto j)
+            {
+                __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 32 * j));
+                if constexpr (std::is_same_v<T, float>)
+                    d = _mm256_castps_si256(_mm256_andnot_ps(_mm256_cmp_ps(_mm256_castsi256_ps(d), _mm256_setzero_ps(), _CMP_EQ_OQ), _mm256_castsi256_ps(d)));
+                else if constexpr (std::is_same_v<T, double>)
+                    d = _mm256_castpd_si256(_mm256_andnot_pd(_mm256_cmp_pd(_mm256_castsi256_pd(d), _mm256_setzero_pd(), _CMP_EQ_OQ), _mm256_castsi256_pd(d)));
+                const __m256i v = _mm256_xor_si256(d, k[j]);
+                const __m256i prod = _mm256_mul_epu32(v, _mm256_srli_epi64(v, 32));
+                a[j] = _mm256_add_epi64(a[j], _mm256_add_epi64(_mm256_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2)), prod));
+            });
+        }
+        for (size_t j = 0; j < 2; ++j)
+        {
+            const __m256i x = _mm256_xor_si256(_mm256_xor_si256(a[j], _mm256_srli_epi64(a[j], 47)), sk[j]);
+            a[j] = _mm256_add_epi64(_mm256_mul_epu32(x, prime), _mm256_slli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(x, 32), prime), 32));
+        }
+        stripes -= group;
+    }
+    for (size_t j = 0; j < 2; ++j)
+    {
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(acc + 4 * j), a[j]);
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128i a[4], k[4], sk[4];
+    for (size_t j = 0; j < 4; ++j)
+    {
+        a[j] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(acc + 2 * j));
+        k[j] = _mm_add_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i *>(hash_keys + 2 * j)), _mm_set1_epi64x(int64_t(seed)));
+        sk[j] = _mm_set_epi64x(int64_t(hash_keys[6 - 2 * j]), int64_t(hash_keys[7 - 2 * j]));
+    }
+    const __m128i prime = _mm_set1_epi64x(0x9e3779b1);
+    while (stripes)
+    {
+        const size_t group = std::min<size_t>(stripes, 16);
+        for (size_t s = 0; s < group; ++s, p += 64)
+        {
+            static_for<4>([&](auto j)
+            {
+                __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16 * j));
+                if constexpr (std::is_same_v<T, float>)
+                    d = _mm_castps_si128(_mm_andnot_ps(_mm_cmpeq_ps(_mm_castsi128_ps(d), _mm_setzero_ps()), _mm_castsi128_ps(d)));
+                else if constexpr (std::is_same_v<T, double>)
+                    d = _mm_castpd_si128(_mm_andnot_pd(_mm_cmpeq_pd(_mm_castsi128_pd(d), _mm_setzero_pd()), _mm_castsi128_pd(d)));
+                const __m128i v = _mm_xor_si128(d, k[j]);
+                const __m128i prod = _mm_mul_epu32(v, _mm_srli_epi64(v, 32));
+                a[j] = _mm_add_epi64(a[j], _mm_add_epi64(_mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2)), prod));
+            });
+        }
+        for (size_t j = 0; j < 4; ++j)
+        {
+            const __m128i x = _mm_xor_si128(_mm_xor_si128(a[j], _mm_srli_epi64(a[j], 47)), sk[j]);
+            a[j] = _mm_add_epi64(_mm_mul_epu32(x, prime), _mm_slli_epi64(_mm_mul_epu32(_mm_srli_epi64(x, 32), prime), 32));
+        }
+        stripes -= group;
+    }
+    for (size_t j = 0; j < 4; ++j)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(acc + 2 * j), a[j]);
+    }
+#else
+    while (stripes)
+    {
+        const size_t group = std::min<size_t>(stripes, 16);
+        for (size_t s = 0; s < group; ++s, p += 64)
+        {
+            uint64_t w[8];
+            if constexpr (std::is_floating_point_v<T>)
+            {
+                T v[64 / sizeof(T)];
+                std::memcpy(v, p, 64);
+                for (T &x : v)
+                {
+                    x = x == T(0) ? T(0) : x;
+                }
+                std::memcpy(w, v, 64);
+            }
+            else
+            {
+                std::memcpy(w, p, 64);
+            }
+            for (size_t i = 0; i < 8; ++i)
+            {
+                const uint64_t v = w[i] ^ (hash_keys[i] + seed);
+                acc[i] += w[i ^ 1] + (v & 0xffffffffu) * (v >> 32);
+            }
+        }
+        for (size_t i = 0; i < 8; ++i)
+        {
+            acc[i] = (acc[i] ^ (acc[i] >> 47) ^ hash_keys[7 - i]) * 0x9e3779b1u;
+        }
+        stripes -= group;
+    }
+#endif
+}
+
+template <typename T>
+inline uint64_t HashValues(const T *values, size_t n, uint64_t seed = 0) noexcept
+{
+    if constexpr (!hash_bulk_v<T>)
+    {
+        size_t h = size_t(seed);
+        for (size_t i = 0; i < n; ++i)
+        {
+            hash_combine(h, values[i]);
+        }
+        return HashMix64(uint64_t(h) ^ n);
+    }
+    else
+    {
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(values);
+        const size_t bytes = n * sizeof(T);
+        uint64_t acc[8] = {0x9e3779b1u, 0x9e3779b185ebca87ull, 0xc2b2ae3d27d4eb4full, 0x165667b19e3779f9ull,
+                           0x85ebca77c2b2ae63ull, 0x85ebca77u, 0x27d4eb2f165667c5ull, 0xc2b2ae3du};
+        HashStripes<T>(acc, p, bytes / 64, seed);
+        if (const size_t rest = bytes % 64)
+        {
+            alignas(64) unsigned char tail[64] = {};
+            std::memcpy(tail, p + bytes - rest, rest);
+            HashStripes<T>(acc, tail, 1, seed);
+        }
+        uint64_t h = uint64_t(bytes) * 0x9e3779b185ebca87ull ^ seed;
+        for (size_t k = 0; k < 8; ++k)
+        {
+            h = (h ^ HashMix64(acc[k] + hash_keys[k])) * 0x100000001b3ull;
+        }
+        return HashMix64(h);
+    }
+}
+
+inline uint64_t HashBytes(const void *p, size_t bytes, uint64_t seed = 0) noexcept { return HashValues(static_cast<const unsigned char *>(p), bytes, seed); }
+
 //implies value metafunction
 template <bool A, bool B>
 constexpr bool implies_v = !(A && !B);
@@ -73,42 +326,45 @@ constexpr bool implies_v = !(A && !B);
         static constexpr bool value = decltype(check<C>(nullptr))::value;                                                               \
     };
 
-#define GET(v, i) v &(1 << i)
-#define SET(v, i) v ^= (1 << i)
-#define ON(v, i) v |= (1 << i)
-#define OFF(v, i) v &= ~(1 << i)
+//single bits of an integer, the mask has v's (promoted) type so bits past 31 of 64 bit values work, BitMat packs whole matrices
+#define GET(v, i) ((v) & (decltype(+(v))(1) << (i)))
+#define SET(v, i) ((v) ^= (decltype(+(v))(1) << (i)))
+#define ON(v, i) ((v) |= (decltype(+(v))(1) << (i)))
+#define OFF(v, i) ((v) &= ~(decltype(+(v))(1) << (i)))
 
 #include <ctime>
 #include <ratio>
 #include <chrono>
 
+//DEPRECATED, kept for old call sites, bench.hpp has warmup, calibration, DoNotOptimize and percentiles
+//timers accumulate in 64 bit nanoseconds on steady_clock, the 32 bit sum used to wrap after ~4.3 seconds
 #define time_func_a(f, a, x)                                                                  \
     {                                                                                         \
         using namespace std::chrono;                                                          \
-        uint32_t timer = 0;                                                                   \
+        uint64_t timer = 0;                                                                   \
         for (int i = 0; i < x; ++i)                                                           \
         {                                                                                     \
-            auto t1 = high_resolution_clock::now().time_since_epoch();                        \
+            auto t1 = steady_clock::now();                                                    \
             f;                                                                                \
-            auto t2 = high_resolution_clock::now().time_since_epoch();                        \
+            auto t2 = steady_clock::now();                                                    \
             a;                                                                                \
-            timer += std::chrono::duration_cast<std::chrono::nanoseconds>((t2 - t1)).count(); \
+            timer += uint64_t(duration_cast<nanoseconds>(t2 - t1).count());                   \
         }                                                                                     \
-        std::cout << timer / x << '\n';                                                       \
+        std::cout << timer / uint64_t(x) << '\n';                                             \
     }
 
 #define time_func(f, x)                                                                       \
     {                                                                                         \
         using namespace std::chrono;                                                          \
-        uint32_t timer = 0;                                                                   \
+        uint64_t timer = 0;                                                                   \
         for (int i = 0; i < x; ++i)                                                           \
         {                                                                                     \
-            auto t1 = high_resolution_clock::now().time_since_epoch();                        \
+            auto t1 = steady_clock::now();                                                    \
             f;                                                                                \
-            auto t2 = high_resolution_clock::now().time_since_epoch();                        \
-            timer += std::chrono::duration_cast<std::chrono::nanoseconds>((t2 - t1)).count(); \
+            auto t2 = steady_clock::now();                                                    \
+            timer += uint64_t(duration_cast<nanoseconds>(t2 - t1).count());                   \
         }                                                                                     \
-        std::cout << timer / x << '\n';                                                       \
+        std::cout << timer / uint64_t(x) << '\n';                                             \
     }
 
 #define Op_a(v, name, x, a)   \